@@ -1,6 +1,8 @@
 #pragma once
 #include <vector>
+#include <span>
 #include <cstdint>
+#include <cstddef>
 
 #define BLOCK_STATIC_SIZE 20
 
@@ -10,8 +12,32 @@ struct Block {
     std::vector<char> payload;
     uint32_t crc32;
     std::vector<char> serialize() const;
+    void serialize_into(char* buffer) const;
     size_t deserialize(const char* buffer);
 
+    uint32_t compute_crc() const;
     bool is_valid() const;
     void update_crc();
-};
\ No newline at end of file
+    // reuses a CRC of the payload computed upstream, the payload bytes are not read again
+    void update_crc(uint32_t payload_crc);
+};
+
+// Non-owning view over a serialized block, the CRC is checked on the buffer in place
+class BlockView {
+    private:
+        const char* data_;
+        size_t size_;
+    public:
+        BlockView(const char* data, size_t size);
+        explicit BlockView(std::span<const char> buffer);
+
+        uint64_t timestamp() const;
+        uint64_t block_payload_size() const;
+        std::span<const char> payload() const;
+        uint32_t crc32() const;
+
+        bool is_well_formed() const;
+        uint32_t compute_crc() const;
+        bool is_valid() const;
+        Block to_block() const;
+};
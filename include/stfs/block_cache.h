@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#define BLOCK_CACHE_DEFAULT_SHARDS 16
+#define BLOCK_CACHE_ENTRY_OVERHEAD 64 // bookkeeping charged per entry on top of its data
+
+struct BlockCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t bytes;   // charged against the capacity, overhead included
+    uint64_t entries;
+};
+
+// Verified copies of blocks keyed by id, split into shards that each own a slice of the byte budget
+// and evict with CLOCK. A miss hands out the shard epoch, insert() drops the copy if an invalidation
+// landed in the shard since then, so a reader that lost a race with the writer cannot cache old data.
+class BlockCache {
+    private:
+        struct Entry
+        {
+            uint64_t key;
+            std::vector<char> data;
+            bool referenced;
+        };
+
+        struct alignas(64) Shard
+        {
+            std::mutex mutex;
+            std::vector<Entry> entries; // the clock, hand sweeps it in order
+            std::unordered_map<uint64_t, size_t> slots;
+            size_t hand = 0;
+            size_t bytes = 0;
+            uint64_t epoch = 0; // bumped by every invalidation
+        };
+
+        std::unique_ptr<Shard[]> shards_;
+        uint64_t shard_mask_;
+        std::atomic<size_t> shard_capacity_ = 0;
+
+        std::atomic<uint64_t> hits_ = 0;
+        std::atomic<uint64_t> misses_ = 0;
+        std::atomic<uint64_t> insertions_ = 0;
+        std::atomic<uint64_t> evictions_ = 0;
+        std::atomic<uint64_t> invalidations_ = 0;
+
+        Shard &shard_for(uint64_t key) const;
+        void remove(Shard &shard, size_t slot);
+        void evict(Shard &shard, size_t capacity, size_t incoming);
+    public:
+        explicit BlockCache(size_t shards = BLOCK_CACHE_DEFAULT_SHARDS); // rounded up to a power of two
+
+        // 0 disables the cache and drops what it holds
+        void set_capacity(size_t bytes);
+        size_t get_capacity() const;
+
+        // on a miss epoch is set for the insert() that follows
+        bool lookup(uint64_t key, std::span<char> out, uint64_t &epoch);
+        void insert(uint64_t key, std::span<const char> data, uint64_t epoch);
+        void invalidate(uint64_t key);
+        void clear();
+
+        BlockCacheStats get_stats() const;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+enum class PayloadCodec : uint8_t
+{
+    None,
+    Lz // built-in byte-oriented LZ77, no external dependency
+};
+
+// Encodes the data of one block as a stream. Each append may grow the output only up to a budget,
+// so a packer learns how much of a record still fits and carries the rest to the next block.
+class BlockEncoder {
+    public:
+        virtual ~BlockEncoder() = default;
+
+        // encodes the longest prefix of data that keeps the output within budget bytes, returns its size
+        virtual size_t append(std::span<const char> data, size_t budget) = 0;
+
+        virtual std::span<const char> output() const = 0;
+        virtual std::span<const char> raw() const = 0; // everything appended so far, unencoded
+        virtual void reset() = 0;
+};
+
+class StoreEncoder : public BlockEncoder {
+    private:
+        std::vector<char> data_;
+    public:
+        size_t append(std::span<const char> data, size_t budget) override;
+
+        std::span<const char> output() const override;
+        std::span<const char> raw() const override;
+        void reset() override;
+};
+
+// Sequences of a token (literal count | match length - 3, 0 - no match), extra length bytes,
+// literals and a little endian 16-bit match offset. Later appends match against earlier ones.
+class LzEncoder : public BlockEncoder {
+    private:
+        std::vector<char> history_;
+        std::vector<char> output_;
+        std::vector<uint32_t> table_; // hash of 4 bytes -> position + 1
+
+        void emit(const char *literals, size_t literal_count, size_t match_length, size_t offset);
+    public:
+        LzEncoder();
+
+        size_t append(std::span<const char> data, size_t budget) override;
+
+        std::span<const char> output() const override;
+        std::span<const char> raw() const override;
+        void reset() override;
+};
+
+std::unique_ptr<BlockEncoder> make_block_encoder(PayloadCodec codec);
+
+// output must be sized to the raw data, false when input does not decode to exactly that
+bool decode_block(PayloadCodec codec, std::span<const char> input, std::span<char> output);
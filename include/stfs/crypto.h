@@ -2,4 +2,13 @@
 #include <cstdint>
 
 uint32_t generate_CRC32(const uint8_t* data, uint64_t data_size);
-bool validate_CRC32(const uint8_t* data, uint32_t crc32, uint64_t data_size);
\ No newline at end of file
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, uint64_t data_size);
+// CRC of A followed by B from the CRCs of A and B, without touching the bytes again
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b);
+bool validate_CRC32(const uint8_t* data, uint32_t crc32, uint64_t data_size);
+
+// CRC of a serialized record whose trailing crc32 field is hashed as zeros
+uint32_t generate_record_CRC32(const char* data, uint64_t record_size);
+
+// name of the kernel picked for this CPU
+const char* crc32_kernel_name();
\ No newline at end of file
@@ -3,7 +3,14 @@
 #include <cstdint>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <span>
 #include <stdexcept>
+#ifdef _WIN32
+#include <mutex>
+#endif
 
 #define DEVICE_HEAD_SIZE 9
 struct DeviceHead {
@@ -20,17 +27,31 @@ public:
     DeviceError(const std::string &msg) : std::runtime_error(msg) {}
 };
 
+// Devices accept concurrent read_into calls, also while another thread writes or syncs.
 class Device {
     public:
         virtual const DeviceHead& get_head() const = 0;
         virtual void write(size_t position, const char* data, size_t size) = 0;
-        virtual std::unique_ptr<char[]> read(size_t position, std::size_t size) = 0;
+        virtual void read_into(size_t position, std::span<char> buffer) = 0;
+        virtual std::unique_ptr<char[]> read(size_t position, std::size_t size);
+        virtual void sync() = 0;
+
+        // queued variants, the buffer must stay valid until the future is ready;
+        // devices without a submission queue complete the request before returning
+        virtual std::future<void> read_async(size_t position, std::span<char> buffer);
+        virtual std::future<void> write_async(size_t position, const char* data, size_t size);
         virtual ~Device() = default;
 };
 
+// Positional reads and writes, so readers on different threads never share a file position.
 class FileDevice: public Device {
     private:
+#ifdef _WIN32
         std::fstream file_;
+        std::mutex file_mutex_;
+#else
+        int fd_ = -1;
+#endif
         uint64_t head_offset_;
         DeviceHead head_;
         
@@ -42,6 +63,7 @@ class FileDevice: public Device {
         static std::unique_ptr<Device> format(const std::string& filename, uint64_t head_offset, uint64_t total_blocks_on_disk, uint8_t disk_id);
         const DeviceHead& get_head() const override;
         void write(size_t position, const char* data, size_t size) override;
-        std::unique_ptr<char[]> read(size_t position, std::size_t size) override;
+        void read_into(size_t position, std::span<char> buffer) override;
+        void sync() override;
         ~FileDevice();
 };
\ No newline at end of file
@@ -4,18 +4,54 @@
 #include <stfs/block.h>
 #include <stfs/storage_cluster.h>
 #include <stfs/journal.h>
+#include <stfs/scanner.h>
+#include <stfs/record_block.h>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <vector>
 
+// Safe to share between threads: reads run concurrently, writes go through the journal one at a time.
 class Fs{
     private:
         StorageCluster& cluster_;
         Journal& journal_;
+        std::mutex write_mutex_;
+        std::optional<RecordBlockBuilder> open_records_; // guarded by write_mutex_
+        uint64_t last_record_timestamp_ = 0;
+        std::atomic<SearchStrategy> search_strategy_ = SearchStrategy::Interpolation;
 
         Block read_block(uint64_t id);
+        BlockView read_block_view(uint64_t id, std::span<char> buffer);
+        uint64_t read_timestamp(uint64_t id);
+        TimeStampFetcher probing_fetcher(uint64_t &probes);
+        uint64_t find_first_logical_id(uint64_t timestamp, RingBufferState state);
+        void commit_blocks(std::span<const Block> blocks);
+        void require_packed_records() const;
     public:
         Fs(StorageCluster& cluster_ref, Journal& journal_ref);
+        ~Fs();
         void  create_block(uint64_t timestamp, const char *payload);
         void  add_block(Block block);
+        void  add_blocks(std::span<const Block> blocks);
+        uint64_t get_max_transaction_blocks() const;
         Block get_block_by_id(uint64_t id);
+        BlockView get_block_view_by_id(uint64_t id, std::span<char> buffer);
         Block get_block_by_timestamp(uint64_t timestamp);
+        void  enable_sparse_index(uint64_t stride);
+        // how timestamp lookups and scans find their first block, probes per search go to the SearchProbes metric
+        void  set_search_strategy(SearchStrategy strategy);
+        BlockScanner scan(uint64_t from_timestamp, uint64_t to_timestamp, ScanDirection direction = ScanDirection::Forward);
+
+        // Packed clusters only. Records are appended in timestamp order and buffered until their block fills,
+        // a record larger than the free space is split into fragments over as many blocks as it needs.
+        void append_record(uint64_t timestamp, std::span<const char> data);
+        // commits the partly filled block, what it has left stays unused
+        void flush_records();
+        // first committed record stamped at or after timestamp
+        std::optional<Record> get_record_by_timestamp(uint64_t timestamp);
+        RecordScanner scan_records(uint64_t from_timestamp, uint64_t to_timestamp);
+
+        MetricsSnapshot get_metrics_snapshot() const;
 };
\ No newline at end of file
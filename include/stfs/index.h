@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define INDEX_ENTRY_SIZE 28
+
+struct IndexEntry
+{
+    uint64_t timestamp = 0;
+    uint64_t block_id = 0;  // ring slot the entry describes
+    uint64_t sequence = 0;  // write ordinal of the block, tells current lap from stale entries
+    uint32_t crc32 = 0;
+
+    std::vector<char> serialize() const;
+    void serialize_into(char *buffer) const;
+    size_t deserialize(const char *buffer);
+
+    bool is_valid() const;
+    void update_crc();
+};
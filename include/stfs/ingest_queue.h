@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <stfs/block.h>
+#include <stfs/fs.h>
+
+struct IngestQueueOptions
+{
+    size_t capacity = 1024;        // rounded up to a power of two
+    uint64_t max_batch_blocks = 0; // 0 - as many as one journal transaction holds
+};
+
+struct IngestQueueStats
+{
+    uint64_t blocks_committed;
+    uint64_t blocks_failed;
+    uint64_t batches;
+};
+
+// Producers enqueue blocks without taking a lock and get a future that is ready once the block
+// is committed. One writer thread drains the queue through Fs::add_blocks, whatever piled up
+// while it was writing goes into the next transaction. A full queue makes submit() wait and
+// try_submit() refuse.
+class IngestQueue {
+    private:
+        struct alignas(64) Cell
+        {
+            std::atomic<uint64_t> sequence;
+            Block block;
+            std::promise<void> committed;
+        };
+
+        Fs& fs_;
+        uint64_t max_batch_blocks_;
+        uint64_t mask_;
+        std::unique_ptr<Cell[]> cells_;
+
+        alignas(64) std::atomic<uint64_t> enqueue_position_ = 0;
+        alignas(64) uint64_t dequeue_position_ = 0; // writer thread only
+        alignas(64) std::atomic<uint64_t> writer_wakeups_ = 0;
+        alignas(64) std::atomic<uint64_t> dequeued_ = 0; // producers waiting for room watch it
+        std::atomic<uint64_t> active_producers_ = 0;
+        std::atomic<bool> stopping_ = false;
+
+        std::atomic<uint64_t> blocks_committed_ = 0;
+        std::atomic<uint64_t> blocks_failed_ = 0;
+        std::atomic<uint64_t> batches_ = 0;
+
+        std::thread writer_;
+
+        std::optional<std::future<void>> try_enqueue(Block &block);
+        bool is_empty() const;
+        void enter_producer();
+        void leave_producer();
+        void writer_loop();
+        void commit(std::vector<Block> &blocks, std::vector<std::promise<void>> &promises);
+    public:
+        explicit IngestQueue(Fs& fs, const IngestQueueOptions& options = {});
+        IngestQueue(const IngestQueue&) = delete;
+        IngestQueue& operator=(const IngestQueue&) = delete;
+        ~IngestQueue();
+
+        std::future<void> submit(Block block);
+        // the block is only moved from when it was queued
+        std::optional<std::future<void>> try_submit(Block &&block);
+
+        // commits everything already queued, submits after it throw
+        void stop();
+
+        IngestQueueStats get_stats() const;
+};
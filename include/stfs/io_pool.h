@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+struct IoRequest
+{
+    uint8_t device_id;
+    std::function<void()> work;
+};
+
+// One worker thread per device, so requests for different devices are issued at the same time
+// while requests for the same device keep their submission order.
+class IoWorkerPool {
+    private:
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable wakeup;
+            std::deque<std::function<void()>> queue;
+            bool stopping = false;
+        };
+
+        std::map<uint8_t, std::unique_ptr<Worker>> workers_;
+
+        static void worker_loop(Worker &worker);
+    public:
+        IoWorkerPool() = default;
+        IoWorkerPool(const IoWorkerPool &) = delete;
+        IoWorkerPool &operator=(const IoWorkerPool &) = delete;
+        ~IoWorkerPool();
+
+        void add_device(uint8_t device_id);
+        void stop();
+
+        // runs every request on its device worker and waits for all of them,
+        // the first failure in submission order is rethrown once all requests are done
+        void run(std::vector<IoRequest> &requests);
+};
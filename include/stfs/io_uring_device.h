@@ -0,0 +1,94 @@
+#pragma once
+#include <stfs/device.h>
+
+#ifdef __linux__
+
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+struct io_uring_sqe;
+
+struct IoUringOptions
+{
+    unsigned queue_depth = 64;
+    bool direct_io = false; // O_DIRECT, unaligned requests go through a per-slot aligned bounce buffer
+};
+
+// Device on a raw io_uring instance. Up to queue_depth reads and writes are in flight at once,
+// a reaper thread completes them, the synchronous calls wait on the returned future.
+class IoUringDevice: public Device {
+    private:
+        struct Ring;
+        struct Request
+        {
+            std::promise<void> done;
+            char* buffer;
+            size_t position;
+            size_t remaining;
+            size_t required_end; // a bounced read may stop at the end of file once it got this far
+            std::span<char> copy_out; // caller buffer a bounced read is copied into on completion
+            size_t copy_offset;
+            size_t locked_begin; // sectors a bounced write rewrites, empty for other requests
+            size_t locked_end;
+            bool is_write;
+            bool fixed;
+            bool bounced;
+        };
+        struct BounceBuffer
+        {
+            std::unique_ptr<char, decltype(&std::free)> data{nullptr, &std::free};
+            size_t size = 0;
+        };
+
+        int fd_ = -1;
+        int wake_fd_ = -1; // eventfd the reaper polls next to the ring, written once on destruction
+        std::unique_ptr<Ring> ring_;
+        uint64_t head_offset_;
+        DeviceHead head_;
+        bool direct_io_;
+
+        std::mutex mutex_;
+        std::condition_variable slot_freed_;
+        std::vector<Request> requests_;
+        std::vector<uint32_t> free_slots_;
+        std::vector<BounceBuffer> bounce_; // one per slot when direct_io is set
+        std::span<char> registered_buffer_;
+        std::thread reaper_;
+        std::string reaper_error_; // guarded by mutex_, set once the reaper gave up on the ring
+
+        IoUringDevice(const std::string& filename, uint64_t offset, bool is_new_file, const IoUringOptions& options);
+        void release();
+        io_uring_sqe& next_sqe();
+        void publish_sqe();
+        void push_request(uint32_t slot);
+        void complete(uint32_t slot, int result);
+        void reap_loop();
+        void fail_pending(const std::string& error);
+        void release_slot(uint32_t slot);
+        void drain(std::unique_lock<std::mutex>& lock);
+        std::future<void> submit(size_t position, char* buffer, size_t size, bool is_write);
+        bool is_aligned(size_t position, const char* buffer, size_t size) const;
+        bool sectors_locked(size_t begin, size_t end) const;
+        void read_sector(size_t position, char* sector);
+        void stage_bounce(uint32_t slot, size_t begin, size_t end, size_t position, const char* data, size_t size, bool is_write);
+        void read_head();
+        void write_head();
+    public:
+        static std::unique_ptr<Device> open(const std::string& dev_filename, uint64_t head_offset, const IoUringOptions& options = {});
+        static std::unique_ptr<Device> format(const std::string& filename, uint64_t head_offset, uint64_t total_blocks_on_disk, uint8_t disk_id, const IoUringOptions& options = {});
+        const DeviceHead& get_head() const override;
+        void write(size_t position, const char* data, size_t size) override;
+        void read_into(size_t position, std::span<char> buffer) override;
+        void sync() override;
+        std::future<void> read_async(size_t position, std::span<char> buffer) override;
+        std::future<void> write_async(size_t position, const char* data, size_t size) override;
+
+        // requests that lie inside the registered buffer use the fixed-buffer opcodes
+        void register_buffer(std::span<char> buffer);
+        void unregister_buffer();
+        ~IoUringDevice();
+};
+
+#endif
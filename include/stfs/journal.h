@@ -2,27 +2,42 @@
 #include <stfs/storage_cluster.h>
 #include <stfs/block.h>
 #include <optional>
+#include <span>
 #include <vector>
 
-struct Transaction {
-    ClusterState state;
-    Block block;
-
-    std::vector<char> serialize() const;
-    size_t deserialize(const char* buffer);
+#define TRANSACTION_BODY_OFFSET JOURNAL_RECORD_HEADER_SIZE
+#define TRANSACTION_STATIC_SIZE (TRANSACTION_BODY_OFFSET + CLUSTER_STATE_SIZE + 8)
 
-    bool is_valid() const;
-    void update_crc();
+// A record is the journal header the cluster stamps when appending it, the cluster state the
+// transaction was logged against, the block count and the serialized blocks
+struct Transaction {
+    // record built straight from the caller's blocks with its header left zeroed, block CRCs are
+    // sealed on the serialized bytes
+    static std::vector<char> serialize(ClusterState state, std::span<const Block> blocks);
+    // checks a serialized record in place without materializing its blocks
+    static bool is_valid_record(const char* data, size_t size, uint64_t max_blocks);
 };
 
+// Transactions go to a circular log of journal slots. With two or more slots a committed transaction
+// is not synced on its own: its record stays in the log until logging the next one syncs both, so
+// the next transaction is logged while the data of the previous one may still be in flight. The state
+// may therefore land before the data, so recovery replays every record whose blocks are not found on disk.
 class Journal {
     private:
         StorageCluster& cluster_;
-        std::optional<Transaction> entry_;
+        std::optional<std::vector<char>> entry_; // serialized record of the open transaction
+
+        bool reached_data_region(const std::vector<char>& record, const ClusterState& logged, uint64_t block_count);
     public:
         Journal(StorageCluster& cluster);
 
+        uint64_t get_max_blocks() const;
+        // throws unless every payload is block_payload_size bytes and fits the cluster block
+        void check_blocks(std::span<const Block> blocks) const;
+
         void create_transaction(Block block);
+        void create_transaction(std::span<const Block> blocks);
         void commit_transaction();
+        // replays the logged transactions the cluster state does not cover yet
         void recover_transaction();
-};
\ No newline at end of file
+};
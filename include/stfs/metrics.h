@@ -0,0 +1,127 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stfs/const.h>
+
+#define METRICS_SHARDS 8
+#define HISTOGRAM_SUB_BUCKET_BITS 3 // 8 linear buckets per power of two, values land within 12.5%
+#define HISTOGRAM_MAX_BITS 40       // larger values share the last bucket, ~18 minutes in ns
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+enum class MetricCounter : size_t
+{
+    ReplicasRepaired, // divergent or unreadable copies rewritten from the voted one
+    ParityRebuilds,   // blocks restored from their stripe
+    QuorumFailures,   // replica votes without a majority
+    Count
+};
+
+enum class MetricHistogram : size_t
+{
+    CrcNs,           // validation of data read from the devices
+    JournalWriteNs,  // logging a transaction and syncing it
+    JournalCommitNs, // applying a logged transaction to the data region
+    SearchProbes,    // timestamps fetched by one search
+    Count
+};
+
+enum class DeviceOp : size_t
+{
+    Read,
+    Write,
+    Sync,
+    Count
+};
+
+struct HistogramSnapshot
+{
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(HISTOGRAM_BUCKETS, 0);
+
+    // upper bound of the bucket holding the q-th value, 0 when empty
+    uint64_t quantile(double q) const;
+};
+
+struct DeviceMetricsSnapshot
+{
+    uint8_t disk_id;
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+    uint64_t errors = 0;
+    std::array<HistogramSnapshot, static_cast<size_t>(DeviceOp::Count)> latency_ns;
+};
+
+struct MetricsSnapshot
+{
+    std::vector<DeviceMetricsSnapshot> devices;
+    std::array<uint64_t, static_cast<size_t>(MetricCounter::Count)> counters = {};
+    std::array<HistogramSnapshot, static_cast<size_t>(MetricHistogram::Count)> histograms;
+
+    uint64_t counter(MetricCounter metric) const;
+    const HistogramSnapshot &histogram(MetricHistogram metric) const;
+
+    // Prometheus text exposition, histograms go out as summaries with latencies in seconds
+    std::string to_prometheus() const;
+};
+
+// Log-linear buckets, recording is one relaxed increment per bucket and sum
+class LatencyHistogram {
+    private:
+        std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> buckets_ = {};
+        std::atomic<uint64_t> sum_ = 0;
+    public:
+        static size_t bucket_of(uint64_t value);
+        static uint64_t bucket_upper_bound(size_t bucket);
+
+        void record(uint64_t value);
+        void add_to(HistogramSnapshot &snapshot) const;
+};
+
+// Recording threads are spread over shards by a per-thread index, so concurrent writers rarely share
+// a cache line; a snapshot sums the shards. Devices are registered while the cluster is set up,
+// before any I/O is issued, records for unregistered disks are dropped.
+class Metrics {
+    private:
+        struct alignas(64) Shard
+        {
+            std::array<std::atomic<uint64_t>, static_cast<size_t>(MetricCounter::Count)> counters = {};
+            std::array<LatencyHistogram, static_cast<size_t>(MetricHistogram::Count)> histograms;
+        };
+
+        struct alignas(64) DeviceShard
+        {
+            std::atomic<uint64_t> read_bytes = 0;
+            std::atomic<uint64_t> write_bytes = 0;
+            std::atomic<uint64_t> errors = 0;
+            std::array<LatencyHistogram, static_cast<size_t>(DeviceOp::Count)> latency;
+        };
+
+        using DeviceShards = std::array<DeviceShard, METRICS_SHARDS>;
+
+        std::unique_ptr<Shard[]> shards_;
+        std::array<std::unique_ptr<DeviceShards>, MAX_DEVICES> devices_;
+
+        static size_t shard_index();
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Metrics();
+
+        static uint64_t elapsed_ns(Clock::time_point started);
+
+        void register_device(uint8_t disk_id);
+
+        void add(MetricCounter metric, uint64_t value = 1);
+        void record(MetricHistogram metric, uint64_t value);
+        void record_device(uint8_t disk_id, DeviceOp op, uint64_t bytes, Clock::time_point started);
+        void record_device_error(uint8_t disk_id);
+
+        MetricsSnapshot snapshot() const;
+};
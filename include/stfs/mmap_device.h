@@ -0,0 +1,41 @@
+#pragma once
+#include <stfs/device.h>
+
+#ifndef _WIN32
+
+#include <shared_mutex>
+
+// Device backed by a shared file mapping. Writes land in the page cache,
+// sync() makes the dirtied range durable with msync. Reads share the mapping lock,
+// only writes (which may remap to grow the file) take it exclusively.
+class MmapDevice: public Device {
+    private:
+        int fd_ = -1;
+        char* mapping_ = nullptr;
+        size_t mapped_size_ = 0;
+        uint64_t head_offset_;
+        DeviceHead head_;
+
+        size_t dirty_begin_ = 0;
+        size_t dirty_end_ = 0;
+        std::shared_mutex mapping_mutex_;
+
+        MmapDevice(const std::string& filename, uint64_t offset, bool is_new_file);
+        void map(size_t size);
+        void unmap();
+        void ensure_size(size_t size);
+        void mark_dirty(size_t begin, size_t end);
+        void flush_range(size_t begin, size_t end);
+        void read_head();
+        void write_head();
+    public:
+        static std::unique_ptr<Device> open(const std::string& dev_filename, uint64_t head_offset);
+        static std::unique_ptr<Device> format(const std::string& filename, uint64_t head_offset, uint64_t total_blocks_on_disk, uint8_t disk_id);
+        const DeviceHead& get_head() const override;
+        void write(size_t position, const char* data, size_t size) override;
+        void read_into(size_t position, std::span<char> buffer) override;
+        void sync() override;
+        ~MmapDevice();
+};
+
+#endif
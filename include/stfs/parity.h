@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// GF(2^8) over x^8 + x^4 + x^3 + x^2 + 1 with generator 2, as used by RAID6 Q parity
+uint8_t gf256_mul(uint8_t a, uint8_t b);
+uint8_t gf256_inv(uint8_t a);
+uint8_t gf256_pow2(uint64_t exponent);
+
+// dst ^= src
+void xor_into(char *dst, const char *src, size_t size);
+// dst ^= factor * src
+void gf256_mul_xor_into(char *dst, const char *src, uint8_t factor, size_t size);
@@ -1,6 +1,11 @@
 #pragma once
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <span>
+#include <stdexcept>
 #include <vector>
+#include <stfs/const.h>
 
 struct DiskLayout
 {
@@ -13,17 +18,118 @@ struct PhysicalLocation {
     uint64_t block_id_on_disk;
 };
 
+#define PER_DISK_INLINE_CAPACITY 16
+
+// At most one entry per disk. Up to PER_DISK_INLINE_CAPACITY entries are held inline so mapping a block
+// allocates nothing, wider clusters (up to MAX_DEVICES disks) move the entries to the heap
+template <typename T>
+class PerDiskList
+{
+private:
+    std::array<T, PER_DISK_INLINE_CAPACITY> inline_items_;
+    std::vector<T> heap_items_;
+    size_t size_ = 0;
+public:
+    void push_back(const T &item)
+    {
+        if (size_ >= MAX_DEVICES)
+        {
+            throw std::length_error("PerDiskList holds at most one entry per disk");
+        }
+
+        if (size_ < PER_DISK_INLINE_CAPACITY)
+        {
+            inline_items_[size_++] = item;
+            return;
+        }
+        if (heap_items_.empty())
+        {
+            heap_items_.assign(inline_items_.begin(), inline_items_.end());
+        }
+        heap_items_.push_back(item);
+        size_++;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T *data() const { return heap_items_.empty() ? inline_items_.data() : heap_items_.data(); }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size_; }
+    const T &front() const { return data()[0]; }
+    const T &back() const { return data()[size_ - 1]; }
+    const T &operator[](size_t index) const { return data()[index]; }
+};
+
+using PhysicalLocations = PerDiskList<PhysicalLocation>;
+
+// Mappings come back empty for block ids outside the capacity, callers report it
 class RaidGovernor
 {
 public:
-    virtual std::vector<PhysicalLocation> map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const = 0;
+    virtual PhysicalLocations map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const = 0;
+    virtual uint64_t get_capacity(const std::vector<DiskLayout> &disks_layout) const = 0;
     virtual uint8_t get_type() const = 0;
+
+    // fills out with one location per block from first_id on, copy picks the replica (wrapping) on mirrored layouts;
+    // false when a block of the range is out of bounds
+    virtual bool map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const;
+
+    // parity governors group stripe_width consecutive blocks into a stripe protected by parity blocks
+    virtual uint8_t get_parity_count() const { return 0; }
+    virtual uint64_t get_stripe_width(const std::vector<DiskLayout> &) const { return 1; }
+    virtual PhysicalLocations map_parity(uint64_t, const std::vector<DiskLayout> &) const { return {}; }
+
     virtual ~RaidGovernor() = default;
 };
 
 class Raid0 : public RaidGovernor
 {
 public:
-    std::vector<PhysicalLocation> map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const override;
+    PhysicalLocations map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const override;
+    bool map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const override;
+    uint64_t get_capacity(const std::vector<DiskLayout> &disks_layout) const override;
+    uint8_t get_type() const override;
+};
+
+// every disk holds a full replica, capacity is the smallest disk
+class Raid1 : public RaidGovernor
+{
+public:
+    PhysicalLocations map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const override;
+    bool map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const override;
+    uint64_t get_capacity(const std::vector<DiskLayout> &disks_layout) const override;
     uint8_t get_type() const override;
+};
+
+// rotating parity, one row per stripe on every disk: P (and Q for two parity blocks)
+// followed by the data blocks of the stripe
+class ParityRaid : public RaidGovernor
+{
+private:
+    uint8_t parity_count_;
+
+    uint64_t parity_disk_index(uint64_t stripe_id, uint64_t num_disks) const;
+public:
+    explicit ParityRaid(uint8_t parity_count);
+
+    PhysicalLocations map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const override;
+    bool map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const override;
+    uint64_t get_capacity(const std::vector<DiskLayout> &disks_layout) const override;
+    uint8_t get_type() const override;
+
+    uint8_t get_parity_count() const override;
+    uint64_t get_stripe_width(const std::vector<DiskLayout> &disks_layout) const override;
+    PhysicalLocations map_parity(uint64_t stripe_id, const std::vector<DiskLayout> &disks_layout) const override;
+};
+
+class Raid5 : public ParityRaid
+{
+public:
+    Raid5() : ParityRaid(1) {}
+};
+
+class Raid6 : public ParityRaid
+{
+public:
+    Raid6() : ParityRaid(2) {}
 };
\ No newline at end of file
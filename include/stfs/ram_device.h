@@ -0,0 +1,45 @@
+#pragma once
+#include <stfs/device.h>
+
+#ifndef _WIN32
+
+#include <shared_mutex>
+
+struct RamDeviceOptions
+{
+    size_t initial_size = 0;
+    bool huge_pages = false; // arena starts on a 2 MiB boundary, is sized in 2 MiB steps and advised for transparent huge pages
+};
+
+// Device kept in one contiguous anonymous mapping. Nothing survives the process unless
+// snapshot() writes the arena to a file, load() brings such a snapshot back.
+class RamDevice: public Device {
+    private:
+        char* arena_ = nullptr;
+        size_t arena_size_ = 0;
+        size_t used_size_ = 0;
+        bool huge_pages_;
+        uint64_t head_offset_;
+        DeviceHead head_;
+        mutable std::shared_mutex arena_mutex_; // writes may move the arena, reads share the lock
+
+        RamDevice(uint64_t offset, const RamDeviceOptions& options);
+        size_t round_to_page(size_t size) const;
+        void grow(size_t size);
+        void read_head();
+        void write_head();
+    public:
+        static std::unique_ptr<Device> format(uint64_t head_offset, uint64_t total_blocks_on_disk, uint8_t disk_id, const RamDeviceOptions& options = {});
+        static std::unique_ptr<Device> load(const std::string& snapshot_filename, uint64_t head_offset, const RamDeviceOptions& options = {});
+        const DeviceHead& get_head() const override;
+        void write(size_t position, const char* data, size_t size) override;
+        void read_into(size_t position, std::span<char> buffer) override;
+        void sync() override;
+
+        // written and synced to a temporary file first, then renamed and the directory synced, so an
+        // existing snapshot is never left torn
+        void snapshot(const std::string& snapshot_filename) const;
+        ~RamDevice();
+};
+
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+#include <stfs/block.h>
+#include <stfs/codec.h>
+
+#define RECORD_BLOCK_HEADER_SIZE 13 // fragment count, codec, data size, stored size
+#define RECORD_ENTRY_SIZE 13        // timestamp, data offset, fragment kind
+
+enum class FragmentKind : uint8_t
+{
+    Whole,  // the record fits in the block
+    First,  // the record continues in the next blocks
+    Middle,
+    Last
+};
+
+struct Record
+{
+    uint64_t timestamp;
+    std::vector<char> data;
+};
+
+struct RecordFragment
+{
+    uint64_t timestamp;
+    FragmentKind kind;
+    std::span<const char> data;
+};
+
+// Packs record fragments into one block payload: header, fragment directory, then the fragment data
+// as the block codec encoded it. Fragment i ends where fragment i + 1 begins in the decoded data,
+// so an entry only stores where its data starts.
+class RecordBlockBuilder {
+    private:
+        uint64_t payload_size_;
+        PayloadCodec codec_;
+        std::unique_ptr<BlockEncoder> encoder_;
+        std::vector<char> directory_;
+        uint32_t count_ = 0;
+        uint64_t stamp_ = 0;
+
+        uint64_t used() const;
+    public:
+        RecordBlockBuilder(uint64_t payload_size, PayloadCodec codec = PayloadCodec::None);
+
+        bool empty() const;
+        // no other fragment with data fits
+        bool full() const;
+
+        // adds as much of data as fits once encoded, the fragment kind follows from continues and what is left.
+        // Returns the bytes taken, nullopt when the block is full and nothing was added.
+        std::optional<size_t> add(uint64_t timestamp, std::span<const char> data, bool continues);
+
+        // the block is stamped with its newest record start, so a timestamp search lands on the block holding the record
+        Block seal();
+};
+
+// Decodes a packed payload once, fragments then point into the decoded data
+class RecordBlockView {
+    private:
+        std::span<const char> payload_;
+        std::vector<char> decoded_;
+        std::span<const char> data_;
+        uint32_t count_ = 0;
+        bool well_formed_ = false;
+
+        const char *entry(uint32_t index) const;
+        uint32_t data_offset(uint32_t index) const;
+        void decode();
+    public:
+        explicit RecordBlockView(std::span<const char> payload);
+        RecordBlockView(const RecordBlockView&) = delete;
+        RecordBlockView& operator=(const RecordBlockView&) = delete;
+        RecordBlockView(RecordBlockView&&) = default;
+        RecordBlockView& operator=(RecordBlockView&&) = default;
+
+        bool is_well_formed() const;
+        uint32_t size() const;
+        RecordFragment fragment(uint32_t index) const;
+        // first fragment stamped at or after timestamp
+        uint32_t lower_bound(uint64_t timestamp) const;
+};
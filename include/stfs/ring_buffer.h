@@ -9,6 +9,10 @@ struct RingBufferState
     uint64_t capacity;
 
     uint64_t get_next_block_id() const {
+        if (count == 0)
+        {
+            return head_id;
+        }
         return (tail_id + 1) % capacity;
     }
 };
\ No newline at end of file
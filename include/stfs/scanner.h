@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <stfs/block.h>
+#include <stfs/record_block.h>
+#include <stfs/ring_buffer.h>
+#include <stfs/storage_cluster.h>
+
+#define SCAN_BATCH_BLOCKS 256
+
+enum class ScanDirection
+{
+    Forward,
+    Reverse
+};
+
+// Streams blocks of logical range [begin, end) of a ring snapshot. The first read fetches one block
+// and each following one doubles up to SCAN_BATCH_BLOCKS, a scan stopped early reads little past it.
+class BlockScanner {
+    private:
+        StorageCluster& cluster_;
+        RingBufferState state_;
+        uint64_t begin_;
+        uint64_t end_;
+        ScanDirection direction_;
+        DataValidator validator_;
+        std::deque<Block> buffered_;
+        std::vector<char> batch_buffer_;
+        uint64_t batch_blocks_ = 1;
+
+        void fill();
+        void read_logical_range(uint64_t first_logical_id, uint64_t count);
+    public:
+        BlockScanner(StorageCluster& cluster, RingBufferState state, uint64_t begin, uint64_t end, ScanDirection direction, DataValidator validator);
+
+        std::optional<Block> next();
+        uint64_t remaining() const;
+};
+
+// Reassembles records of a packed cluster from a forward block scan, yielding those stamped within [from, to].
+// Continuations whose first fragment was overwritten or never committed are skipped.
+class RecordScanner {
+    private:
+        BlockScanner blocks_;
+        uint64_t from_;
+        uint64_t to_;
+        std::optional<Block> block_;
+        std::optional<RecordBlockView> view_; // over block_, decoded once per block
+        uint32_t next_fragment_ = 0;
+        bool first_block_ = true;
+        bool done_ = false;
+
+        std::optional<RecordFragment> next_fragment();
+    public:
+        RecordScanner(BlockScanner blocks, uint64_t from, uint64_t to);
+
+        std::optional<Record> next();
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <stfs/storage_cluster.h>
+
+struct ScrubberOptions
+{
+    uint64_t bytes_per_second = 0;                    // device read budget, 0 - unthrottled
+    std::chrono::milliseconds foreground_backoff{0};  // pause while foreground requests keep arriving, 0 - never yield
+    std::chrono::milliseconds pass_interval{1000};    // pause between passes and while the ring is empty
+};
+
+struct ScrubberStats
+{
+    uint64_t passes_completed;
+    uint64_t blocks_scrubbed;
+    uint64_t bytes_read;
+    uint64_t replicas_repaired;
+    uint64_t parity_rebuilds;
+    uint64_t unrecoverable_blocks;
+    uint64_t pass_blocks_done;  // blocks of the current pass already scrubbed
+    uint64_t pass_blocks_total; // blocks the current pass covers
+};
+
+// Walks the valid range of the ring in the background, one block per StorageCluster::scrub_block call,
+// so blocks nobody reads still get their replicas voted on and repaired before a second failure.
+// The cursor follows write sequences, blocks overwritten ahead of it are skipped, newer ones wait for the next pass.
+class Scrubber {
+    private:
+        StorageCluster& cluster_;
+        DataValidator validator_;
+        ScrubberOptions options_;
+
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable wakeup_;
+        bool stopping_ = false;
+
+        uint64_t cursor_ = 0;
+        uint64_t pass_begin_ = 0;
+        uint64_t pass_end_ = 0;
+        bool in_pass_ = false;
+        std::chrono::steady_clock::time_point budget_time_;
+        uint64_t seen_foreground_requests_ = 0;
+
+        std::atomic<uint64_t> passes_completed_ = 0;
+        std::atomic<uint64_t> blocks_scrubbed_ = 0;
+        std::atomic<uint64_t> bytes_read_ = 0;
+        std::atomic<uint64_t> replicas_repaired_ = 0;
+        std::atomic<uint64_t> parity_rebuilds_ = 0;
+        std::atomic<uint64_t> unrecoverable_blocks_ = 0;
+        std::atomic<uint64_t> pass_blocks_done_ = 0;
+        std::atomic<uint64_t> pass_blocks_total_ = 0;
+
+        void run();
+        bool wait_until(std::chrono::steady_clock::time_point deadline);
+        bool throttle(uint64_t bytes);
+        bool scrub_next();
+    public:
+        Scrubber(StorageCluster& cluster, const ScrubberOptions& options = {});
+        Scrubber(StorageCluster& cluster, DataValidator validator, const ScrubberOptions& options = {});
+        Scrubber(const Scrubber&) = delete;
+        Scrubber& operator=(const Scrubber&) = delete;
+        ~Scrubber();
+
+        void start();
+        void stop();
+
+        // one full pass on the caller's thread, not to be mixed with start()
+        void scrub_pass();
+
+        ScrubberStats get_stats() const;
+};
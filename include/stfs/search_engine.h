@@ -5,9 +5,27 @@
 
 using TimeStampFetcher = std::function<uint64_t(uint64_t)>;
 
+enum class SearchStrategy
+{
+    Binary,        // halves the window on every probe
+    Interpolation, // guesses the position from the timestamps at the window ends, falls back to Binary on skewed data
+    Galloping      // steps back from the newest block in doubling strides, cheapest for recent timestamps
+};
+
+struct SearchWindow
+{
+    uint64_t left;  // first logical id to search
+    uint64_t right; // one past the last logical id to search
+};
+
 class SearchEngine {
     private:
         static uint64_t logical_to_real_index(uint64_t logical_id, RingBufferState state);
+        static uint64_t binary_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window);
+        static uint64_t interpolation_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window);
+        static uint64_t galloping_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window);
     public:
         static uint64_t find_block_id_by_timestamp(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state);
-};
\ No newline at end of file
+        static uint64_t find_block_id_by_timestamp(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window, SearchStrategy strategy = SearchStrategy::Binary);
+        static uint64_t find_first_logical_id(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window, SearchStrategy strategy = SearchStrategy::Binary);
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <stfs/endian_compat.h>
 
 #define SERIALIZE_FIELD(buffer_ptr, value, type, serializer_func) \
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <stfs/ring_buffer.h>
+#include <stfs/search_engine.h>
+
+struct SparseIndexSample
+{
+    uint64_t timestamp;
+    uint64_t sequence; // write ordinal of the sampled block
+};
+
+// Every stride-th block's timestamp kept in RAM. Samples are appended in write order and
+// searched through an Eytzinger copy that is rebuilt lazily after the sample set changes.
+class SparseIndex {
+    private:
+        struct Node
+        {
+            uint64_t timestamp;
+            uint64_t rank; // position of the sample in samples_
+        };
+
+        uint64_t stride_;
+        std::deque<SparseIndexSample> samples_;
+        std::vector<Node> layout_; // 1-based Eytzinger order, layout_[0] is unused
+        bool layout_dirty_ = true;
+
+        void rebuild_layout();
+    public:
+        explicit SparseIndex(uint64_t stride);
+
+        uint64_t get_stride() const;
+        size_t size() const;
+        bool should_sample(uint64_t sequence) const;
+        bool has_stale_layout() const; // narrow() rebuilds the layout first, so it writes to the index
+
+        void append(uint64_t sequence, uint64_t timestamp);
+        void evict_before(uint64_t sequence);
+        void truncate_from(uint64_t sequence);
+
+        SearchWindow narrow(uint64_t timestamp, RingBufferState state, uint64_t first_sequence);
+};
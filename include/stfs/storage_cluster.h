@@ -2,19 +2,35 @@
 #include <iostream>
 #include <cstdint>
 #include <map>
+#include <deque>
+#include <optional>
 #include <string>
 #include <vector>
 #include <array>
 #include <memory>
 #include <stdexcept>
 #include <functional>
+#include <span>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
 #include <stfs/crypto.h>
+#include <stfs/codec.h>
 #include <stfs/raid.h>
 #include <stfs/device.h>
 #include <stfs/ring_buffer.h>
+#include <stfs/index.h>
+#include <stfs/sparse_index.h>
+#include <stfs/io_pool.h>
+#include <stfs/block_cache.h>
+#include <stfs/metrics.h>
+#include <stfs/search_engine.h>
 
 #define CLUSTER_HEAD_SIZE 120
 #define CLUSTER_STATE_SIZE 36
+#define JOURNAL_DEFAULT_SLOTS 4
+#define JOURNAL_RECORD_HEADER_SIZE 20 // crc32, sequence, record size
 
 class ClusterError : public std::runtime_error
 {
@@ -22,10 +38,16 @@ public:
     ClusterError(const std::string &msg) : std::runtime_error(msg) {};
 };
 
+enum class PayloadFormat : uint64_t
+{
+    Blocks,       // one payload per block, exactly block_payload_size bytes
+    PackedRecords // variable-length records packed through RecordBlockBuilder
+};
+
 struct ClusterHead // imutable fs meta block
 {
     std::array<char, 5> magic = {'S', 'T', 'F', 'S', '\0'};           // "STFS"
-    uint32_t version = 1;                                             // fs version
+    uint32_t version = 2;                                             // fs version
     uint8_t num_of_disks = 1;                                         // total number of disks in claster
     uint8_t raid_type = 0;                                            // claster raid type
     char mime[25] = "application/octet-stream";                       // mime type of block payload on claster
@@ -34,18 +56,19 @@ struct ClusterHead // imutable fs meta block
     uint64_t total_blocks = 0;                                        // total blocks on claster
     uint64_t device_head_offset = CLUSTER_HEAD_SIZE;                // where device head is on device
     uint64_t cluster_state_offset = CLUSTER_HEAD_SIZE + DEVICE_HEAD_SIZE; // where cluster state is on device
-    uint64_t journal_offset = CLUSTER_HEAD_SIZE + DEVICE_HEAD_SIZE + CLUSTER_STATE_SIZE; // where index is on device
+    uint64_t journal_offset = CLUSTER_HEAD_SIZE + DEVICE_HEAD_SIZE + CLUSTER_STATE_SIZE; // where journal is on device
     uint64_t data_offset = 0;                                         // where data begins
+    uint64_t index_offset = 0;                                        // where index is on device ( 0 - cluster without index )
 
-    // reserved 32 bytes for future
-    uint64_t reserve1 = 0;
-    uint64_t reserve2 = 0;
-    uint64_t reserve3 = 0;
-    uint64_t reserve4 = 0;
+    uint64_t payload_format = 0;                                      // PayloadFormat of the blocks
+    uint64_t payload_codec = 0;                                       // PayloadCodec packed blocks are encoded with
+
+    uint64_t journal_slots = 0;                                       // records the journal holds ( 0 - single record cluster )
 
     uint32_t crc32;
 
     std::vector<char> serialize() const;
+    void serialize_into(char* buffer) const;
     size_t deserialize(const char* buffer);
 
     bool is_valid() const;
@@ -62,6 +85,7 @@ struct ClusterState
     uint32_t crc32;
 
     std::vector<char> serialize() const;
+    void serialize_into(char* buffer) const;
     size_t deserialize(const char* buffer);
 
     bool is_valid() const;
@@ -93,54 +117,234 @@ struct PhysicalAddress
     uint64_t offset;
 };
 
+using PhysicalAddresses = PerDiskList<PhysicalAddress>;
+
+
+
+enum class ReplicaReadMode
+{
+    Quorum, // read every replica and vote
+    Fast    // read one rotating replica, vote only when its CRC fails
+};
+
+struct RunSlot
+{
+    uint64_t block_id_on_disk;
+    uint64_t slot; // position of the block in the requested range
+};
+
+struct WriteSlot
+{
+    uint64_t block_id_on_disk;
+    const char *data;
+    const char *index_entry; // nullptr for parity rows
+};
 
+// parity accumulated over the blocks of the stripe being filled
+struct ParityStripe
+{
+    uint64_t stripe_id;
+    uint64_t blocks_folded;
+    std::vector<char> p;
+    std::vector<char> q;
+};
+
+// a stripe member rebuilt from parity, written back once the rebuild is known to be current
+struct StripeRepair
+{
+    PhysicalLocation location;
+    std::vector<char> data;
+};
+
+// what scrubbing one block found and fixed
+struct ScrubReport
+{
+    uint64_t bytes_read = 0;
+    uint64_t replicas_repaired = 0;
+    bool rebuilt_from_parity = false;
+    bool unrecoverable = false;
+};
+
+// When the cluster state is persisted. Blocks written after the last persisted state are found again
+// on open by their index entries, so a checkpoint every few blocks trades a longer scan for fewer
+// metadata writes to every device.
+struct StateCheckpointPolicy
+{
+    uint64_t max_blocks = 1;            // blocks written since the last checkpoint ( 0 - no limit )
+    std::chrono::milliseconds max_age{}; // time since the last checkpoint, checked on writes ( 0 - no limit )
+};
 
 struct ClusterStructsSizes
 {
     uint64_t total_block_size;
     uint64_t transaction_size;
+    uint64_t journal_slots = JOURNAL_DEFAULT_SLOTS; // transactions the journal holds, each in its own transaction_size slot
+};
+
+struct JournalRecord
+{
+    uint64_t sequence;
+    std::vector<char> data; // the whole record, header included
 };
 
 class StorageCluster
 {
 private:
     std::map<uint8_t, std::unique_ptr<Device>> devices_;
+    std::vector<DiskLayout> layouts_; // by disk id, fixed once the devices are added
+    IoWorkerPool io_pool_;
     std::unique_ptr<RaidGovernor> raid_governor_;
     uint64_t total_block_size_ = 0;
     uint64_t transaction_size_ = 0;
+    uint64_t journal_slots_ = 0;
+    uint64_t journal_slot_size_ = 0;
     ClusterHead head_;
+    std::optional<ParityStripe> open_stripe_;
+    std::atomic<ReplicaReadMode> replica_read_mode_ = ReplicaReadMode::Fast;
+    std::atomic<uint64_t> replica_cursor_ = 0;
+    std::atomic<uint64_t> foreground_requests_ = 0;
+
+    // Writes, repairs and state changes are serialized by writer_mutex_, state_ belongs to its holder.
+    // Readers never take it on the way to valid data: they copy the state published after each change
+    // and only queue for the lock when a replica has to be rewritten, so a repair is voted on copies
+    // no write is in the middle of replacing.
+    std::mutex writer_mutex_;
     ClusterState state_;
-
-    std::unique_ptr<char[]> read_and_verify_mirrored_data(
-        const std::vector<PhysicalAddress> &addresses,
-        size_t size,
+    uint64_t journal_sequence_ = 0; // next record, known once the journal was scanned
+    bool journal_scanned_ = false;
+    StateCheckpointPolicy checkpoint_policy_;
+    uint64_t blocks_since_checkpoint_ = 0;
+    std::chrono::steady_clock::time_point last_checkpoint_ = std::chrono::steady_clock::now();
+    mutable std::mutex published_state_mutex_; // held for the copy only
+    ClusterState published_state_;
+
+    mutable std::shared_mutex sparse_index_mutex_;
+    std::unique_ptr<SparseIndex> sparse_index_;
+
+    // blocks and index entries that passed validation, dropped by the writer once their slot is rewritten
+    BlockCache block_cache_;
+    Metrics metrics_;
+
+    void note_foreground_request();
+    void publish_state();
+    void add_device(uint8_t disk_id, std::unique_ptr<Device> device);
+    bool validate(const DataValidator &validator, const char *data, size_t size);
+
+    size_t read_and_verify_mirrored_data(
+        std::span<const PhysicalAddress> addresses,
+        std::span<char> out,
         const DataValidator &is_valid);
+    // reads every replica and copies the quorum winner to out without repairing, stale gets the copies to rewrite
+    void vote_mirrored_data(
+        std::span<const PhysicalAddress> addresses,
+        std::span<char> out,
+        const DataValidator &is_valid,
+        std::vector<PhysicalAddress> &stale);
+    size_t repair_replicas(std::span<const PhysicalAddress> stale, const char *data, size_t size);
+
+    bool try_read_replicated_data(
+        std::span<const PhysicalAddress> addresses,
+        std::span<char> out,
+        const DataValidator &is_valid);
+
+    void read_runs(uint8_t disk_id, std::vector<RunSlot> &slots, const DataValidator &validator, std::span<char> out, std::vector<char> &filled);
+    void write_runs(uint8_t disk_id, std::vector<WriteSlot> &slots);
+    void open_stripe(uint64_t stripe_id, uint64_t position, const std::vector<DiskLayout> &layouts);
+    void fold_into_stripe(
+        uint64_t block_id,
+        const char *data,
+        const std::vector<DiskLayout> &layouts,
+        std::map<uint8_t, std::vector<WriteSlot>> &slots_per_disk,
+        std::deque<std::vector<char>> &parity_blocks);
+    void rebuild_from_parity(uint64_t id, const DataValidator &validator, std::span<char> out);
+    // rebuilds id into out without writing, open_stripe is the accumulator snapshot taken under writer_mutex_
+    std::vector<StripeRepair> reconstruct_from_parity(uint64_t id, const DataValidator &validator, std::span<char> out, const std::optional<ParityStripe> &open_stripe);
+    void write_stripe_repairs(const std::vector<StripeRepair> &repairs);
+    void read_block_from_replicas(uint64_t id, const DataValidator &validator, std::span<char> out);
 
     void read_and_verify_heads();
     void read_and_verify_states();
+    std::vector<JournalRecord> scan_journal();
 
     void write_head_to_all_devices();
     void write_state_to_all_devices();
-
+    void checkpoint_state_if_due(uint64_t written_blocks);
+
+    const std::vector<DiskLayout> &get_disks_layout() const;
+    RingBufferState ring_state(const ClusterState &state) const;
+    ClusterState advance_state(ClusterState state, uint64_t new_block_id) const;
+    PhysicalLocations map_block(uint64_t id) const;
+    PhysicalAddresses block_addresses(uint64_t id) const;
+    PhysicalAddresses index_addresses(uint64_t id) const;
+    DataValidator index_validator(uint64_t id, const ClusterState &state) const;
+    uint64_t expected_sequence(uint64_t id, const ClusterState &state) const;
+    static uint64_t first_valid_sequence(const ClusterState &state);
+
+    Device &get_device(uint8_t device_id) const;
     void mirrored_write(size_t address, const char *data, size_t size);
     void write(uint8_t device_id, size_t address, const char *data, size_t size);
-    std::unique_ptr<char[]> read(uint8_t device_id, size_t address, size_t size);
+    void read(uint8_t device_id, size_t address, std::span<char> buffer);
 
 public:
     explicit StorageCluster(std::unique_ptr<RaidGovernor> governor, const ClusterStructsSizes &sizes);
-
-    void format_cluster(const std::vector<DeviceFormatBlueprint> &blueprints, uint64_t block_payload_size);
+    // persists a state the checkpoint policy has held back
+    ~StorageCluster();
+
+    void format_cluster(
+        const std::vector<DeviceFormatBlueprint> &blueprints,
+        uint64_t block_payload_size,
+        PayloadFormat payload_format = PayloadFormat::Blocks,
+        PayloadCodec payload_codec = PayloadCodec::None);
     void open_cluster(const std::vector<DeviceOpenBlueprint> &blueprints);
 
-    void write_next_block(const char *data);
-    void write_transaction_block(const char *data);
+    void write_next_block(const char *data, uint64_t timestamp);
+    void write_next_blocks(const char *data, uint64_t count, const std::vector<uint64_t> &timestamps);
+    // stamps the reserved header of the record with the next sequence and its CRC and writes it over
+    // the oldest slot of the journal, returns the sequence
+    uint64_t append_journal_record(std::span<char> record);
+    void sync_devices();
+
+    // throws unless the cluster has an index or the policy checkpoints every block
+    void set_state_checkpoint_policy(StateCheckpointPolicy policy);
+    void checkpoint_state();
+    // appends the blocks written after the persisted state whose index entry carries the next sequence
+    // and whose data passes the validator, returns how many were found
+    uint64_t recover_tail(const DataValidator &validator);
 
     RingBufferState get_ring_buffer_state() const;
 
-    const ClusterState& get_state() const;
+    ClusterState get_state() const;
     const ClusterHead& get_head() const;
+    uint64_t get_total_block_size() const;
+    uint64_t get_transaction_size() const;
+    uint64_t get_journal_slots() const;
     void update_state(ClusterState state);
 
+    bool has_index() const;
+    PayloadFormat get_payload_format() const;
+    PayloadCodec get_payload_codec() const;
+    void set_replica_read_mode(ReplicaReadMode mode);
+
+    // cached blocks are served without a replica read or vote, 0 bytes disables the cache
+    void set_block_cache_capacity(size_t bytes);
+    BlockCacheStats get_block_cache_stats() const;
+
+    // device I/O, validation and repairs are recorded by the cluster, the journal and Fs add their own
+    Metrics &get_metrics();
+    MetricsSnapshot get_metrics_snapshot() const;
+
+    void build_sparse_index(uint64_t stride, TimeStampFetcher &fetcher);
+    SearchWindow narrow_search(uint64_t timestamp);
+
     std::unique_ptr<char[]> read_block(uint64_t id, DataValidator validator);
-    std::unique_ptr<char[]> read_transaction_block(DataValidator validator);
+    void read_block(uint64_t id, DataValidator validator, std::span<char> out);
+    void read_blocks(uint64_t first_id, uint64_t count, DataValidator validator, std::span<char> out);
+    IndexEntry read_index_entry(uint64_t id);
+    // newest intact copy of every journal slot in sequence order, the journal is read once per device
+    std::vector<JournalRecord> read_journal();
+
+    // reads every replica of the block and its index entry, repairs divergent or broken copies.
+    // Only the repairs take writer_mutex_, and only while the block still holds the sequence that was read.
+    ScrubReport scrub_block(uint64_t id, const DataValidator &validator);
+    uint64_t get_foreground_request_count() const;
 };
@@ -0,0 +1,658 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stfs/fs.h>
+#include <stfs/io_uring_device.h>
+#include <stfs/mmap_device.h>
+#include <stfs/ram_device.h>
+
+// Usage: stfs_bench [--key value]...
+//   --payload            block payload size in bytes (4096)
+//   --devices            device count (2)
+//   --raid               0, 1, 5 or 6 (1)
+//   --backend            file, mmap, uring or ram (ram)
+//   --queue-depth        requests in flight per uring device (64)
+//   --direct-io          1 - open uring devices with O_DIRECT (0)
+//   --blocks-per-device  blocks formatted on each device (4096)
+//   --journal-blocks     blocks one transaction holds (16)
+//   --batch              blocks per append call (1)
+//   --checkpoint-blocks  blocks written between cluster state checkpoints, 0 - no limit (1)
+//   --checkpoint-ms      milliseconds between cluster state checkpoints, 0 - no limit (0)
+//   --ops                reads and searches per scenario (10000)
+//   --recoveries         journal recoveries to time (20)
+//   --search             binary, interpolation or galloping timestamp search (interpolation)
+//   --scenarios          comma separated subset of append,random_read,search,replay,recovery,degraded
+//   --dir                directory for file backed devices (.)
+//   --seed               random seed (1)
+// Results go to stdout as JSON, cluster diagnostics to stderr.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchConfig
+{
+    uint64_t payload = 4096;
+    uint64_t devices = 2;
+    uint64_t raid = 1;
+    std::string backend = "ram";
+    uint64_t queue_depth = 64;
+    uint64_t direct_io = 0;
+    uint64_t blocks_per_device = 4096;
+    uint64_t journal_blocks = 16;
+    uint64_t batch = 1;
+    uint64_t checkpoint_blocks = 1;
+    uint64_t checkpoint_ms = 0;
+    uint64_t ops = 10000;
+    uint64_t recoveries = 20;
+    std::string search = "interpolation";
+    std::string scenarios = "append,random_read,search,replay,recovery,degraded";
+    std::string dir = ".";
+    uint64_t seed = 1;
+};
+
+struct LatencySummary
+{
+    double mean_ns = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+struct ScenarioResult
+{
+    std::string name;
+    uint64_t ops = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    std::optional<LatencySummary> latency{};
+    std::map<std::string, uint64_t> counters{};
+    std::string skipped{}; // reason, empty when the scenario ran
+    std::string error{};   // failed check, the bench exits with 1 once the JSON is written
+};
+
+static LatencySummary summarize(std::vector<uint64_t> &samples)
+{
+    LatencySummary summary;
+
+    if (samples.empty())
+    {
+        return summary;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0;
+    for (uint64_t sample : samples)
+    {
+        total += sample;
+    }
+
+    summary.mean_ns = total / samples.size();
+    summary.p50_ns = samples[samples.size() / 2];
+    summary.p99_ns = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+    summary.max_ns = samples.back();
+
+    return summary;
+}
+
+static uint64_t elapsed_ns(Clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+static uint64_t block_timestamp(uint64_t sequence)
+{
+    return 1000 + sequence * 10;
+}
+
+// Owns the cluster under test, devices stay reachable so a scenario can damage a replica
+class BenchCluster
+{
+private:
+    const BenchConfig &config_;
+    std::vector<Device *> devices_;
+    std::vector<std::string> paths_;
+    std::unique_ptr<StorageCluster> cluster_;
+    std::unique_ptr<Journal> journal_;
+    std::unique_ptr<Fs> fs_;
+    uint64_t next_sequence_ = 0;
+
+    std::unique_ptr<RaidGovernor> make_governor() const
+    {
+        switch (config_.raid)
+        {
+        case 0:
+            return std::make_unique<Raid0>();
+        case 1:
+            return std::make_unique<Raid1>();
+        case 5:
+            return std::make_unique<Raid5>();
+        case 6:
+            return std::make_unique<Raid6>();
+        }
+        throw std::invalid_argument("Unsupported raid type " + std::to_string(config_.raid));
+    }
+
+    DeviceFormatter make_formatter()
+    {
+        uint64_t blocks = config_.blocks_per_device;
+        std::string backend = config_.backend;
+        IoUringOptions uring_options = {
+            .queue_depth = static_cast<unsigned>(config_.queue_depth),
+            .direct_io = config_.direct_io != 0};
+
+        return [this, blocks, backend, uring_options](const std::string &path, uint64_t head_offset, uint8_t device_id) -> std::unique_ptr<Device>
+        {
+            std::unique_ptr<Device> device;
+
+            if (backend == "file")
+            {
+                device = FileDevice::format(path, head_offset, blocks, device_id);
+            }
+            else if (backend == "mmap")
+            {
+                device = MmapDevice::format(path, head_offset, blocks, device_id);
+            }
+            else if (backend == "uring")
+            {
+                device = IoUringDevice::format(path, head_offset, blocks, device_id, uring_options);
+            }
+            else if (backend == "ram")
+            {
+                device = RamDevice::format(head_offset, blocks, device_id);
+            }
+            else
+            {
+                throw std::invalid_argument("Unsupported backend " + backend);
+            }
+
+            devices_.push_back(device.get());
+            return device;
+        };
+    }
+
+public:
+    explicit BenchCluster(const BenchConfig &config) : config_(config)
+    {
+        ClusterStructsSizes sizes = {
+            .total_block_size = BLOCK_STATIC_SIZE + config.payload,
+            .transaction_size = TRANSACTION_STATIC_SIZE + config.journal_blocks * (BLOCK_STATIC_SIZE + config.payload)};
+
+        cluster_ = std::make_unique<StorageCluster>(make_governor(), sizes);
+
+        DeviceFormatter formatter = make_formatter();
+        std::vector<DeviceFormatBlueprint> blueprints;
+
+        for (uint64_t i = 0; i < config.devices; ++i)
+        {
+            std::string path = (std::filesystem::path(config.dir) / ("stfs_bench_" + std::to_string(i) + ".dev")).string();
+            paths_.push_back(path);
+            blueprints.push_back({path, formatter});
+        }
+
+        cluster_->format_cluster(blueprints, config.payload);
+        cluster_->set_state_checkpoint_policy({.max_blocks = config.checkpoint_blocks, .max_age = std::chrono::milliseconds(config.checkpoint_ms)});
+        journal_ = std::make_unique<Journal>(*cluster_);
+        fs_ = std::make_unique<Fs>(*cluster_, *journal_);
+    }
+
+    ~BenchCluster()
+    {
+        fs_.reset();
+        journal_.reset();
+        cluster_.reset();
+
+        if (config_.backend != "ram")
+        {
+            for (const std::string &path : paths_)
+            {
+                std::error_code error;
+                std::filesystem::remove(path, error);
+            }
+        }
+    }
+
+    StorageCluster &cluster() { return *cluster_; }
+    Journal &journal() { return *journal_; }
+    Fs &fs() { return *fs_; }
+    std::vector<Device *> &devices() { return devices_; }
+
+    Block make_block()
+    {
+        uint64_t sequence = next_sequence_++;
+        std::vector<char> payload(config_.payload);
+
+        for (uint64_t i = 0; i < payload.size(); ++i)
+        {
+            payload[i] = static_cast<char>((sequence + i) * 131);
+        }
+
+        Block block = {block_timestamp(sequence), config_.payload, std::move(payload), 0};
+        block.update_crc();
+        return block;
+    }
+
+    // the sequence range still held by the ring
+    std::pair<uint64_t, uint64_t> valid_sequences() const
+    {
+        ClusterState state = cluster_->get_state();
+        return {state.total_writes_count - state.valid_block_count, state.total_writes_count};
+    }
+};
+
+static ScenarioResult run_append(BenchCluster &bench, const BenchConfig &config)
+{
+    ScenarioResult result{.name = "append"};
+    uint64_t capacity = bench.cluster().get_head().total_blocks;
+    uint64_t batch = std::clamp<uint64_t>(config.batch, 1, bench.fs().get_max_transaction_blocks());
+    std::vector<uint64_t> samples;
+
+    // fills the ring once, later scenarios read what it wrote
+    auto start = Clock::now();
+
+    for (uint64_t written = 0; written < capacity; written += batch)
+    {
+        std::vector<Block> blocks;
+        for (uint64_t i = 0; i < std::min(batch, capacity - written); ++i)
+        {
+            blocks.push_back(bench.make_block());
+        }
+
+        auto call = Clock::now();
+        bench.fs().add_blocks(blocks);
+        samples.push_back(elapsed_ns(call));
+
+        result.ops += blocks.size();
+    }
+
+    result.seconds = elapsed_ns(start) / 1e9;
+    result.bytes = result.ops * config.payload;
+    result.latency = summarize(samples);
+    result.counters["blocks_per_call"] = batch;
+
+    return result;
+}
+
+static ScenarioResult run_random_read(BenchCluster &bench, const BenchConfig &config, std::mt19937_64 &random)
+{
+    ScenarioResult result{.name = "random_read"};
+    RingBufferState state = bench.cluster().get_ring_buffer_state();
+
+    if (state.count == 0)
+    {
+        result.skipped = "ring is empty";
+        return result;
+    }
+
+    std::vector<char> buffer(bench.cluster().get_total_block_size());
+    std::vector<uint64_t> samples;
+    samples.reserve(config.ops);
+
+    auto start = Clock::now();
+
+    for (uint64_t i = 0; i < config.ops; ++i)
+    {
+        uint64_t id = (state.head_id + random() % state.count) % state.capacity;
+
+        auto call = Clock::now();
+        bench.fs().get_block_view_by_id(id, buffer);
+        samples.push_back(elapsed_ns(call));
+    }
+
+    result.seconds = elapsed_ns(start) / 1e9;
+    result.ops = config.ops;
+    result.bytes = result.ops * config.payload;
+    result.latency = summarize(samples);
+
+    return result;
+}
+
+static ScenarioResult run_search(BenchCluster &bench, const BenchConfig &config, std::mt19937_64 &random)
+{
+    ScenarioResult result{.name = "search"};
+    auto [first, end] = bench.valid_sequences();
+
+    if (first == end)
+    {
+        result.skipped = "ring is empty";
+        return result;
+    }
+
+    std::map<std::string, SearchStrategy> strategies = {
+        {"binary", SearchStrategy::Binary},
+        {"interpolation", SearchStrategy::Interpolation},
+        {"galloping", SearchStrategy::Galloping}};
+
+    auto strategy = strategies.find(config.search);
+    if (strategy == strategies.end())
+    {
+        throw std::invalid_argument("Unknown search strategy " + config.search);
+    }
+    bench.fs().set_search_strategy(strategy->second);
+
+    std::vector<uint64_t> samples;
+    samples.reserve(config.ops);
+    uint64_t misses = 0;
+    uint64_t probes_before = bench.fs().get_metrics_snapshot().histogram(MetricHistogram::SearchProbes).sum;
+
+    auto start = Clock::now();
+
+    for (uint64_t i = 0; i < config.ops; ++i)
+    {
+        uint64_t timestamp = block_timestamp(first + random() % (end - first));
+
+        auto call = Clock::now();
+        Block block = bench.fs().get_block_by_timestamp(timestamp);
+        samples.push_back(elapsed_ns(call));
+
+        misses += block.timestamp != timestamp;
+    }
+
+    result.seconds = elapsed_ns(start) / 1e9;
+    result.ops = config.ops;
+    result.latency = summarize(samples);
+    result.counters["wrong_block"] = misses;
+    result.counters["probes"] = bench.fs().get_metrics_snapshot().histogram(MetricHistogram::SearchProbes).sum - probes_before;
+
+    return result;
+}
+
+static ScenarioResult run_replay(BenchCluster &bench, const BenchConfig &config)
+{
+    ScenarioResult result{.name = "replay"};
+
+    auto start = Clock::now();
+
+    BlockScanner scanner = bench.fs().scan(0, std::numeric_limits<uint64_t>::max());
+    while (scanner.next())
+    {
+        result.ops++;
+    }
+
+    result.seconds = elapsed_ns(start) / 1e9;
+    result.bytes = result.ops * config.payload;
+
+    return result;
+}
+
+// a transaction is logged but not committed, as if the process died, then replayed by a fresh journal
+static ScenarioResult run_recovery(BenchCluster &bench, const BenchConfig &config)
+{
+    ScenarioResult result{.name = "recovery"};
+    uint64_t blocks_per_transaction = bench.fs().get_max_transaction_blocks();
+    std::vector<uint64_t> samples;
+
+    for (uint64_t i = 0; i < config.recoveries; ++i)
+    {
+        std::vector<Block> blocks;
+        for (uint64_t j = 0; j < blocks_per_transaction; ++j)
+        {
+            blocks.push_back(bench.make_block());
+        }
+
+        Journal crashed(bench.cluster());
+        crashed.create_transaction(blocks);
+
+        Journal journal(bench.cluster());
+
+        auto call = Clock::now();
+        journal.recover_transaction();
+        samples.push_back(elapsed_ns(call));
+
+        result.ops++;
+        result.bytes += blocks.size() * config.payload;
+    }
+
+    uint64_t total_ns = 0;
+    for (uint64_t sample : samples)
+    {
+        total_ns += sample;
+    }
+
+    result.seconds = total_ns / 1e9;
+    result.latency = summarize(samples);
+    result.counters["blocks_per_transaction"] = blocks_per_transaction;
+
+    return result;
+}
+
+// the data region of the first device is overwritten, every read then falls back to the other replicas and repairs
+static ScenarioResult run_degraded(BenchCluster &bench, const BenchConfig &config)
+{
+    ScenarioResult result{.name = "degraded"};
+
+    if (config.raid == 0 || config.devices < 2)
+    {
+        result.skipped = "no redundancy";
+        return result;
+    }
+
+    const ClusterHead &head = bench.cluster().get_head();
+    Device &victim = *bench.devices().front();
+    uint64_t total_block_size = bench.cluster().get_total_block_size();
+
+    std::vector<char> garbage(victim.get_head().total_blocks_on_disk * total_block_size, static_cast<char>(0xA5));
+    victim.write(head.data_offset, garbage.data(), garbage.size());
+    victim.sync();
+
+    RingBufferState state = bench.cluster().get_ring_buffer_state();
+    std::vector<char> buffer(total_block_size);
+    std::vector<uint64_t> samples;
+    samples.reserve(state.count);
+
+    auto start = Clock::now();
+
+    // with one disk lost every valid block has to come back, from a replica or its stripe
+    for (uint64_t logical = 0; logical < state.count; ++logical)
+    {
+        uint64_t id = (state.head_id + logical) % state.capacity;
+        auto call = Clock::now();
+        try
+        {
+            bench.fs().get_block_view_by_id(id, buffer);
+        }
+        catch (const ClusterError &e)
+        {
+            result.error = "block " + std::to_string(id) + " is unrecoverable: " + e.what();
+            break;
+        }
+        samples.push_back(elapsed_ns(call));
+        result.ops++;
+    }
+
+    result.seconds = elapsed_ns(start) / 1e9;
+    result.bytes = result.ops * config.payload;
+    result.latency = summarize(samples);
+
+    return result;
+}
+
+static std::string json_string(const std::string &value)
+{
+    std::string escaped = "\"";
+
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+
+    return escaped + "\"";
+}
+
+static void write_json(std::ostream &out, const BenchConfig &config, uint64_t capacity, const std::vector<ScenarioResult> &results)
+{
+    out << "{\n  \"config\": {"
+        << "\"payload\": " << config.payload
+        << ", \"devices\": " << config.devices
+        << ", \"raid\": " << config.raid
+        << ", \"backend\": " << json_string(config.backend)
+        << ", \"queue_depth\": " << config.queue_depth
+        << ", \"direct_io\": " << config.direct_io
+        << ", \"blocks_per_device\": " << config.blocks_per_device
+        << ", \"capacity_blocks\": " << capacity
+        << ", \"journal_blocks\": " << config.journal_blocks
+        << ", \"batch\": " << config.batch
+        << ", \"checkpoint_blocks\": " << config.checkpoint_blocks
+        << ", \"checkpoint_ms\": " << config.checkpoint_ms
+        << ", \"ops\": " << config.ops
+        << ", \"search\": " << json_string(config.search)
+        << ", \"seed\": " << config.seed << "},\n  \"results\": [";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const ScenarioResult &result = results[i];
+
+        out << (i == 0 ? "\n" : ",\n") << "    {\"scenario\": " << json_string(result.name);
+
+        if (!result.skipped.empty())
+        {
+            out << ", \"skipped\": " << json_string(result.skipped) << "}";
+            continue;
+        }
+
+        if (!result.error.empty())
+        {
+            out << ", \"error\": " << json_string(result.error);
+        }
+
+        double seconds = std::max(result.seconds, 1e-9);
+
+        out << ", \"ops\": " << result.ops
+            << ", \"seconds\": " << result.seconds
+            << ", \"ops_per_second\": " << result.ops / seconds
+            << ", \"bytes\": " << result.bytes
+            << ", \"mb_per_second\": " << result.bytes / seconds / 1e6;
+
+        if (result.latency)
+        {
+            out << ", \"latency_ns\": {\"mean\": " << result.latency->mean_ns
+                << ", \"p50\": " << result.latency->p50_ns
+                << ", \"p99\": " << result.latency->p99_ns
+                << ", \"max\": " << result.latency->max_ns << "}";
+        }
+
+        for (const auto &[name, value] : result.counters)
+        {
+            out << ", " << json_string(name) << ": " << value;
+        }
+
+        out << "}";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+static BenchConfig parse_arguments(int argc, char **argv)
+{
+    BenchConfig config;
+    std::map<std::string, std::function<void(const std::string &)>> options = {
+        {"--payload", [&](const std::string &v) { config.payload = std::stoull(v); }},
+        {"--devices", [&](const std::string &v) { config.devices = std::stoull(v); }},
+        {"--raid", [&](const std::string &v) { config.raid = std::stoull(v); }},
+        {"--backend", [&](const std::string &v) { config.backend = v; }},
+        {"--queue-depth", [&](const std::string &v) { config.queue_depth = std::stoull(v); }},
+        {"--direct-io", [&](const std::string &v) { config.direct_io = std::stoull(v); }},
+        {"--blocks-per-device", [&](const std::string &v) { config.blocks_per_device = std::stoull(v); }},
+        {"--journal-blocks", [&](const std::string &v) { config.journal_blocks = std::stoull(v); }},
+        {"--batch", [&](const std::string &v) { config.batch = std::stoull(v); }},
+        {"--checkpoint-blocks", [&](const std::string &v) { config.checkpoint_blocks = std::stoull(v); }},
+        {"--checkpoint-ms", [&](const std::string &v) { config.checkpoint_ms = std::stoull(v); }},
+        {"--ops", [&](const std::string &v) { config.ops = std::stoull(v); }},
+        {"--recoveries", [&](const std::string &v) { config.recoveries = std::stoull(v); }},
+        {"--search", [&](const std::string &v) { config.search = v; }},
+        {"--scenarios", [&](const std::string &v) { config.scenarios = v; }},
+        {"--dir", [&](const std::string &v) { config.dir = v; }},
+        {"--seed", [&](const std::string &v) { config.seed = std::stoull(v); }}};
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        auto option = options.find(argv[i]);
+
+        if (option == options.end() || i + 1 >= argc)
+        {
+            throw std::invalid_argument(std::string("Unknown or incomplete option ") + argv[i]);
+        }
+        option->second(argv[i + 1]);
+    }
+
+    return config;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        BenchConfig config = parse_arguments(argc, argv);
+        BenchCluster bench(config);
+        std::mt19937_64 random(config.seed);
+        std::vector<ScenarioResult> results;
+
+        std::stringstream scenarios(config.scenarios);
+        std::string scenario;
+
+        while (std::getline(scenarios, scenario, ','))
+        {
+            std::cerr << "Running " << scenario << std::endl;
+
+            if (scenario == "append")
+            {
+                results.push_back(run_append(bench, config));
+            }
+            else if (scenario == "random_read")
+            {
+                results.push_back(run_random_read(bench, config, random));
+            }
+            else if (scenario == "search")
+            {
+                results.push_back(run_search(bench, config, random));
+            }
+            else if (scenario == "replay")
+            {
+                results.push_back(run_replay(bench, config));
+            }
+            else if (scenario == "recovery")
+            {
+                results.push_back(run_recovery(bench, config));
+            }
+            else if (scenario == "degraded")
+            {
+                results.push_back(run_degraded(bench, config));
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown scenario " + scenario);
+            }
+        }
+
+        write_json(std::cout, config, bench.cluster().get_head().total_blocks, results);
+
+        for (const ScenarioResult &result : results)
+        {
+            if (!result.error.empty())
+            {
+                std::cerr << "stfs_bench: " << result.name << " failed: " << result.error << std::endl;
+                return 1;
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "stfs_bench: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -8,12 +8,13 @@
 using namespace std;
 
 #define BLOCK_PAYLOAD 32
+#define JOURNAL_BLOCKS 16
 
 int main()
 {
     ClusterStructsSizes sizes = {
         .total_block_size = BLOCK_STATIC_SIZE + BLOCK_PAYLOAD,
-        .transaction_size = CLUSTER_STATE_SIZE + BLOCK_STATIC_SIZE + BLOCK_PAYLOAD};
+        .transaction_size = TRANSACTION_STATIC_SIZE + JOURNAL_BLOCKS * (BLOCK_STATIC_SIZE + BLOCK_PAYLOAD)};
     StorageCluster cluster(std::make_unique<Raid0>(), sizes);
 
     int mode = 0;
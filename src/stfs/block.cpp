@@ -1,17 +1,29 @@
+#include <algorithm>
+#include <cstring>
 #include <stfs/block.h>
 #include <stfs/serelization.h>
 #include <stfs/crypto.h>
 
+#define BLOCK_HEADER_SIZE (BLOCK_STATIC_SIZE - sizeof(uint32_t))
+
 std::vector<char> Block::serialize() const {
     std::vector<char> buffer(BLOCK_STATIC_SIZE + block_payload_size);
-    char* ptr = buffer.data();
+    serialize_into(buffer.data());
+    return buffer;
+}
+
+void Block::serialize_into(char* buffer) const {
+    char* ptr = buffer;
 
     SERIALIZE_FIELD(ptr, timestamp, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, block_payload_size, uint64_t, serializeU64);
-    std::memcpy(ptr, payload.data(), payload.size());
-    ptr += payload.size();
+
+    // exactly block_payload_size bytes go out, a short payload is zero padded and a long one cut
+    size_t copied = std::min<size_t>(payload.size(), block_payload_size);
+    std::memcpy(ptr, payload.data(), copied);
+    std::memset(ptr + copied, 0, block_payload_size - copied);
+    ptr += block_payload_size;
     SERIALIZE_FIELD(ptr, crc32, uint32_t, serializeU32);
-    return buffer;
 }
 
 size_t Block::deserialize(const char* buffer) {
@@ -28,25 +40,117 @@ size_t Block::deserialize(const char* buffer) {
     return buffer - start;
 }
 
+// the CRC covers header, payload and the crc field as zeros, streamed without building the serialized block
+static uint32_t header_crc(uint64_t timestamp, uint64_t block_payload_size)
+{
+    char header[BLOCK_HEADER_SIZE];
+    char *ptr = header;
+
+    SERIALIZE_FIELD(ptr, timestamp, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, block_payload_size, uint64_t, serializeU64);
+
+    return generate_CRC32(reinterpret_cast<const uint8_t *>(header), sizeof(header));
+}
+
+static uint32_t append_zero_crc(uint32_t crc)
+{
+    const uint8_t zero_crc[sizeof(uint32_t)] = {};
+    return crc32_update(crc, zero_crc, sizeof(zero_crc));
+}
+
+uint32_t Block::compute_crc() const
+{
+    uint32_t crc = header_crc(timestamp, block_payload_size);
+    size_t covered = std::min<size_t>(payload.size(), block_payload_size);
+    crc = crc32_update(crc, reinterpret_cast<const uint8_t *>(payload.data()), covered);
+
+    // the same bytes serialize_into writes
+    const uint8_t zeros[64] = {};
+    for (size_t left = block_payload_size - covered; left > 0; left -= std::min(left, sizeof(zeros)))
+    {
+        crc = crc32_update(crc, zeros, std::min(left, sizeof(zeros)));
+    }
+
+    return append_zero_crc(crc);
+}
+
 void Block::update_crc()
 {
-    this->crc32 = 0;
-    auto serialized_data = serialize();
-    this->crc32 = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
+    this->crc32 = compute_crc();
+}
+
+void Block::update_crc(uint32_t payload_crc)
+{
+    if (payload.size() != block_payload_size)
+    {
+        update_crc();
+        return;
+    }
+
+    uint32_t crc = crc32_combine(header_crc(timestamp, block_payload_size), payload_crc, payload.size());
+    this->crc32 = append_zero_crc(crc);
 }
 
 bool Block::is_valid() const
 {
-    Block self_copy = *this;
-    self_copy.crc32 = 0;
+    return payload.size() == block_payload_size && compute_crc() == this->crc32;
+}
+
+BlockView::BlockView(const char *data, size_t size) : data_(data), size_(size) {}
 
-    auto serialized_data = self_copy.serialize();
+BlockView::BlockView(std::span<const char> buffer) : data_(buffer.data()), size_(buffer.size()) {}
 
-    uint32_t calculated_crc = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
+uint64_t BlockView::timestamp() const
+{
+    uint64_t timestamp;
+    const char *ptr = data_;
+    DESERIALIZE_FIELD(ptr, timestamp, uint64_t, deserializeU64);
+    return timestamp;
+}
+
+uint64_t BlockView::block_payload_size() const
+{
+    uint64_t block_payload_size;
+    const char *ptr = data_ + sizeof(uint64_t);
+    DESERIALIZE_FIELD(ptr, block_payload_size, uint64_t, deserializeU64);
+    return block_payload_size;
+}
+
+std::span<const char> BlockView::payload() const
+{
+    return {data_ + BLOCK_HEADER_SIZE, block_payload_size()};
+}
+
+uint32_t BlockView::crc32() const
+{
+    uint32_t crc32;
+    const char *ptr = data_ + BLOCK_HEADER_SIZE + block_payload_size();
+    DESERIALIZE_FIELD(ptr, crc32, uint32_t, deserializeU32);
+    return crc32;
+}
 
-    return calculated_crc == this->crc32;
-}
\ No newline at end of file
+bool BlockView::is_well_formed() const
+{
+    return size_ >= BLOCK_STATIC_SIZE && block_payload_size() <= size_ - BLOCK_STATIC_SIZE;
+}
+
+uint32_t BlockView::compute_crc() const
+{
+    return generate_record_CRC32(data_, BLOCK_STATIC_SIZE + block_payload_size());
+}
+
+bool BlockView::is_valid() const
+{
+    return is_well_formed() && compute_crc() == crc32();
+}
+
+Block BlockView::to_block() const
+{
+    auto payload_span = payload();
+
+    return Block{
+        .timestamp = timestamp(),
+        .block_payload_size = payload_span.size(),
+        .payload = std::vector<char>(payload_span.begin(), payload_span.end()),
+        .crc32 = crc32()};
+}
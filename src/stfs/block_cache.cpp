@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stfs/block_cache.h>
+
+BlockCache::BlockCache(size_t shards)
+{
+    size_t count = std::bit_ceil(std::max<size_t>(shards, 1));
+
+    shard_mask_ = count - 1;
+    shards_ = std::make_unique<Shard[]>(count);
+}
+
+// neighbouring block ids are read together, the multiplication spreads them over the shards
+BlockCache::Shard &BlockCache::shard_for(uint64_t key) const
+{
+    return shards_[((key * 0x9E3779B97F4A7C15ull) >> 32) & shard_mask_];
+}
+
+void BlockCache::remove(Shard &shard, size_t slot)
+{
+    shard.bytes -= shard.entries[slot].data.size() + BLOCK_CACHE_ENTRY_OVERHEAD;
+    shard.slots.erase(shard.entries[slot].key);
+
+    if (slot != shard.entries.size() - 1)
+    {
+        shard.entries[slot] = std::move(shard.entries.back());
+        shard.slots[shard.entries[slot].key] = slot;
+    }
+    shard.entries.pop_back();
+
+    if (shard.hand >= shard.entries.size())
+    {
+        shard.hand = 0;
+    }
+}
+
+// the hand clears reference bits until it finds an entry nobody read since its last sweep
+void BlockCache::evict(Shard &shard, size_t capacity, size_t incoming)
+{
+    while (!shard.entries.empty() && shard.bytes + incoming > capacity)
+    {
+        Entry &entry = shard.entries[shard.hand];
+
+        if (entry.referenced)
+        {
+            entry.referenced = false;
+            shard.hand = (shard.hand + 1) % shard.entries.size();
+            continue;
+        }
+
+        remove(shard, shard.hand);
+        evictions_++;
+    }
+}
+
+void BlockCache::set_capacity(size_t bytes)
+{
+    size_t capacity = bytes / (shard_mask_ + 1);
+    shard_capacity_.store(capacity);
+
+    for (size_t i = 0; i <= shard_mask_; ++i)
+    {
+        std::lock_guard lock(shards_[i].mutex);
+        evict(shards_[i], capacity, 0);
+    }
+}
+
+size_t BlockCache::get_capacity() const
+{
+    return shard_capacity_.load() * (shard_mask_ + 1);
+}
+
+bool BlockCache::lookup(uint64_t key, std::span<char> out, uint64_t &epoch)
+{
+    if (shard_capacity_.load(std::memory_order_relaxed) == 0)
+    {
+        return false;
+    }
+
+    Shard &shard = shard_for(key);
+    std::lock_guard lock(shard.mutex);
+
+    auto slot = shard.slots.find(key);
+
+    if (slot == shard.slots.end() || shard.entries[slot->second].data.size() != out.size())
+    {
+        epoch = shard.epoch;
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Entry &entry = shard.entries[slot->second];
+    entry.referenced = true;
+    std::memcpy(out.data(), entry.data.data(), out.size());
+
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void BlockCache::insert(uint64_t key, std::span<const char> data, uint64_t epoch)
+{
+    size_t capacity = shard_capacity_.load(std::memory_order_relaxed);
+    size_t charge = data.size() + BLOCK_CACHE_ENTRY_OVERHEAD;
+
+    if (charge > capacity)
+    {
+        return;
+    }
+
+    Shard &shard = shard_for(key);
+    std::lock_guard lock(shard.mutex);
+
+    if (shard.epoch != epoch || shard.slots.contains(key))
+    {
+        return;
+    }
+
+    evict(shard, capacity, charge);
+
+    shard.slots[key] = shard.entries.size();
+    shard.entries.push_back({.key = key, .data = std::vector<char>(data.begin(), data.end()), .referenced = false});
+    shard.bytes += charge;
+
+    insertions_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BlockCache::invalidate(uint64_t key)
+{
+    Shard &shard = shard_for(key);
+    std::lock_guard lock(shard.mutex);
+
+    shard.epoch++;
+
+    auto slot = shard.slots.find(key);
+
+    if (slot != shard.slots.end())
+    {
+        remove(shard, slot->second);
+        invalidations_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void BlockCache::clear()
+{
+    for (size_t i = 0; i <= shard_mask_; ++i)
+    {
+        Shard &shard = shards_[i];
+        std::lock_guard lock(shard.mutex);
+
+        shard.epoch++;
+        invalidations_.fetch_add(shard.entries.size(), std::memory_order_relaxed);
+
+        shard.entries.clear();
+        shard.slots.clear();
+        shard.hand = 0;
+        shard.bytes = 0;
+    }
+}
+
+BlockCacheStats BlockCache::get_stats() const
+{
+    BlockCacheStats stats{
+        .hits = hits_.load(),
+        .misses = misses_.load(),
+        .insertions = insertions_.load(),
+        .evictions = evictions_.load(),
+        .invalidations = invalidations_.load(),
+        .bytes = 0,
+        .entries = 0};
+
+    for (size_t i = 0; i <= shard_mask_; ++i)
+    {
+        std::lock_guard lock(shards_[i].mutex);
+        stats.bytes += shards_[i].bytes;
+        stats.entries += shards_[i].entries.size();
+    }
+
+    return stats;
+}
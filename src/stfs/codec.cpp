@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cstring>
+#include <stfs/codec.h>
+#include <stfs/storage_cluster.h>
+
+size_t StoreEncoder::append(std::span<const char> data, size_t budget)
+{
+    size_t size = std::min(data.size(), budget > data_.size() ? budget - data_.size() : 0);
+
+    data_.insert(data_.end(), data.begin(), data.begin() + size);
+    return size;
+}
+
+std::span<const char> StoreEncoder::output() const
+{
+    return data_;
+}
+
+std::span<const char> StoreEncoder::raw() const
+{
+    return data_;
+}
+
+void StoreEncoder::reset()
+{
+    data_.clear();
+}
+
+// lengths past the token nibble continue in bytes of 255 closed by a smaller one
+static size_t extra_length_size(size_t length)
+{
+    return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+static void write_extra_length(std::vector<char> &output, size_t length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+    {
+        output.push_back(static_cast<char>(255));
+    }
+    output.push_back(static_cast<char>(length));
+}
+
+static bool read_extra_length(std::span<const char> input, size_t &position, size_t &length)
+{
+    uint8_t byte;
+
+    do
+    {
+        if (position == input.size())
+        {
+            return false;
+        }
+        byte = static_cast<uint8_t>(input[position++]);
+        length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+static size_t sequence_size(size_t literal_count, size_t match_length)
+{
+    size_t size = 1 + extra_length_size(literal_count) + literal_count;
+
+    if (match_length > 0)
+    {
+        size += sizeof(uint16_t) + extra_length_size(match_length - 3);
+    }
+
+    return size;
+}
+
+LzEncoder::LzEncoder() : table_(1 << LZ_HASH_BITS, 0) {}
+
+void LzEncoder::emit(const char *literals, size_t literal_count, size_t match_length, size_t offset)
+{
+    uint8_t match_nibble = match_length > 0 ? std::min<size_t>(match_length - 3, 15) : 0;
+
+    output_.push_back(static_cast<char>((std::min<size_t>(literal_count, 15) << 4) | match_nibble));
+
+    if (literal_count >= 15)
+    {
+        write_extra_length(output_, literal_count);
+    }
+    output_.insert(output_.end(), literals, literals + literal_count);
+
+    if (match_length > 0)
+    {
+        output_.push_back(static_cast<char>(offset & 0xFF));
+        output_.push_back(static_cast<char>(offset >> 8));
+
+        if (match_length - 3 >= 15)
+        {
+            write_extra_length(output_, match_length - 3);
+        }
+    }
+}
+
+size_t LzEncoder::append(std::span<const char> data, size_t budget)
+{
+    size_t start = history_.size();
+    history_.insert(history_.end(), data.begin(), data.end());
+
+    const char *bytes = history_.data();
+    size_t end = history_.size();
+    size_t position = start;
+    size_t literal_start = start;
+
+    while (position + LZ_MIN_MATCH <= end)
+    {
+        uint32_t word;
+        std::memcpy(&word, bytes + position, sizeof(word));
+
+        uint32_t &slot = table_[(word * 2654435761u) >> (32 - LZ_HASH_BITS)];
+        size_t candidate = slot;
+        slot = position + 1;
+
+        if (candidate == 0 || candidate - 1 >= position || position - (candidate - 1) > LZ_MAX_OFFSET || std::memcmp(bytes + candidate - 1, bytes + position, LZ_MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = LZ_MIN_MATCH;
+
+        while (position + length < end && bytes[match + length] == bytes[position + length])
+        {
+            length++;
+        }
+
+        if (output_.size() + sequence_size(position - literal_start, length) > budget)
+        {
+            break;
+        }
+
+        emit(bytes + literal_start, position - literal_start, length, position - match);
+        position += length;
+        literal_start = position;
+    }
+
+    // whatever is left goes out as literals, cut where the budget runs out
+    size_t available = budget > output_.size() ? budget - output_.size() : 0;
+    size_t count = end - literal_start;
+
+    while (count > 0 && sequence_size(count, 0) > available)
+    {
+        size_t overhead = 1 + extra_length_size(count);
+        count = available > overhead ? std::min(count - 1, available - overhead) : 0;
+    }
+
+    if (count > 0)
+    {
+        emit(bytes + literal_start, count, 0, 0);
+    }
+
+    // positions of the dropped tail may stay in the table, candidates are compared byte by byte anyway
+    history_.resize(literal_start + count);
+
+    return history_.size() - start;
+}
+
+std::span<const char> LzEncoder::output() const
+{
+    return output_;
+}
+
+std::span<const char> LzEncoder::raw() const
+{
+    return history_;
+}
+
+void LzEncoder::reset()
+{
+    history_.clear();
+    output_.clear();
+    std::fill(table_.begin(), table_.end(), 0);
+}
+
+static bool lz_decode(std::span<const char> input, std::span<char> output)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < input.size())
+    {
+        uint8_t token = static_cast<uint8_t>(input[in++]);
+        size_t literal_count = token >> 4;
+
+        if (literal_count == 15 && !read_extra_length(input, in, literal_count))
+        {
+            return false;
+        }
+        if (literal_count > input.size() - in || literal_count > output.size() - out)
+        {
+            return false;
+        }
+
+        std::memcpy(output.data() + out, input.data() + in, literal_count);
+        in += literal_count;
+        out += literal_count;
+
+        size_t match_length = token & 0x0F;
+
+        if (match_length == 0)
+        {
+            continue;
+        }
+        if (input.size() - in < sizeof(uint16_t))
+        {
+            return false;
+        }
+
+        size_t offset = static_cast<uint8_t>(input[in]) | (static_cast<size_t>(static_cast<uint8_t>(input[in + 1])) << 8);
+        in += sizeof(uint16_t);
+
+        if (match_length == 15 && !read_extra_length(input, in, match_length))
+        {
+            return false;
+        }
+        match_length += 3;
+
+        if (offset == 0 || offset > out || match_length > output.size() - out)
+        {
+            return false;
+        }
+
+        if (offset >= match_length)
+        {
+            std::memcpy(output.data() + out, output.data() + out - offset, match_length);
+            out += match_length;
+            continue;
+        }
+
+        // the match overlaps the bytes it produces
+        for (size_t i = 0; i < match_length; ++i, ++out)
+        {
+            output[out] = output[out - offset];
+        }
+    }
+
+    return out == output.size();
+}
+
+std::unique_ptr<BlockEncoder> make_block_encoder(PayloadCodec codec)
+{
+    switch (codec)
+    {
+    case PayloadCodec::None:
+        return std::make_unique<StoreEncoder>();
+    case PayloadCodec::Lz:
+        return std::make_unique<LzEncoder>();
+    }
+
+    throw ClusterError("Unknown payload codec " + std::to_string(static_cast<int>(codec)));
+}
+
+bool decode_block(PayloadCodec codec, std::span<const char> input, std::span<char> output)
+{
+    switch (codec)
+    {
+    case PayloadCodec::None:
+        if (input.size() != output.size())
+        {
+            return false;
+        }
+        std::memcpy(output.data(), input.data(), input.size());
+        return true;
+    case PayloadCodec::Lz:
+        return lz_decode(input, output);
+    }
+
+    return false;
+}
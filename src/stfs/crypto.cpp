@@ -1,101 +1,344 @@
+#include <cstring>
 #include <stfs/crypto.h>
 
-#if !defined(FORCE_SOFTWARE_CRC) && (defined(__SSE4_2__) && (defined(__x86_64__) || defined(_M_X64)))
+// CRC32C (Castagnoli). The kernel is picked once at runtime from what the CPU supports,
+// so one binary keeps the hardware path on every machine that has it.
 
-#include <nmmintrin.h>
+#if !defined(FORCE_SOFTWARE_CRC) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC_X86_DISPATCH
+#include <immintrin.h>
+#elif !defined(FORCE_SOFTWARE_CRC) && defined(__aarch64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC_ARM_DISPATCH
+#include <arm_acle.h>
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 
-uint32_t generate_CRC32(const uint8_t *data, uint64_t data_size)
+#define CRC32C_POLY 0x82F63B78u // reflected
+
+// interleaved kernels run three independent chains over stripes of this size and fold them together
+#define CRC_LONG_STRIPE 8192
+#define CRC_SHORT_STRIPE 256
+
+using Crc32Kernel = uint32_t (*)(uint32_t state, const uint8_t *data, uint64_t data_size);
+
+struct Crc32Tables
 {
-    uint64_t crc = 0xFFFFFFFF;
+    uint32_t table[8][256];
 
-    const uint64_t *data64 = reinterpret_cast<const uint64_t *>(data);
-    uint64_t num_chunks = data_size / 8;
-    for (uint64_t i = 0; i < num_chunks; ++i)
+    constexpr Crc32Tables() : table()
     {
-        crc = _mm_crc32_u64(crc, data64[i]);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (int slice = 1; slice < 8; ++slice)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t previous = table[slice - 1][i];
+                table[slice][i] = (previous >> 8) ^ table[0][previous & 0xFF];
+            }
+        }
     }
+};
 
-    uint64_t bytes_processed = num_chunks * 8;
-    for (uint64_t i = bytes_processed; i < data_size; ++i)
+static constexpr Crc32Tables crc32_tables;
+
+// a(x) * b(x) mod P in the reflected representation, bit 31 is x^0
+static constexpr uint32_t crc32_multiply(uint32_t a, uint32_t b)
+{
+    uint32_t product = 0;
+    for (uint32_t mask = 1u << 31; mask != 0; mask >>= 1)
     {
-        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), data[i]);
+        if (a & mask)
+        {
+            product ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
     }
+    return product;
+}
 
-    return static_cast<uint32_t>(crc) ^ 0xFFFFFFFF;
+// x^exponent mod P
+static constexpr uint32_t crc32_x_pow(uint64_t exponent)
+{
+    uint32_t result = 1u << 31;
+    uint32_t square = 1u << 30;
+    while (exponent)
+    {
+        if (exponent & 1)
+        {
+            result = crc32_multiply(result, square);
+        }
+        square = crc32_multiply(square, square);
+        exponent >>= 1;
+    }
+    return result;
 }
 
-#elif !defined(FORCE_SOFTWARE_CRC) && (defined(__ARM_FEATURE_CRC32) && defined(__aarch64__))
+// x^(2^k) mod P, so shifting by any length costs one multiplication per set bit of it
+struct Crc32PowerTable
+{
+    uint32_t power[64];
 
-#include <arm_acle.h>
+    constexpr Crc32PowerTable() : power()
+    {
+        uint32_t square = 1u << 30;
+        for (int k = 0; k < 64; ++k)
+        {
+            power[k] = square;
+            square = crc32_multiply(square, square);
+        }
+    }
+};
 
-uint32_t generate_CRC32(const uint8_t *data, uint64_t data_size)
+static constexpr Crc32PowerTable crc32_powers;
+
+// Shifting a CRC by n bytes is a multiplication by x^(8n). A carry-less product with x^(8n-33)
+// followed by a zero-state crc32 instruction (which multiplies by x^32, the product adds one more x)
+// gives exactly that.
+static constexpr uint32_t crc32_shift_constant(uint64_t bytes)
 {
-    uint32_t crc = 0xFFFFFFFF;
-
-    const uint64_t *data64 = reinterpret_cast<const uint64_t *>(data);
-    uint64_t num_chunks = data_size / 8;
-    for (uint64_t i = 0; i < num_chunks; ++i)
-    {
-        crc = __crc32d(crc, data64[i]);
-    }
-
-    uint64_t bytes_processed = num_chunks * 8;
-    for (uint64_t i = bytes_processed; i < data_size; ++i)
-    {
-        crc = __crc32b(crc, data[i]);
-    }
-
-    return crc ^ 0xFFFFFFFF;
-}
-
-#else
-#pragma warning("Using software CRC32 implementation")
-const uint32_t crc_table[256] = {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
+    return crc32_x_pow(8 * bytes - 33);
+}
 
-uint32_t generate_CRC32(const uint8_t *data, uint64_t data_size)
+static inline uint64_t load_u64(const uint8_t *data)
 {
-    uint32_t crc = 0xFFFFFFFF;
-    for (uint64_t i = 0; i < data_size; ++i)
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t crc32_software(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    const auto &table = crc32_tables.table;
+    uint32_t crc = state;
+
+    for (; data_size >= 8; data += 8, data_size -= 8)
     {
-        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        uint32_t low = crc ^ (uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
     }
-    return crc ^ 0xFFFFFFFF;
+
+    for (; data_size > 0; ++data, --data_size)
+    {
+        crc = table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
 }
+
+#if defined(CRC_X86_DISPATCH)
+
+__attribute__((target("sse4.2"))) static uint32_t crc32_x86(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    uint64_t crc = state;
+
+    for (; data_size >= 8; data += 8, data_size -= 8)
+    {
+        crc = _mm_crc32_u64(crc, load_u64(data));
+    }
+
+    for (; data_size > 0; ++data, --data_size)
+    {
+        crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *data);
+    }
+
+    return static_cast<uint32_t>(crc);
+}
+
+__attribute__((target("sse4.2,pclmul"))) static inline uint64_t crc32_x86_clmul(uint64_t crc, uint32_t constant)
+{
+    return _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128(crc), _mm_cvtsi32_si128(constant), 0x00));
+}
+
+template <uint64_t STRIPE>
+__attribute__((target("sse4.2,pclmul"))) static inline uint32_t crc32_x86_stripes(uint32_t state, const uint8_t *&data, uint64_t &data_size)
+{
+    constexpr uint32_t shift_one = crc32_shift_constant(STRIPE);
+    constexpr uint32_t shift_two = crc32_shift_constant(2 * STRIPE);
+
+    uint32_t crc = state;
+
+    for (; data_size >= 3 * STRIPE; data += 3 * STRIPE, data_size -= 3 * STRIPE)
+    {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+
+        for (uint64_t i = 0; i < STRIPE; i += 8)
+        {
+            crc0 = _mm_crc32_u64(crc0, load_u64(data + i));
+            crc1 = _mm_crc32_u64(crc1, load_u64(data + STRIPE + i));
+            crc2 = _mm_crc32_u64(crc2, load_u64(data + 2 * STRIPE + i));
+        }
+
+        uint64_t folded = crc32_x86_clmul(crc0, shift_two) ^ crc32_x86_clmul(crc1, shift_one);
+        crc = static_cast<uint32_t>(_mm_crc32_u64(0, folded) ^ crc2);
+    }
+
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32_x86_interleaved(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    uint32_t crc = crc32_x86_stripes<CRC_LONG_STRIPE>(state, data, data_size);
+    crc = crc32_x86_stripes<CRC_SHORT_STRIPE>(crc, data, data_size);
+
+    return crc32_x86(crc, data, data_size);
+}
+
+#elif defined(CRC_ARM_DISPATCH)
+
+__attribute__((target("+crc"))) static uint32_t crc32_arm(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    uint32_t crc = state;
+
+    for (; data_size >= 8; data += 8, data_size -= 8)
+    {
+        crc = __crc32cd(crc, load_u64(data));
+    }
+
+    for (; data_size > 0; ++data, --data_size)
+    {
+        crc = __crc32cb(crc, *data);
+    }
+
+    return crc;
+}
+
+__attribute__((target("+crc+crypto"))) static inline uint64_t crc32_arm_clmul(uint64_t crc, uint32_t constant)
+{
+    return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64(crc, constant)), 0);
+}
+
+template <uint64_t STRIPE>
+__attribute__((target("+crc+crypto"))) static inline uint32_t crc32_arm_stripes(uint32_t state, const uint8_t *&data, uint64_t &data_size)
+{
+    constexpr uint32_t shift_one = crc32_shift_constant(STRIPE);
+    constexpr uint32_t shift_two = crc32_shift_constant(2 * STRIPE);
+
+    uint32_t crc = state;
+
+    for (; data_size >= 3 * STRIPE; data += 3 * STRIPE, data_size -= 3 * STRIPE)
+    {
+        uint32_t crc0 = crc;
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+
+        for (uint64_t i = 0; i < STRIPE; i += 8)
+        {
+            crc0 = __crc32cd(crc0, load_u64(data + i));
+            crc1 = __crc32cd(crc1, load_u64(data + STRIPE + i));
+            crc2 = __crc32cd(crc2, load_u64(data + 2 * STRIPE + i));
+        }
+
+        uint64_t folded = crc32_arm_clmul(crc0, shift_two) ^ crc32_arm_clmul(crc1, shift_one);
+        crc = __crc32cd(0, folded) ^ crc2;
+    }
+
+    return crc;
+}
+
+__attribute__((target("+crc+crypto"))) static uint32_t crc32_arm_interleaved(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    uint32_t crc = crc32_arm_stripes<CRC_LONG_STRIPE>(state, data, data_size);
+    crc = crc32_arm_stripes<CRC_SHORT_STRIPE>(crc, data, data_size);
+
+    return crc32_arm(crc, data, data_size);
+}
+
+#endif
+
+struct Crc32Implementation
+{
+    Crc32Kernel kernel;
+    const char *name;
+};
+
+static Crc32Implementation select_crc32_implementation()
+{
+#if defined(CRC_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+    {
+        return {crc32_x86_interleaved, "sse4.2+pclmul"};
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return {crc32_x86, "sse4.2"};
+    }
+#elif defined(CRC_ARM_DISPATCH)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if ((hwcap & HWCAP_CRC32) && (hwcap & HWCAP_PMULL))
+    {
+        return {crc32_arm_interleaved, "crc32+pmull"};
+    }
+    if (hwcap & HWCAP_CRC32)
+    {
+        return {crc32_arm, "crc32"};
+    }
 #endif
+    return {crc32_software, "software"};
+}
+
+static const Crc32Implementation &crc32_implementation()
+{
+    static const Crc32Implementation implementation = select_crc32_implementation();
+    return implementation;
+}
+
+static uint32_t crc32_raw(uint32_t state, const uint8_t *data, uint64_t data_size)
+{
+    return crc32_implementation().kernel(state, data, data_size);
+}
+
+const char *crc32_kernel_name()
+{
+    return crc32_implementation().name;
+}
+
+uint32_t generate_CRC32(const uint8_t *data, uint64_t data_size)
+{
+    return crc32_raw(0xFFFFFFFF, data, data_size) ^ 0xFFFFFFFF;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint64_t data_size)
+{
+    return crc32_raw(crc ^ 0xFFFFFFFF, data, data_size) ^ 0xFFFFFFFF;
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b)
+{
+    // the pre and post inversions of both CRCs cancel out, only A has to be shifted past B
+    uint64_t bits = 8 * size_b;
+    for (int k = 0; bits != 0; ++k, bits >>= 1)
+    {
+        if (bits & 1)
+        {
+            crc_a = crc32_multiply(crc_a, crc32_powers.power[k]);
+        }
+    }
+    return crc_a ^ crc_b;
+}
+
+uint32_t generate_record_CRC32(const char *data, uint64_t record_size)
+{
+    const uint8_t zero_crc[sizeof(uint32_t)] = {};
+
+    uint32_t crc = generate_CRC32(reinterpret_cast<const uint8_t *>(data), record_size - sizeof(zero_crc));
+    return crc32_update(crc, zero_crc, sizeof(zero_crc));
+}
 
 bool validate_CRC32(const uint8_t *data, uint32_t crc32, uint64_t data_size)
 {
     return generate_CRC32(data, data_size) == crc32;
-}
\ No newline at end of file
+}
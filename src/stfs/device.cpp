@@ -3,6 +3,12 @@
 #include <stfs/fs.h>
 #include <stfs/serelization.h>
 
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 std::vector<char> DeviceHead::serialize() const {
     std::vector<char> buffer;
     buffer.resize(DEVICE_HEAD_SIZE);
@@ -25,6 +31,8 @@ size_t DeviceHead::deserialize(const char *buffer) {
     return buffer-start;
 }
 
+#ifdef _WIN32
+
 FileDevice::FileDevice(const std::string& filename, uint64_t offset, bool is_new_file)
     : head_offset_(offset) 
 {
@@ -40,6 +48,25 @@ FileDevice::FileDevice(const std::string& filename, uint64_t offset, bool is_new
     }
 }
 
+#else
+
+FileDevice::FileDevice(const std::string& filename, uint64_t offset, bool is_new_file)
+    : head_offset_(offset) 
+{
+    int flags = O_RDWR;
+    if (is_new_file) {
+        flags |= O_CREAT | O_TRUNC;
+    }
+
+    fd_ = ::open(filename.c_str(), flags, 0644);
+
+    if (fd_ < 0) {
+        throw DeviceError("Failed to open or create device file: " + filename);
+    }
+}
+
+#endif
+
 void FileDevice::read_head() {
     auto head_data = read(head_offset_, DEVICE_HEAD_SIZE);
 
@@ -48,7 +75,7 @@ void FileDevice::read_head() {
 
 void FileDevice::write_head() {
     auto serialized_data = head_.serialize();
-    write(head_offset_, reinterpret_cast<const char*>(serialized_data.data()), DEVICE_HEAD_SIZE+2);
+    write(head_offset_, reinterpret_cast<const char*>(serialized_data.data()), DEVICE_HEAD_SIZE);
 }
 
 std::unique_ptr<Device> FileDevice::open(const std::string& dev_filename, uint64_t head_offset) {
@@ -66,8 +93,8 @@ std::unique_ptr<Device> FileDevice::format(
     auto device = std::unique_ptr<FileDevice>(new FileDevice(dev_filename, head_offset, true));
     
     DeviceHead head {
-        .disk_id = disk_id,
-        .total_blocks_on_disk = total_blocks_on_disk
+        .total_blocks_on_disk = total_blocks_on_disk,
+        .disk_id = disk_id
     };
     device->head_ = head;
     device->write_head();
@@ -79,24 +106,65 @@ const DeviceHead& FileDevice::get_head() const {
     return head_;
 }
 
-std::unique_ptr<char[]> FileDevice::read(size_t position, size_t size)
+std::unique_ptr<char[]> Device::read(size_t position, size_t size)
 {
-    file_.seekg(position);
     auto data = std::make_unique<char[]>(size);
-    file_.read(data.get(), size);
+    read_into(position, {data.get(), size});
+    return data;
+}
+
+std::future<void> Device::read_async(size_t position, std::span<char> buffer)
+{
+    std::promise<void> done;
+    try
+    {
+        read_into(position, buffer);
+        done.set_value();
+    }
+    catch (...)
+    {
+        done.set_exception(std::current_exception());
+    }
+    return done.get_future();
+}
+
+std::future<void> Device::write_async(size_t position, const char *data, size_t size)
+{
+    std::promise<void> done;
+    try
+    {
+        write(position, data, size);
+        done.set_value();
+    }
+    catch (...)
+    {
+        done.set_exception(std::current_exception());
+    }
+    return done.get_future();
+}
+
+#ifdef _WIN32
+
+void FileDevice::read_into(size_t position, std::span<char> buffer)
+{
+    std::lock_guard lock(file_mutex_);
+
+    file_.seekg(position);
+    file_.read(buffer.data(), buffer.size());
     if ((file_.fail() && !file_.eof()) || file_.bad()) {
         throw DeviceError("An error occurred while reading from device.");
     }
     
-    if (file_.gcount() != size) {
+    if (file_.gcount() != buffer.size()) {
         file_.clear();
         throw DeviceError("Unexpected end of file reached.");
     }
-    return data;
 }
 
 void FileDevice::write(size_t position, const char *data, size_t size)
 {
+    std::lock_guard lock(file_mutex_);
+
     file_.seekp(position);
     file_.write(data, size);
     file_.flush();
@@ -107,8 +175,78 @@ void FileDevice::write(size_t position, const char *data, size_t size)
     }
 }
 
+void FileDevice::sync()
+{
+    std::lock_guard lock(file_mutex_);
+
+    file_.flush();
+
+    if (file_.fail() || file_.bad()) {
+        file_.clear();
+        throw DeviceError("An error occurred while syncing device.");
+    }
+}
 
 FileDevice::~FileDevice()
 {
     file_.close();
 }
+
+#else
+
+void FileDevice::read_into(size_t position, std::span<char> buffer)
+{
+    size_t done = 0;
+
+    while (done < buffer.size()) {
+        ssize_t result = ::pread(fd_, buffer.data() + done, buffer.size() - done, position + done);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            throw DeviceError("An error occurred while reading from device.");
+        }
+        if (result == 0) {
+            throw DeviceError("Unexpected end of file reached.");
+        }
+        done += result;
+    }
+}
+
+void FileDevice::write(size_t position, const char *data, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t result = ::pwrite(fd_, data + done, size - done, position + done);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            throw DeviceError("An error occurred while writing from device.");
+        }
+        done += result;
+    }
+}
+
+void FileDevice::sync()
+{
+#ifdef __APPLE__
+    int result = ::fsync(fd_);
+#else
+    int result = ::fdatasync(fd_);
+#endif
+
+    if (result != 0) {
+        throw DeviceError("An error occurred while syncing device.");
+    }
+}
+
+FileDevice::~FileDevice()
+{
+    ::close(fd_);
+}
+
+#endif
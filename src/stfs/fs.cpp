@@ -1,14 +1,58 @@
 #include <stfs/fs.h>
 #include <stfs/search_engine.h>
+#include <algorithm>
 #include <iostream>
+#include <limits>
+
+static bool is_valid_block_data(const char *data, size_t size)
+{
+    return BlockView(data, size).is_valid();
+}
 
 Fs::Fs(StorageCluster &cluster_ref, Journal &journal_ref) : cluster_(cluster_ref), journal_(journal_ref)
 {
+    // the journal is replayed against the true tail, not the last checkpointed state
+    cluster_.recover_tail(is_valid_block_data);
+
     try {
         journal_.recover_transaction();
     } catch (...) {
         std::cerr << "Recovering transaction failed, skiping" << std::endl; 
     }
+
+    // records keep their order across reopens, the newest readable block is stamped with the newest record start
+    if (cluster_.get_payload_format() == PayloadFormat::PackedRecords)
+    {
+        RingBufferState state = cluster_.get_ring_buffer_state();
+
+        for (uint64_t back = 0; back < state.count; ++back)
+        {
+            uint64_t id = (state.tail_id + state.capacity - back) % state.capacity;
+
+            try
+            {
+                last_record_timestamp_ = read_timestamp(id);
+                break;
+            }
+            catch (const ClusterError &e)
+            {
+                std::cerr << "Warning: block " << id << " is unreadable, ordering records after an older block: " << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+// buffered records would be lost otherwise, the destructor cannot report a failure
+Fs::~Fs()
+{
+    try
+    {
+        flush_records();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Warning: buffered records were not committed: " << e.what() << std::endl;
+    }
 }
 
 void Fs::create_block(uint64_t timestamp, const char *payload)
@@ -24,39 +68,231 @@ void Fs::create_block(uint64_t timestamp, const char *payload)
 }
 void Fs::add_block(Block block)
 {
-    block.update_crc();
-    auto serialized = block.serialize();
+    std::lock_guard lock(write_mutex_);
+
     journal_.create_transaction(block);
     journal_.commit_transaction();
 }
 
+void Fs::add_blocks(std::span<const Block> blocks)
+{
+    std::lock_guard lock(write_mutex_);
+
+    commit_blocks(blocks);
+}
+
+// every journal-sized group of blocks commits all or nothing
+void Fs::commit_blocks(std::span<const Block> blocks)
+{
+    uint64_t max_blocks = journal_.get_max_blocks();
+
+    // a bad block fails the call before any group of it is committed
+    journal_.check_blocks(blocks);
+
+    while (!blocks.empty())
+    {
+        auto group = blocks.first(std::min<uint64_t>(blocks.size(), max_blocks));
+
+        journal_.create_transaction(group);
+        journal_.commit_transaction();
+
+        blocks = blocks.subspan(group.size());
+    }
+}
+
+uint64_t Fs::get_max_transaction_blocks() const
+{
+    return journal_.get_max_blocks();
+}
+
 Block Fs::read_block(uint64_t id)
 {
-    DataValidator validator = [](const char *data, size_t size) -> bool
+    std::vector<char> buffer(cluster_.get_total_block_size());
+
+    return read_block_view(id, buffer).to_block();
+}
+
+BlockView Fs::read_block_view(uint64_t id, std::span<char> buffer)
+{
+    cluster_.read_block(id, is_valid_block_data, buffer);
+
+    return BlockView(buffer);
+}
+
+uint64_t Fs::read_timestamp(uint64_t id)
+{
+    if (cluster_.has_index())
     {
-        Block block;
-        block.deserialize(data);
+        try
+        {
+            return cluster_.read_index_entry(id).timestamp;
+        }
+        catch (const ClusterError &e)
+        {
+            std::cerr << "Index entry " << id << " is unusable, falling back to block: " << e.what() << std::endl;
+        }
+    }
 
-        return block.is_valid();
-    };
+    std::vector<char> buffer(cluster_.get_total_block_size());
 
-    Block block;
+    return read_block_view(id, buffer).timestamp();
+}
 
-    auto data = cluster_.read_block(id, validator);
-    block.deserialize(data.get());
+void Fs::enable_sparse_index(uint64_t stride)
+{
+    TimeStampFetcher fetcher = [this](uint64_t id) -> uint64_t {
+        return read_timestamp(id);
+    };
+    cluster_.build_sparse_index(stride, fetcher);
+}
 
-    return block;
+void Fs::set_search_strategy(SearchStrategy strategy)
+{
+    search_strategy_ = strategy;
 }
 
 Block Fs::get_block_by_id(uint64_t id)
 {
     return read_block(id);
 }
-Block Fs::get_block_by_timestamp(uint64_t timestamp)
+
+BlockView Fs::get_block_view_by_id(uint64_t id, std::span<char> buffer)
 {
-    TimeStampFetcher fetcher = [this](uint64_t id) -> uint64_t {
-        return read_block(id).timestamp;
+    return read_block_view(id, buffer);
+}
+// every search records how many timestamps it fetched
+TimeStampFetcher Fs::probing_fetcher(uint64_t &probes)
+{
+    return [this, &probes](uint64_t id) -> uint64_t {
+        probes++;
+        return read_timestamp(id);
     };
-    auto block_id = SearchEngine::find_block_id_by_timestamp(timestamp, fetcher, cluster_.get_ring_buffer_state());
+}
+
+uint64_t Fs::find_first_logical_id(uint64_t timestamp, RingBufferState state)
+{
+    uint64_t probes = 0;
+    TimeStampFetcher fetcher = probing_fetcher(probes);
+
+    uint64_t logical_id = SearchEngine::find_first_logical_id(timestamp, fetcher, state, cluster_.narrow_search(timestamp), search_strategy_);
+
+    cluster_.get_metrics().record(MetricHistogram::SearchProbes, probes);
+    return logical_id;
+}
+
+Block Fs::get_block_by_timestamp(uint64_t timestamp)
+{
+    uint64_t probes = 0;
+    TimeStampFetcher fetcher = probing_fetcher(probes);
+
+    auto block_id = SearchEngine::find_block_id_by_timestamp(timestamp, fetcher, cluster_.get_ring_buffer_state(), cluster_.narrow_search(timestamp), search_strategy_);
+
+    cluster_.get_metrics().record(MetricHistogram::SearchProbes, probes);
     return read_block(block_id);
-}
\ No newline at end of file
+}
+
+BlockScanner Fs::scan(uint64_t from_timestamp, uint64_t to_timestamp, ScanDirection direction)
+{
+    RingBufferState state = cluster_.get_ring_buffer_state();
+
+    uint64_t begin = find_first_logical_id(from_timestamp, state);
+    uint64_t end = state.count;
+
+    if (to_timestamp != std::numeric_limits<uint64_t>::max())
+    {
+        end = find_first_logical_id(to_timestamp + 1, state);
+    }
+
+    return BlockScanner(cluster_, state, begin, end, direction, is_valid_block_data);
+}
+void Fs::require_packed_records() const
+{
+    if (cluster_.get_payload_format() != PayloadFormat::PackedRecords)
+    {
+        throw ClusterError("Cluster is not formatted for packed records");
+    }
+}
+
+void Fs::append_record(uint64_t timestamp, std::span<const char> data)
+{
+    require_packed_records();
+
+    std::lock_guard lock(write_mutex_);
+
+    if (timestamp < last_record_timestamp_)
+    {
+        throw ClusterError("Records must be appended in timestamp order");
+    }
+
+    if (!open_records_)
+    {
+        open_records_.emplace(cluster_.get_head().block_payload_size, cluster_.get_payload_codec());
+    }
+
+    std::vector<Block> sealed;
+    size_t written = 0;
+
+    while (true)
+    {
+        std::optional<size_t> size = open_records_->add(timestamp, data.subspan(written), written > 0);
+
+        if (!size)
+        {
+            sealed.push_back(open_records_->seal());
+            continue;
+        }
+
+        written += *size;
+
+        if (written == data.size())
+        {
+            break;
+        }
+    }
+
+    if (open_records_->full())
+    {
+        sealed.push_back(open_records_->seal());
+    }
+
+    last_record_timestamp_ = timestamp;
+
+    // a record spanning more blocks than a transaction holds is torn by a crash between groups, readers skip it
+    commit_blocks(sealed);
+}
+
+void Fs::flush_records()
+{
+    std::lock_guard lock(write_mutex_);
+
+    if (!open_records_ || open_records_->empty())
+    {
+        return;
+    }
+
+    Block block = open_records_->seal();
+    commit_blocks({&block, 1});
+}
+
+std::optional<Record> Fs::get_record_by_timestamp(uint64_t timestamp)
+{
+    return scan_records(timestamp, std::numeric_limits<uint64_t>::max()).next();
+}
+
+RecordScanner Fs::scan_records(uint64_t from_timestamp, uint64_t to_timestamp)
+{
+    require_packed_records();
+
+    RingBufferState state = cluster_.get_ring_buffer_state();
+
+    // the block holding the first record at from_timestamp is the first one stamped at or after it,
+    // records stamped past to_timestamp can still sit at the front of later blocks so the block range stays open
+    uint64_t begin = find_first_logical_id(from_timestamp, state);
+
+    return RecordScanner(BlockScanner(cluster_, state, begin, state.count, ScanDirection::Forward, is_valid_block_data), from_timestamp, to_timestamp);
+}
+
+MetricsSnapshot Fs::get_metrics_snapshot() const
+{
+    return cluster_.get_metrics_snapshot();
+}
@@ -0,0 +1,48 @@
+#include <stfs/index.h>
+#include <stfs/serelization.h>
+#include <stfs/crypto.h>
+
+std::vector<char> IndexEntry::serialize() const
+{
+    std::vector<char> buffer(INDEX_ENTRY_SIZE);
+    serialize_into(buffer.data());
+    return buffer;
+}
+
+void IndexEntry::serialize_into(char *buffer) const
+{
+    char *ptr = buffer;
+
+    SERIALIZE_FIELD(ptr, timestamp, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, block_id, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, sequence, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, crc32, uint32_t, serializeU32);
+}
+
+size_t IndexEntry::deserialize(const char *buffer)
+{
+    const char *start = buffer;
+
+    DESERIALIZE_FIELD(buffer, timestamp, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, block_id, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, sequence, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, crc32, uint32_t, deserializeU32);
+
+    return buffer - start;
+}
+
+void IndexEntry::update_crc()
+{
+    char serialized_data[INDEX_ENTRY_SIZE];
+    serialize_into(serialized_data);
+
+    this->crc32 = generate_record_CRC32(serialized_data, INDEX_ENTRY_SIZE);
+}
+
+bool IndexEntry::is_valid() const
+{
+    char serialized_data[INDEX_ENTRY_SIZE];
+    serialize_into(serialized_data);
+
+    return generate_record_CRC32(serialized_data, INDEX_ENTRY_SIZE) == this->crc32;
+}
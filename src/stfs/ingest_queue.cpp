@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <bit>
+#include <stfs/ingest_queue.h>
+
+IngestQueue::IngestQueue(Fs &fs, const IngestQueueOptions &options) : fs_(fs)
+{
+    uint64_t max_transaction_blocks = fs_.get_max_transaction_blocks();
+
+    max_batch_blocks_ = options.max_batch_blocks == 0 ? max_transaction_blocks : std::min(options.max_batch_blocks, max_transaction_blocks);
+
+    if (max_batch_blocks_ == 0)
+    {
+        throw ClusterError("Journal cannot hold a single block");
+    }
+
+    size_t capacity = std::bit_ceil(std::max<size_t>(options.capacity, 2));
+    mask_ = capacity - 1;
+    cells_ = std::make_unique<Cell[]>(capacity);
+
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    writer_ = std::thread(&IngestQueue::writer_loop, this);
+}
+
+IngestQueue::~IngestQueue()
+{
+    stop();
+}
+
+// Bounded queue after Vyukov: a cell is free for position p while its sequence is p,
+// holds a block while it is p + 1 and is handed to the next lap once the writer sets p + capacity.
+std::optional<std::future<void>> IngestQueue::try_enqueue(Block &block)
+{
+    uint64_t position = enqueue_position_.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        Cell &cell = cells_[position & mask_];
+        uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+        int64_t lag = static_cast<int64_t>(sequence - position);
+
+        if (lag == 0)
+        {
+            if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                cell.block = std::move(block);
+                cell.committed = std::promise<void>();
+                std::future<void> committed = cell.committed.get_future();
+
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return committed;
+            }
+        }
+        else if (lag < 0)
+        {
+            return std::nullopt;
+        }
+        else
+        {
+            position = enqueue_position_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool IngestQueue::is_empty() const
+{
+    return cells_[dequeue_position_ & mask_].sequence.load(std::memory_order_acquire) != dequeue_position_ + 1;
+}
+
+// a producer registers before it looks at stopping_, so the writer only exits once every
+// producer that got past the check has published its block
+void IngestQueue::enter_producer()
+{
+    active_producers_.fetch_add(1);
+
+    if (stopping_.load())
+    {
+        leave_producer();
+        throw ClusterError("Ingest queue is stopped");
+    }
+}
+
+void IngestQueue::leave_producer()
+{
+    active_producers_.fetch_sub(1);
+
+    writer_wakeups_.fetch_add(1, std::memory_order_release);
+    writer_wakeups_.notify_one();
+}
+
+std::future<void> IngestQueue::submit(Block block)
+{
+    enter_producer();
+
+    while (true)
+    {
+        uint64_t dequeued = dequeued_.load(std::memory_order_acquire);
+        std::optional<std::future<void>> committed = try_enqueue(block);
+
+        if (committed)
+        {
+            leave_producer();
+            return std::move(*committed);
+        }
+
+        dequeued_.wait(dequeued, std::memory_order_acquire);
+    }
+}
+
+std::optional<std::future<void>> IngestQueue::try_submit(Block &&block)
+{
+    enter_producer();
+
+    std::optional<std::future<void>> committed = try_enqueue(block);
+
+    leave_producer();
+    return committed;
+}
+
+void IngestQueue::stop()
+{
+    if (!writer_.joinable())
+    {
+        return;
+    }
+
+    stopping_.store(true);
+    writer_wakeups_.fetch_add(1, std::memory_order_release);
+    writer_wakeups_.notify_one();
+
+    writer_.join();
+}
+
+IngestQueueStats IngestQueue::get_stats() const
+{
+    return {
+        .blocks_committed = blocks_committed_.load(),
+        .blocks_failed = blocks_failed_.load(),
+        .batches = batches_.load()};
+}
+
+void IngestQueue::writer_loop()
+{
+    std::vector<Block> blocks;
+    std::vector<std::promise<void>> promises;
+    blocks.reserve(max_batch_blocks_);
+    promises.reserve(max_batch_blocks_);
+
+    while (true)
+    {
+        uint64_t wakeups = writer_wakeups_.load(std::memory_order_acquire);
+
+        while (blocks.size() < max_batch_blocks_ && !is_empty())
+        {
+            Cell &cell = cells_[dequeue_position_ & mask_];
+
+            blocks.push_back(std::move(cell.block));
+            promises.push_back(std::move(cell.committed));
+
+            cell.sequence.store(dequeue_position_ + mask_ + 1, std::memory_order_release);
+            dequeue_position_++;
+        }
+
+        if (!blocks.empty())
+        {
+            // room is handed back before the disk write, producers refill the queue meanwhile
+            dequeued_.fetch_add(blocks.size(), std::memory_order_release);
+            dequeued_.notify_all();
+
+            commit(blocks, promises);
+            continue;
+        }
+
+        if (stopping_.load() && active_producers_.load() == 0 && is_empty())
+        {
+            return;
+        }
+
+        writer_wakeups_.wait(wakeups, std::memory_order_acquire);
+    }
+}
+
+// a batch never exceeds one journal transaction, so it is committed or rejected as a whole.
+// Stats are counted before the futures resolve, a producer that saw its block committed sees it counted.
+void IngestQueue::commit(std::vector<Block> &blocks, std::vector<std::promise<void>> &promises)
+{
+    std::exception_ptr error;
+
+    try
+    {
+        fs_.add_blocks(blocks);
+        blocks_committed_ += blocks.size();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+        blocks_failed_ += blocks.size();
+    }
+
+    batches_++;
+
+    for (std::promise<void> &committed : promises)
+    {
+        if (error)
+        {
+            committed.set_exception(error);
+        }
+        else
+        {
+            committed.set_value();
+        }
+    }
+    blocks.clear();
+    promises.clear();
+}
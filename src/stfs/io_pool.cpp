@@ -0,0 +1,112 @@
+#include <exception>
+#include <latch>
+#include <stfs/io_pool.h>
+
+IoWorkerPool::~IoWorkerPool()
+{
+    stop();
+}
+
+void IoWorkerPool::worker_loop(Worker &worker)
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(worker.mutex);
+            worker.wakeup.wait(lock, [&worker]
+                               { return worker.stopping || !worker.queue.empty(); });
+
+            if (worker.queue.empty())
+            {
+                return;
+            }
+
+            task = std::move(worker.queue.front());
+            worker.queue.pop_front();
+        }
+
+        task();
+    }
+}
+
+void IoWorkerPool::add_device(uint8_t device_id)
+{
+    if (workers_.contains(device_id))
+    {
+        return;
+    }
+
+    auto worker = std::make_unique<Worker>();
+    worker->thread = std::thread(worker_loop, std::ref(*worker));
+
+    workers_.emplace(device_id, std::move(worker));
+}
+
+void IoWorkerPool::stop()
+{
+    for (auto &[_id, worker] : workers_)
+    {
+        {
+            std::lock_guard lock(worker->mutex);
+            worker->stopping = true;
+        }
+        worker->wakeup.notify_one();
+        worker->thread.join();
+    }
+
+    workers_.clear();
+}
+
+void IoWorkerPool::run(std::vector<IoRequest> &requests)
+{
+    // a lone request gains nothing from a thread handoff
+    if (requests.size() == 1)
+    {
+        requests.front().work();
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(requests.size());
+    std::latch done(requests.size());
+
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        auto task = [&requests, &errors, &done, i]
+        {
+            try
+            {
+                requests[i].work();
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+            done.count_down();
+        };
+
+        auto worker = workers_.find(requests[i].device_id);
+
+        if (worker == workers_.end())
+        {
+            task();
+            continue;
+        }
+
+        {
+            std::lock_guard lock(worker->second->mutex);
+            worker->second->queue.push_back(std::move(task));
+        }
+        worker->second->wakeup.notify_one();
+    }
+
+    done.wait();
+
+    for (const auto &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
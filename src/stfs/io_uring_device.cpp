@@ -0,0 +1,685 @@
+#include <stfs/io_uring_device.h>
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define IO_URING_MAX_CHUNK (1u << 30)
+#define DIRECT_IO_ALIGNMENT 4096
+
+struct IoUringDevice::Ring
+{
+    int fd = -1;
+
+    void *sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    unsigned entries = 0;
+};
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template <typename T>
+static T *ring_field(void *ring, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+IoUringDevice::IoUringDevice(const std::string &filename, uint64_t offset, bool is_new_file, const IoUringOptions &options)
+    : ring_(std::make_unique<Ring>()), head_offset_(offset), direct_io_(options.direct_io)
+{
+    int flags = O_RDWR;
+    if (is_new_file)
+    {
+        flags |= O_CREAT | O_TRUNC;
+    }
+    if (direct_io_)
+    {
+        flags |= O_DIRECT;
+    }
+
+    fd_ = ::open(filename.c_str(), flags, 0644);
+
+    if (fd_ < 0)
+    {
+        throw DeviceError("Failed to open or create device file: " + filename);
+    }
+
+    try
+    {
+        io_uring_params params{};
+        ring_->fd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(options.queue_depth, 1u), &params));
+
+        if (ring_->fd < 0)
+        {
+            throw DeviceError("Failed to set up io_uring: " + std::string(std::strerror(errno)));
+        }
+
+        ring_->entries = params.sq_entries;
+        ring_->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring_->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mapping)
+        {
+            ring_->sq_ring_size = ring_->cq_ring_size = std::max(ring_->sq_ring_size, ring_->cq_ring_size);
+        }
+
+        ring_->sq_ring = mmap(nullptr, ring_->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_SQ_RING);
+        if (ring_->sq_ring == MAP_FAILED)
+        {
+            ring_->sq_ring = nullptr;
+            throw DeviceError("Failed to map io_uring submission ring.");
+        }
+
+        ring_->cq_ring = ring_->sq_ring;
+        if (!single_mapping)
+        {
+            ring_->cq_ring = mmap(nullptr, ring_->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_CQ_RING);
+            if (ring_->cq_ring == MAP_FAILED)
+            {
+                ring_->cq_ring = nullptr;
+                throw DeviceError("Failed to map io_uring completion ring.");
+            }
+        }
+
+        ring_->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, ring_->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            throw DeviceError("Failed to map io_uring submission entries.");
+        }
+        ring_->sqes = static_cast<io_uring_sqe *>(sqes);
+
+        ring_->sq_tail = ring_field<unsigned>(ring_->sq_ring, params.sq_off.tail);
+        ring_->sq_mask = ring_field<unsigned>(ring_->sq_ring, params.sq_off.ring_mask);
+        ring_->sq_array = ring_field<unsigned>(ring_->sq_ring, params.sq_off.array);
+        ring_->cq_head = ring_field<unsigned>(ring_->cq_ring, params.cq_off.head);
+        ring_->cq_tail = ring_field<unsigned>(ring_->cq_ring, params.cq_off.tail);
+        ring_->cq_mask = ring_field<unsigned>(ring_->cq_ring, params.cq_off.ring_mask);
+        ring_->cqes = ring_field<io_uring_cqe>(ring_->cq_ring, params.cq_off.cqes);
+
+        wake_fd_ = eventfd(0, EFD_CLOEXEC);
+        if (wake_fd_ < 0)
+        {
+            throw DeviceError("Failed to create io_uring wake event: " + std::string(std::strerror(errno)));
+        }
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+
+    // every in-flight request holds one slot, so the completion ring (twice the submission ring) never overflows
+    requests_.resize(ring_->entries);
+    if (direct_io_)
+    {
+        bounce_.resize(ring_->entries);
+    }
+    for (uint32_t slot = ring_->entries; slot > 0; --slot)
+    {
+        free_slots_.push_back(slot - 1);
+    }
+
+    reaper_ = std::thread(&IoUringDevice::reap_loop, this);
+}
+
+void IoUringDevice::release()
+{
+    if (ring_->sqes)
+    {
+        munmap(ring_->sqes, ring_->sqes_size);
+    }
+    if (ring_->cq_ring && ring_->cq_ring != ring_->sq_ring)
+    {
+        munmap(ring_->cq_ring, ring_->cq_ring_size);
+    }
+    if (ring_->sq_ring)
+    {
+        munmap(ring_->sq_ring, ring_->sq_ring_size);
+    }
+    if (ring_->fd >= 0)
+    {
+        ::close(ring_->fd);
+    }
+    if (wake_fd_ >= 0)
+    {
+        ::close(wake_fd_);
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+
+    *ring_ = Ring{};
+    wake_fd_ = -1;
+    fd_ = -1;
+}
+
+io_uring_sqe &IoUringDevice::next_sqe()
+{
+    unsigned tail = *ring_->sq_tail;
+    unsigned index = tail & *ring_->sq_mask;
+
+    io_uring_sqe &sqe = ring_->sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    ring_->sq_array[index] = index;
+
+    return sqe;
+}
+
+void IoUringDevice::publish_sqe()
+{
+    std::atomic_ref<unsigned>(*ring_->sq_tail).fetch_add(1, std::memory_order_release);
+
+    while (io_uring_enter(ring_->fd, 1, 0, 0) < 0)
+    {
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            throw DeviceError("Failed to submit io_uring request: " + std::string(std::strerror(errno)));
+        }
+    }
+}
+
+void IoUringDevice::push_request(uint32_t slot)
+{
+    const Request &request = requests_[slot];
+    io_uring_sqe &sqe = next_sqe();
+
+    if (request.fixed)
+    {
+        sqe.opcode = request.is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    }
+    else
+    {
+        sqe.opcode = request.is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe.fd = fd_;
+    sqe.off = request.position;
+    sqe.addr = reinterpret_cast<uint64_t>(request.buffer);
+    sqe.len = static_cast<uint32_t>(std::min<size_t>(request.remaining, IO_URING_MAX_CHUNK));
+    sqe.buf_index = 0;
+    sqe.user_data = slot;
+
+    publish_sqe();
+}
+
+void IoUringDevice::complete(uint32_t slot, int result)
+{
+    std::unique_lock lock(mutex_);
+    Request &request = requests_[slot];
+
+    std::string error;
+    if (result < 0)
+    {
+        error = (request.is_write ? "An error occurred while writing to device: " : "An error occurred while reading from device: ") + std::string(std::strerror(-result));
+    }
+    else if (static_cast<size_t>(result) < request.remaining && request.position + result < request.required_end)
+    {
+        if (result == 0 || (request.bounced && result % DIRECT_IO_ALIGNMENT != 0))
+        {
+            // nothing moved, or an O_DIRECT transfer stopped at the end of file short of the requested bytes
+            error = request.is_write ? "An error occurred while writing to device." : "Unexpected end of file reached.";
+        }
+        else
+        {
+            // short transfer, the rest goes back into the queue under the same slot
+            request.buffer += result;
+            request.position += result;
+            request.remaining -= result;
+
+            try
+            {
+                push_request(slot);
+                return;
+            }
+            catch (const DeviceError &e)
+            {
+                error = e.what();
+            }
+        }
+    }
+
+    if (error.empty() && request.bounced && !request.is_write)
+    {
+        std::memcpy(request.copy_out.data(), bounce_[slot].data.get() + request.copy_offset, request.copy_out.size());
+    }
+
+    std::promise<void> done = std::move(request.done);
+    release_slot(slot);
+
+    lock.unlock();
+    slot_freed_.notify_all();
+
+    if (error.empty())
+    {
+        done.set_value();
+    }
+    else
+    {
+        done.set_exception(std::make_exception_ptr(DeviceError(error)));
+    }
+}
+
+void IoUringDevice::reap_loop()
+{
+    // the ring fd polls readable while completions are queued, the wake fd once the destructor
+    // wants the reaper gone, so shutting down never depends on the ring accepting another request
+    pollfd fds[2] = {
+        {.fd = ring_->fd, .events = POLLIN, .revents = 0},
+        {.fd = wake_fd_, .events = POLLIN, .revents = 0}};
+
+    while (true)
+    {
+        std::string wait_error;
+        bool stopping = false;
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno != EINTR && errno != EAGAIN)
+            {
+                wait_error = std::strerror(errno);
+            }
+        }
+        else if (fds[0].revents & (POLLERR | POLLNVAL))
+        {
+            wait_error = "io_uring file descriptor is no longer usable";
+        }
+        else
+        {
+            stopping = fds[1].revents & POLLIN;
+        }
+
+        unsigned head = *ring_->cq_head;
+        unsigned tail = std::atomic_ref<unsigned>(*ring_->cq_tail).load(std::memory_order_acquire);
+
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &cqe = ring_->cqes[head & *ring_->cq_mask];
+            complete(static_cast<uint32_t>(cqe.user_data), cqe.res);
+        }
+
+        std::atomic_ref<unsigned>(*ring_->cq_head).store(head, std::memory_order_release);
+
+        if (stopping)
+        {
+            return;
+        }
+        if (!wait_error.empty())
+        {
+            std::cerr << "Warning: io_uring wait failed, failing pending requests: " << wait_error << std::endl;
+            fail_pending("io_uring wait failed: " + wait_error);
+            return;
+        }
+    }
+}
+
+void IoUringDevice::fail_pending(const std::string &error)
+{
+    std::vector<std::promise<void>> failed;
+    {
+        std::lock_guard lock(mutex_);
+        reaper_error_ = error;
+
+        std::vector<bool> is_free(requests_.size());
+        for (uint32_t slot : free_slots_)
+        {
+            is_free[slot] = true;
+        }
+
+        for (uint32_t slot = 0; slot < requests_.size(); ++slot)
+        {
+            if (!is_free[slot])
+            {
+                failed.push_back(std::move(requests_[slot].done));
+                release_slot(slot);
+            }
+        }
+    }
+    slot_freed_.notify_all();
+
+    for (auto &done : failed)
+    {
+        done.set_exception(std::make_exception_ptr(DeviceError(error)));
+    }
+}
+
+void IoUringDevice::release_slot(uint32_t slot)
+{
+    requests_[slot].locked_begin = requests_[slot].locked_end = 0;
+    free_slots_.push_back(slot);
+}
+
+void IoUringDevice::drain(std::unique_lock<std::mutex> &lock)
+{
+    slot_freed_.wait(lock, [this]
+                     { return free_slots_.size() == requests_.size(); });
+}
+
+bool IoUringDevice::is_aligned(size_t position, const char *buffer, size_t size) const
+{
+    return position % DIRECT_IO_ALIGNMENT == 0 &&
+           size % DIRECT_IO_ALIGNMENT == 0 &&
+           reinterpret_cast<uintptr_t>(buffer) % DIRECT_IO_ALIGNMENT == 0;
+}
+
+bool IoUringDevice::sectors_locked(size_t begin, size_t end) const
+{
+    return std::any_of(requests_.begin(), requests_.end(), [&](const Request &request)
+                       { return request.locked_begin < end && begin < request.locked_end; });
+}
+
+void IoUringDevice::read_sector(size_t position, char *sector)
+{
+    ssize_t read_bytes = pread(fd_, sector, DIRECT_IO_ALIGNMENT, position);
+    if (read_bytes < 0)
+    {
+        throw DeviceError("An error occurred while reading from device: " + std::string(std::strerror(errno)));
+    }
+
+    // bytes past the end of file read back as zeros
+    std::memset(sector + read_bytes, 0, DIRECT_IO_ALIGNMENT - read_bytes);
+}
+
+// runs without mutex_, the slot's bounce buffer belongs to the submitting thread until the request is pushed
+void IoUringDevice::stage_bounce(uint32_t slot, size_t begin, size_t end, size_t position, const char *data, size_t size, bool is_write)
+{
+    BounceBuffer &bounce = bounce_[slot];
+
+    if (bounce.size < end - begin)
+    {
+        bounce.data.reset(static_cast<char *>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, end - begin)));
+        bounce.size = bounce.data ? end - begin : 0;
+
+        if (!bounce.data)
+        {
+            throw DeviceError("Failed to allocate direct I/O buffer.");
+        }
+    }
+
+    if (!is_write)
+    {
+        return;
+    }
+
+    // partially written edge sectors keep the bytes around the written range
+    size_t last = end - DIRECT_IO_ALIGNMENT;
+    if (position != begin)
+    {
+        read_sector(begin, bounce.data.get());
+    }
+    if (position + size != end && (last != begin || position == begin))
+    {
+        read_sector(last, bounce.data.get() + (last - begin));
+    }
+
+    std::memcpy(bounce.data.get() + (position - begin), data, size);
+}
+
+std::future<void> IoUringDevice::submit(size_t position, char *buffer, size_t size, bool is_write)
+{
+    if (size == 0)
+    {
+        std::promise<void> done;
+        done.set_value();
+        return done.get_future();
+    }
+
+    // O_DIRECT takes sector aligned offsets, lengths and buffers, anything else moves the sectors
+    // it covers through the slot's bounce buffer
+    bool bounced = direct_io_ && !is_aligned(position, buffer, size);
+    size_t begin = position;
+    size_t end = position + size;
+    if (bounced)
+    {
+        begin = position / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        end = (position + size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    }
+
+    // a bounced write rewrites its edge sectors whole, other bounced writes into them wait until it completes
+    bool locks_sectors = bounced && is_write;
+
+    std::unique_lock lock(mutex_);
+    slot_freed_.wait(lock, [&]
+                     { return !free_slots_.empty() && !(locks_sectors && sectors_locked(begin, end)); });
+
+    if (!reaper_error_.empty())
+    {
+        throw DeviceError(reaper_error_);
+    }
+
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+
+    bool fixed = !bounced &&
+                 !registered_buffer_.empty() &&
+                 buffer >= registered_buffer_.data() &&
+                 buffer + size <= registered_buffer_.data() + registered_buffer_.size();
+
+    requests_[slot] = Request{
+        .done = std::promise<void>(),
+        .buffer = buffer,
+        .position = begin,
+        .remaining = end - begin,
+        .required_end = position + size,
+        .copy_out = bounced && !is_write ? std::span<char>(buffer, size) : std::span<char>(),
+        .copy_offset = position - begin,
+        .locked_begin = locks_sectors ? begin : 0,
+        .locked_end = locks_sectors ? end : 0,
+        .is_write = is_write,
+        .fixed = fixed,
+        .bounced = bounced};
+
+    std::future<void> future = requests_[slot].done.get_future();
+
+    try
+    {
+        if (bounced)
+        {
+            // the edge sectors are read without holding up other submitters, the locked range keeps
+            // bounced writes into the same sectors out meanwhile
+            lock.unlock();
+            std::exception_ptr staging_error;
+            try
+            {
+                stage_bounce(slot, begin, end, position, buffer, size, is_write);
+            }
+            catch (...)
+            {
+                staging_error = std::current_exception();
+            }
+            lock.lock();
+
+            if (!reaper_error_.empty())
+            {
+                // fail_pending already failed the request and released its slot
+                return future;
+            }
+            if (staging_error)
+            {
+                std::rethrow_exception(staging_error);
+            }
+
+            requests_[slot].buffer = bounce_[slot].data.get();
+        }
+
+        push_request(slot);
+    }
+    catch (...)
+    {
+        release_slot(slot);
+        lock.unlock();
+        slot_freed_.notify_all();
+        throw;
+    }
+
+    return future;
+}
+
+void IoUringDevice::read_head()
+{
+    auto head_data = read(head_offset_, DEVICE_HEAD_SIZE);
+
+    head_.deserialize(head_data.get());
+}
+
+void IoUringDevice::write_head()
+{
+    auto serialized_data = head_.serialize();
+    write(head_offset_, serialized_data.data(), DEVICE_HEAD_SIZE);
+}
+
+std::unique_ptr<Device> IoUringDevice::open(const std::string &dev_filename, uint64_t head_offset, const IoUringOptions &options)
+{
+    auto device = std::unique_ptr<IoUringDevice>(new IoUringDevice(dev_filename, head_offset, false, options));
+    device->read_head();
+    return device;
+}
+
+std::unique_ptr<Device> IoUringDevice::format(
+    const std::string &dev_filename,
+    uint64_t head_offset,
+    uint64_t total_blocks_on_disk,
+    uint8_t disk_id,
+    const IoUringOptions &options)
+{
+    auto device = std::unique_ptr<IoUringDevice>(new IoUringDevice(dev_filename, head_offset, true, options));
+
+    DeviceHead head{
+        .total_blocks_on_disk = total_blocks_on_disk,
+        .disk_id = disk_id};
+    device->head_ = head;
+    device->write_head();
+    device->sync();
+
+    return device;
+}
+
+const DeviceHead &IoUringDevice::get_head() const
+{
+    return head_;
+}
+
+std::future<void> IoUringDevice::read_async(size_t position, std::span<char> buffer)
+{
+    return submit(position, buffer.data(), buffer.size(), false);
+}
+
+std::future<void> IoUringDevice::write_async(size_t position, const char *data, size_t size)
+{
+    // the kernel only reads from the buffer of a write request
+    return submit(position, const_cast<char *>(data), size, true);
+}
+
+void IoUringDevice::read_into(size_t position, std::span<char> buffer)
+{
+    read_async(position, buffer).get();
+}
+
+void IoUringDevice::write(size_t position, const char *data, size_t size)
+{
+    write_async(position, data, size).get();
+}
+
+void IoUringDevice::sync()
+{
+    {
+        std::unique_lock lock(mutex_);
+        drain(lock);
+    }
+
+    if (fdatasync(fd_) != 0)
+    {
+        throw DeviceError("An error occurred while syncing device.");
+    }
+}
+
+void IoUringDevice::register_buffer(std::span<char> buffer)
+{
+    std::unique_lock lock(mutex_);
+    drain(lock);
+
+    if (!registered_buffer_.empty())
+    {
+        syscall(__NR_io_uring_register, ring_->fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        registered_buffer_ = {};
+    }
+
+    iovec region{
+        .iov_base = buffer.data(),
+        .iov_len = buffer.size()};
+
+    if (syscall(__NR_io_uring_register, ring_->fd, IORING_REGISTER_BUFFERS, &region, 1) != 0)
+    {
+        throw DeviceError("Failed to register io_uring buffer: " + std::string(std::strerror(errno)));
+    }
+
+    registered_buffer_ = buffer;
+}
+
+void IoUringDevice::unregister_buffer()
+{
+    std::unique_lock lock(mutex_);
+    drain(lock);
+
+    if (!registered_buffer_.empty())
+    {
+        syscall(__NR_io_uring_register, ring_->fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        registered_buffer_ = {};
+    }
+}
+
+IoUringDevice::~IoUringDevice()
+{
+    try
+    {
+        std::unique_lock lock(mutex_);
+        drain(lock);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+
+    if (reaper_.joinable())
+    {
+        uint64_t wake = 1;
+        if (::write(wake_fd_, &wake, sizeof(wake)) != sizeof(wake))
+        {
+            std::cerr << "Warning: failed to wake the io_uring reaper: " << std::strerror(errno) << std::endl;
+        }
+        reaper_.join();
+    }
+
+    release();
+}
+
+#endif
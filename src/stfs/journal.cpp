@@ -1,88 +1,307 @@
 #include <stfs/journal.h>
 #include <stfs/serelization.h>
 #include <stfs/crypto.h>
+#include <cstring>
+#include <iostream>
 
-std::vector<char> Transaction::serialize() const
+std::vector<char> Transaction::serialize(ClusterState state, std::span<const Block> blocks)
 {
-    auto serialized_state = state.serialize();
-    auto serialized_block = block.serialize();
+    size_t size = TRANSACTION_STATIC_SIZE;
+    for (const auto &block : blocks)
+    {
+        size += BLOCK_STATIC_SIZE + block.block_payload_size;
+    }
 
-    uint8_t size = serialized_state.size() + serialized_block.size();
+    std::vector<char> data(size);
+    char *ptr = data.data() + TRANSACTION_BODY_OFFSET;
 
-    std::vector<char> data;
-    data.resize(size);
+    state.update_crc();
+    state.serialize_into(ptr);
+    ptr += CLUSTER_STATE_SIZE;
+    SERIALIZE_FIELD(ptr, blocks.size(), uint64_t, serializeU64);
+
+    for (const auto &block : blocks)
+    {
+        // the payload is copied once, the CRC then runs over the still cached copy
+        size_t block_size = BLOCK_STATIC_SIZE + block.block_payload_size;
+        block.serialize_into(ptr);
 
-    char *ptr = data.data();
+        char *crc_ptr = ptr + block_size - sizeof(uint32_t);
+        SERIALIZE_FIELD(crc_ptr, BlockView(ptr, block_size).compute_crc(), uint32_t, serializeU32);
 
-    std::memcpy(ptr, serialized_state.data(), serialized_state.size());
-    ptr += serialized_state.size();
-    std::memcpy(ptr, serialized_block.data(), serialized_block.size());
+        ptr += block_size;
+    }
 
     return data;
 }
 
-size_t Transaction::deserialize(const char *buffer)
+bool Transaction::is_valid_record(const char *data, size_t size, uint64_t max_blocks)
 {
-    const char *start = buffer;
+    if (size < TRANSACTION_STATIC_SIZE)
+    {
+        return false;
+    }
 
-    size_t state_size = state.deserialize(buffer);
-    buffer += state_size;
+    ClusterState state;
+    state.deserialize(data + TRANSACTION_BODY_OFFSET);
 
-    size_t block_size = block.deserialize(buffer);
-    buffer += block_size;
+    uint64_t block_count;
+    const char *ptr = data + TRANSACTION_BODY_OFFSET + CLUSTER_STATE_SIZE;
+    DESERIALIZE_FIELD(ptr, block_count, uint64_t, deserializeU64);
 
-    return buffer - start;
-}
+    if (!state.is_valid() || block_count == 0 || block_count > max_blocks)
+    {
+        return false;
+    }
 
-bool Transaction::is_valid() const
-{
-    return state.is_valid() && block.is_valid();
+    const char *end = data + size;
+    for (uint64_t i = 0; i < block_count; ++i)
+    {
+        BlockView view(ptr, end - ptr);
+
+        if (!view.is_valid())
+        {
+            return false;
+        }
+
+        ptr += BLOCK_STATIC_SIZE + view.block_payload_size();
+    }
+
+    return true;
 }
 
-void Transaction::update_crc() {
-    block.update_crc();
-    state.update_crc();
-};
 Journal::Journal(StorageCluster& cluster): cluster_(cluster) {}
 
+uint64_t Journal::get_max_blocks() const {
+    uint64_t transaction_size = cluster_.get_transaction_size();
+
+    if (transaction_size < TRANSACTION_STATIC_SIZE)
+    {
+        return 0;
+    }
+
+    return (transaction_size - TRANSACTION_STATIC_SIZE) / cluster_.get_total_block_size();
+}
+
+void Journal::check_blocks(std::span<const Block> blocks) const {
+    uint64_t payload_size = cluster_.get_head().block_payload_size;
+
+    for (const auto &block : blocks)
+    {
+        if (block.payload.size() != block.block_payload_size)
+        {
+            throw ClusterError("Block payload of " + std::to_string(block.payload.size()) + " bytes disagrees with its declared size " + std::to_string(block.block_payload_size));
+        }
+        if (block.block_payload_size > payload_size)
+        {
+            throw ClusterError("Block payload size " + std::to_string(block.block_payload_size) + " exceeds the cluster block payload size " + std::to_string(payload_size));
+        }
+    }
+}
+
 void Journal::create_transaction(Block block) {
-    Transaction transaction = {
-        .state = cluster_.get_state(),
-        .block = block
-    };
+    create_transaction(std::span<const Block>(&block, 1));
+}
 
-    entry_ = transaction;
-    entry_->update_crc();
+void Journal::create_transaction(std::span<const Block> blocks) {
+    if (blocks.empty() || blocks.size() > get_max_blocks())
+    {
+        throw ClusterError("Transaction does not fit the journal, max blocks: " + std::to_string(get_max_blocks()));
+    }
+    check_blocks(blocks);
 
-    auto serialized_data = entry_->serialize();
+    auto started = Metrics::Clock::now();
+    entry_ = Transaction::serialize(cluster_.get_state(), blocks);
 
-    cluster_.write_transaction_block(serialized_data.data());
+    // the sync also makes the data of the previous transaction durable before its slot can be reused
+    cluster_.append_journal_record(*entry_);
+    cluster_.sync_devices();
+    cluster_.get_metrics().record(MetricHistogram::JournalWriteNs, Metrics::elapsed_ns(started));
 }
 
 void Journal::commit_transaction() {
-    auto serialized_block = entry_->block.serialize();
-    cluster_.write_next_block(serialized_block.data());
-    uint64_t last_block_id = cluster_.get_ring_buffer_state().tail_id;
+    if (!entry_)
+    {
+        throw ClusterError("No transaction to commit");
+    }
+
+    auto started = Metrics::Clock::now();
+
+    uint64_t total_block_size = cluster_.get_total_block_size();
+
+    uint64_t block_count;
+    const char *ptr = entry_->data() + TRANSACTION_BODY_OFFSET + CLUSTER_STATE_SIZE;
+    DESERIALIZE_FIELD(ptr, block_count, uint64_t, deserializeU64);
+
+    const char *blocks_data = ptr;
+    const char *end = entry_->data() + entry_->size();
+
+    std::vector<uint64_t> timestamps;
+    timestamps.reserve(block_count);
+    bool packed = true;
+
+    for (uint64_t i = 0; i < block_count; ++i)
+    {
+        BlockView view(ptr, end - ptr);
+        size_t block_size = BLOCK_STATIC_SIZE + view.block_payload_size();
 
-    size_t struct_size = entry_->serialize().size();
+        // a logged record may come from a cluster formatted with larger blocks
+        if (block_size > total_block_size)
+        {
+            entry_.reset();
+            throw ClusterError("Logged block of " + std::to_string(block_size) + " bytes exceeds the cluster block size");
+        }
 
-    std::vector<char> zero_vector(struct_size, 0);
+        timestamps.push_back(view.timestamp());
+        packed = packed && block_size == total_block_size;
+        ptr += block_size;
+    }
 
-    cluster_.write_transaction_block(zero_vector.data());
+    // full size blocks already sit back to back in the record and are written from it as is
+    std::vector<char> padded_blocks;
+    if (!packed)
+    {
+        padded_blocks.resize(block_count * total_block_size);
+        ptr = blocks_data;
+
+        for (uint64_t i = 0; i < block_count; ++i)
+        {
+            size_t block_size = BLOCK_STATIC_SIZE + BlockView(ptr, end - ptr).block_payload_size();
+            std::memcpy(padded_blocks.data() + i * total_block_size, ptr, block_size);
+            ptr += block_size;
+        }
+        blocks_data = padded_blocks.data();
+    }
+
+    cluster_.write_next_blocks(blocks_data, block_count, timestamps);
+
+    // a single slot is overwritten by the next record, the data has to be durable before that
+    if (cluster_.get_journal_slots() == 1)
+    {
+        cluster_.sync_devices();
+    }
+
+    entry_.reset();
+    cluster_.get_metrics().record(MetricHistogram::JournalCommitNs, Metrics::elapsed_ns(started));
+}
+
+bool Journal::reached_data_region(const std::vector<char> &record, const ClusterState &logged, uint64_t block_count) {
+    ClusterState state = cluster_.get_state();
+    uint64_t capacity = cluster_.get_head().total_blocks;
+    uint64_t first_valid = state.total_writes_count - state.valid_block_count;
+    uint64_t first_id = RingBufferState{
+        .head_id = logged.head_logical_block_id,
+        .tail_id = logged.tail_logical_block_id,
+        .count = logged.valid_block_count,
+        .capacity = capacity}.get_next_block_id();
+
+    std::vector<char> stored(cluster_.get_total_block_size());
+    const char *ptr = record.data() + TRANSACTION_STATIC_SIZE;
+
+    for (uint64_t i = 0; i < block_count; ++i)
+    {
+        const char *logged_block = ptr;
+        size_t block_size = BLOCK_STATIC_SIZE + BlockView(ptr, record.data() + record.size() - ptr).block_payload_size();
+        uint64_t sequence = logged.total_writes_count + i;
+        uint64_t id = (first_id + i) % capacity;
+        ptr += block_size;
+
+        // a block that already left the ring was synced before a later transaction overwrote it
+        if (sequence < first_valid)
+        {
+            continue;
+        }
+
+        DataValidator matches_record = [logged_block, block_size](const char *data, size_t size) {
+            return size >= block_size && std::memcmp(data, logged_block, block_size) == 0;
+        };
+
+        try
+        {
+            cluster_.read_block(id, matches_record, stored);
+            if (cluster_.has_index() && cluster_.read_index_entry(id).sequence != sequence)
+            {
+                return false;
+            }
+        }
+        catch (const ClusterError &)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 void Journal::recover_transaction() {
-    DataValidator validator = [](const char *data, size_t size) -> bool {
-        Transaction transaction;
-        transaction.deserialize(data);
+    uint64_t max_blocks = get_max_blocks();
+    auto records = cluster_.read_journal();
 
-        return transaction.is_valid();
+    struct LoggedTransaction
+    {
+        size_t record = 0;
+        ClusterState state{};
+        uint64_t block_count = 0;
     };
 
-    auto data = cluster_.read_transaction_block(validator);
-    Transaction transaction;
-    transaction.deserialize(data.get());
-    entry_ = transaction;
-    
-    commit_transaction();
-}
\ No newline at end of file
+    // walking back from the newest record, one logged against the same or an earlier state than a
+    // later record was abandoned or rolled back and is not replayed
+    std::vector<LoggedTransaction> chain;
+    uint64_t next_start = UINT64_MAX;
+
+    for (size_t i = records.size(); i-- > 0;)
+    {
+        const std::vector<char> &data = records[i].data;
+
+        if (!Transaction::is_valid_record(data.data(), data.size(), max_blocks))
+        {
+            std::cerr << "Warning: journal record " << records[i].sequence << " is damaged, skipping" << std::endl;
+            continue;
+        }
+
+        LoggedTransaction logged{.record = i};
+        const char *ptr = data.data() + TRANSACTION_BODY_OFFSET;
+        ptr += logged.state.deserialize(ptr);
+        DESERIALIZE_FIELD(ptr, logged.block_count, uint64_t, deserializeU64);
+
+        if (logged.state.total_writes_count >= next_start)
+        {
+            continue;
+        }
+        next_start = logged.state.total_writes_count;
+        chain.push_back(logged);
+    }
+
+    bool replayed = false;
+
+    for (auto logged = chain.rbegin(); logged != chain.rend(); ++logged)
+    {
+        uint64_t total_writes = cluster_.get_state().total_writes_count;
+
+        // the state of a pipelined commit may reach the disk before its data, a covered record is
+        // trusted only once its blocks are found in place
+        if (logged->state.total_writes_count + logged->block_count <= total_writes &&
+            reached_data_region(records[logged->record].data, logged->state, logged->block_count))
+        {
+            continue;
+        }
+        if (logged->state.total_writes_count > total_writes)
+        {
+            std::cerr << "Warning: journal record " << records[logged->record].sequence << " starts past the cluster state, stopping recovery" << std::endl;
+            break;
+        }
+
+        entry_ = std::move(records[logged->record].data);
+
+        // replay from the state the transaction was logged against, so blocks that already
+        // reached the data region are not appended twice
+        cluster_.update_state(logged->state);
+        commit_transaction();
+        replayed = true;
+    }
+
+    if (replayed)
+    {
+        cluster_.sync_devices();
+    }
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+#include <utility>
+#include <stfs/metrics.h>
+
+#define SUB_BUCKETS (1ull << HISTOGRAM_SUB_BUCKET_BITS)
+
+static const char *counter_names[] = {
+    "stfs_replicas_repaired_total",
+    "stfs_parity_rebuilds_total",
+    "stfs_quorum_failures_total",
+};
+
+// the bool marks nanosecond histograms, exported in seconds
+static const std::pair<const char *, bool> histogram_names[] = {
+    {"stfs_crc_verify_seconds", true},
+    {"stfs_journal_write_seconds", true},
+    {"stfs_journal_commit_seconds", true},
+    {"stfs_search_probes", false},
+};
+
+static const char *device_op_names[] = {
+    "stfs_device_read_seconds",
+    "stfs_device_write_seconds",
+    "stfs_device_sync_seconds",
+};
+
+static const double exported_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+uint64_t HistogramSnapshot::quantile(double q) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count)));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return LatencyHistogram::bucket_upper_bound(i);
+        }
+    }
+
+    return LatencyHistogram::bucket_upper_bound(buckets.size() - 1);
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    size_t msb = std::bit_width(value) - 1;
+
+    if (msb >= HISTOGRAM_MAX_BITS)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    size_t shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    size_t shift = (bucket >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+    uint64_t lower = (SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+
+    return lower + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::add_to(HistogramSnapshot &snapshot) const
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        uint64_t hits = buckets_[i].load(std::memory_order_relaxed);
+        snapshot.buckets[i] += hits;
+        snapshot.count += hits;
+    }
+    snapshot.sum += sum_.load(std::memory_order_relaxed);
+}
+
+Metrics::Metrics() : shards_(std::make_unique<Shard[]>(METRICS_SHARDS)) {}
+
+size_t Metrics::shard_index()
+{
+    static std::atomic<size_t> next_thread = 0;
+    thread_local size_t index = next_thread.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+
+    return index;
+}
+
+uint64_t Metrics::elapsed_ns(Clock::time_point started)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count();
+}
+
+void Metrics::register_device(uint8_t disk_id)
+{
+    if (!devices_[disk_id])
+    {
+        devices_[disk_id] = std::make_unique<DeviceShards>();
+    }
+}
+
+void Metrics::add(MetricCounter metric, uint64_t value)
+{
+    shards_[shard_index()].counters[static_cast<size_t>(metric)].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::record(MetricHistogram metric, uint64_t value)
+{
+    shards_[shard_index()].histograms[static_cast<size_t>(metric)].record(value);
+}
+
+void Metrics::record_device(uint8_t disk_id, DeviceOp op, uint64_t bytes, Clock::time_point started)
+{
+    if (!devices_[disk_id])
+    {
+        return;
+    }
+
+    DeviceShard &shard = (*devices_[disk_id])[shard_index()];
+
+    if (op == DeviceOp::Read)
+    {
+        shard.read_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    else if (op == DeviceOp::Write)
+    {
+        shard.write_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    shard.latency[static_cast<size_t>(op)].record(elapsed_ns(started));
+}
+
+void Metrics::record_device_error(uint8_t disk_id)
+{
+    if (devices_[disk_id])
+    {
+        (*devices_[disk_id])[shard_index()].errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+MetricsSnapshot Metrics::snapshot() const
+{
+    MetricsSnapshot snapshot;
+
+    for (size_t s = 0; s < METRICS_SHARDS; ++s)
+    {
+        const Shard &shard = shards_[s];
+
+        for (size_t i = 0; i < snapshot.counters.size(); ++i)
+        {
+            snapshot.counters[i] += shard.counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < snapshot.histograms.size(); ++i)
+        {
+            shard.histograms[i].add_to(snapshot.histograms[i]);
+        }
+    }
+
+    for (size_t disk_id = 0; disk_id < devices_.size(); ++disk_id)
+    {
+        if (!devices_[disk_id])
+        {
+            continue;
+        }
+
+        DeviceMetricsSnapshot &device = snapshot.devices.emplace_back();
+        device.disk_id = disk_id;
+
+        for (const DeviceShard &shard : *devices_[disk_id])
+        {
+            device.read_bytes += shard.read_bytes.load(std::memory_order_relaxed);
+            device.write_bytes += shard.write_bytes.load(std::memory_order_relaxed);
+            device.errors += shard.errors.load(std::memory_order_relaxed);
+
+            for (size_t i = 0; i < device.latency_ns.size(); ++i)
+            {
+                shard.latency[i].add_to(device.latency_ns[i]);
+            }
+        }
+    }
+
+    return snapshot;
+}
+
+uint64_t MetricsSnapshot::counter(MetricCounter metric) const
+{
+    return counters[static_cast<size_t>(metric)];
+}
+
+const HistogramSnapshot &MetricsSnapshot::histogram(MetricHistogram metric) const
+{
+    return histograms[static_cast<size_t>(metric)];
+}
+
+static void write_summary(std::ostringstream &out, const std::string &name, const std::string &labels, const HistogramSnapshot &histogram, bool nanoseconds)
+{
+    double scale = nanoseconds ? 1e-9 : 1.0;
+    std::string separator = labels.empty() ? "" : ",";
+
+    for (double q : exported_quantiles)
+    {
+        out << name << "{" << labels << separator << "quantile=\"" << q << "\"} " << histogram.quantile(q) * scale << "\n";
+    }
+
+    std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << suffix << " " << histogram.sum * scale << "\n";
+    out << name << "_count" << suffix << " " << histogram.count << "\n";
+}
+
+std::string MetricsSnapshot::to_prometheus() const
+{
+    std::ostringstream out;
+
+    for (size_t i = 0; i < counters.size(); ++i)
+    {
+        out << "# TYPE " << counter_names[i] << " counter\n";
+        out << counter_names[i] << " " << counters[i] << "\n";
+    }
+
+    for (size_t i = 0; i < histograms.size(); ++i)
+    {
+        out << "# TYPE " << histogram_names[i].first << " summary\n";
+        write_summary(out, histogram_names[i].first, "", histograms[i], histogram_names[i].second);
+    }
+
+    const std::pair<const char *, uint64_t DeviceMetricsSnapshot::*> device_counters[] = {
+        {"stfs_device_read_bytes_total", &DeviceMetricsSnapshot::read_bytes},
+        {"stfs_device_write_bytes_total", &DeviceMetricsSnapshot::write_bytes},
+        {"stfs_device_errors_total", &DeviceMetricsSnapshot::errors},
+    };
+
+    for (const auto &[name, field] : device_counters)
+    {
+        out << "# TYPE " << name << " counter\n";
+        for (const DeviceMetricsSnapshot &device : devices)
+        {
+            out << name << "{disk=\"" << (int)device.disk_id << "\"} " << device.*field << "\n";
+        }
+    }
+
+    for (size_t op = 0; op < static_cast<size_t>(DeviceOp::Count); ++op)
+    {
+        out << "# TYPE " << device_op_names[op] << " summary\n";
+        for (const DeviceMetricsSnapshot &device : devices)
+        {
+            write_summary(out, device_op_names[op], "disk=\"" + std::to_string(device.disk_id) + "\"", device.latency_ns[op], true);
+        }
+    }
+
+    return out.str();
+}
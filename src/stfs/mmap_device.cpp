@@ -0,0 +1,234 @@
+#include <stfs/mmap_device.h>
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MmapDevice::MmapDevice(const std::string &filename, uint64_t offset, bool is_new_file)
+    : head_offset_(offset)
+{
+    int flags = O_RDWR;
+    if (is_new_file)
+    {
+        flags |= O_CREAT | O_TRUNC;
+    }
+
+    fd_ = ::open(filename.c_str(), flags, 0644);
+
+    if (fd_ < 0)
+    {
+        throw DeviceError("Failed to open or create device file: " + filename);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd_, &file_stat) != 0)
+    {
+        ::close(fd_);
+        throw DeviceError("Failed to stat device file: " + filename);
+    }
+
+    if (file_stat.st_size > 0)
+    {
+        try
+        {
+            map(file_stat.st_size);
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            throw;
+        }
+    }
+}
+
+void MmapDevice::map(size_t size)
+{
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        throw DeviceError("Failed to map device file.");
+    }
+
+    mapping_ = static_cast<char *>(mapping);
+    mapped_size_ = size;
+}
+
+void MmapDevice::unmap()
+{
+    if (mapping_)
+    {
+        munmap(mapping_, mapped_size_);
+        mapping_ = nullptr;
+        mapped_size_ = 0;
+    }
+}
+
+void MmapDevice::ensure_size(size_t size)
+{
+    if (size <= mapped_size_)
+    {
+        return;
+    }
+
+    // grow geometrically so appends into a fresh device do not remap on every block
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t new_size = std::max(size, mapped_size_ * 2);
+    new_size = (new_size + page_size - 1) / page_size * page_size;
+
+    if (dirty_begin_ != dirty_end_)
+    {
+        flush_range(dirty_begin_, dirty_end_);
+        dirty_begin_ = dirty_end_ = 0;
+    }
+    unmap();
+
+    if (ftruncate(fd_, new_size) != 0)
+    {
+        throw DeviceError("Failed to grow device file.");
+    }
+
+    map(new_size);
+}
+
+void MmapDevice::read_head()
+{
+    auto head_data = read(head_offset_, DEVICE_HEAD_SIZE);
+
+    head_.deserialize(head_data.get());
+}
+
+void MmapDevice::write_head()
+{
+    auto serialized_data = head_.serialize();
+    write(head_offset_, serialized_data.data(), DEVICE_HEAD_SIZE);
+}
+
+std::unique_ptr<Device> MmapDevice::open(const std::string &dev_filename, uint64_t head_offset)
+{
+    auto device = std::unique_ptr<MmapDevice>(new MmapDevice(dev_filename, head_offset, false));
+    device->read_head();
+    return device;
+}
+
+std::unique_ptr<Device> MmapDevice::format(
+    const std::string &dev_filename,
+    uint64_t head_offset,
+    uint64_t total_blocks_on_disk,
+    uint8_t disk_id)
+{
+    auto device = std::unique_ptr<MmapDevice>(new MmapDevice(dev_filename, head_offset, true));
+
+    DeviceHead head{
+        .total_blocks_on_disk = total_blocks_on_disk,
+        .disk_id = disk_id};
+    device->head_ = head;
+    device->write_head();
+    device->sync();
+
+    return device;
+}
+
+const DeviceHead &MmapDevice::get_head() const
+{
+    return head_;
+}
+
+void MmapDevice::read_into(size_t position, std::span<char> buffer)
+{
+    std::shared_lock lock(mapping_mutex_);
+
+    if (position + buffer.size() > mapped_size_)
+    {
+        throw DeviceError("Unexpected end of file reached.");
+    }
+
+    std::memcpy(buffer.data(), mapping_ + position, buffer.size());
+}
+
+void MmapDevice::write(size_t position, const char *data, size_t size)
+{
+    std::lock_guard lock(mapping_mutex_);
+
+    ensure_size(position + size);
+
+    std::memcpy(mapping_ + position, data, size);
+    mark_dirty(position, position + size);
+}
+
+void MmapDevice::mark_dirty(size_t begin, size_t end)
+{
+    if (dirty_begin_ == dirty_end_)
+    {
+        dirty_begin_ = begin;
+        dirty_end_ = end;
+    }
+    else
+    {
+        dirty_begin_ = std::min(dirty_begin_, begin);
+        dirty_end_ = std::max(dirty_end_, end);
+    }
+}
+
+void MmapDevice::flush_range(size_t begin, size_t end)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    begin = begin / page_size * page_size;
+
+    if (msync(mapping_ + begin, end - begin, MS_SYNC) != 0)
+    {
+        throw DeviceError("An error occurred while syncing device.");
+    }
+}
+
+void MmapDevice::sync()
+{
+    size_t begin;
+    size_t end;
+    {
+        std::lock_guard lock(mapping_mutex_);
+        begin = dirty_begin_;
+        end = dirty_end_;
+        dirty_begin_ = dirty_end_ = 0;
+    }
+
+    if (begin == end)
+    {
+        return;
+    }
+
+    // msync runs under the shared lock, readers are not held up by it
+    try
+    {
+        std::shared_lock lock(mapping_mutex_);
+        flush_range(begin, end);
+    }
+    catch (const DeviceError &)
+    {
+        std::lock_guard lock(mapping_mutex_);
+        mark_dirty(begin, end);
+        throw;
+    }
+}
+
+MmapDevice::~MmapDevice()
+{
+    try
+    {
+        sync();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Warning: " << e.what() << std::endl;
+    }
+
+    unmap();
+    ::close(fd_);
+}
+
+#endif
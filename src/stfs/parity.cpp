@@ -0,0 +1,174 @@
+#include <cstring>
+#include <stfs/parity.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+struct GfTables
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    constexpr GfTables() : exp(), log()
+    {
+        uint16_t value = 1;
+        for (int i = 0; i < 255; ++i)
+        {
+            exp[i] = static_cast<uint8_t>(value);
+            log[value] = static_cast<uint8_t>(i);
+            value <<= 1;
+            if (value & 0x100)
+            {
+                value ^= 0x11D;
+            }
+        }
+        for (int i = 255; i < 512; ++i)
+        {
+            exp[i] = exp[i - 255];
+        }
+    }
+};
+
+static constexpr GfTables gf_tables;
+
+uint8_t gf256_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return gf_tables.exp[gf_tables.log[a] + gf_tables.log[b]];
+}
+
+uint8_t gf256_inv(uint8_t a)
+{
+    return gf_tables.exp[255 - gf_tables.log[a]];
+}
+
+uint8_t gf256_pow2(uint64_t exponent)
+{
+    return gf_tables.exp[exponent % 255];
+}
+
+void xor_into(char *dst, const char *src, size_t size)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16)
+    {
+        uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t *>(dst + i));
+        uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t *>(src + i));
+        vst1q_u8(reinterpret_cast<uint8_t *>(dst + i), veorq_u8(a, b));
+    }
+#endif
+
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, sizeof(a));
+        std::memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        std::memcpy(dst + i, &a, sizeof(a));
+    }
+
+    for (; i < size; ++i)
+    {
+        dst[i] ^= src[i];
+    }
+}
+
+void gf256_mul_xor_into(char *dst, const char *src, uint8_t factor, size_t size)
+{
+    if (factor == 0)
+    {
+        return;
+    }
+    if (factor == 1)
+    {
+        xor_into(dst, src, size);
+        return;
+    }
+
+    // product of factor and every nibble value, a byte is multiplied as low ^ high
+    alignas(16) uint8_t low[16];
+    alignas(16) uint8_t high[16];
+    for (uint8_t x = 0; x < 16; ++x)
+    {
+        low[x] = gf256_mul(factor, x);
+        high[x] = gf256_mul(factor, x << 4);
+    }
+
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(low)));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(high)));
+    __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i low_nibbles = _mm256_and_si256(value, nibble_mask);
+        __m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi16(value, 4), nibble_mask);
+        __m256i product = _mm256_xor_si256(
+            _mm256_shuffle_epi8(low_table, low_nibbles),
+            _mm256_shuffle_epi8(high_table, high_nibbles));
+        __m256i target = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(target, product));
+    }
+#elif defined(__SSSE3__)
+    __m128i low_table = _mm_load_si128(reinterpret_cast<const __m128i *>(low));
+    __m128i high_table = _mm_load_si128(reinterpret_cast<const __m128i *>(high));
+    __m128i nibble_mask = _mm_set1_epi8(0x0F);
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i low_nibbles = _mm_and_si128(value, nibble_mask);
+        __m128i high_nibbles = _mm_and_si128(_mm_srli_epi16(value, 4), nibble_mask);
+        __m128i product = _mm_xor_si128(
+            _mm_shuffle_epi8(low_table, low_nibbles),
+            _mm_shuffle_epi8(high_table, high_nibbles));
+        __m128i target = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(target, product));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t low_table = vld1q_u8(low);
+    uint8x16_t high_table = vld1q_u8(high);
+    uint8x16_t nibble_mask = vdupq_n_u8(0x0F);
+
+    for (; i + 16 <= size; i += 16)
+    {
+        uint8x16_t value = vld1q_u8(reinterpret_cast<const uint8_t *>(src + i));
+        uint8x16_t product = veorq_u8(
+            vqtbl1q_u8(low_table, vandq_u8(value, nibble_mask)),
+            vqtbl1q_u8(high_table, vshrq_n_u8(value, 4)));
+        uint8x16_t target = vld1q_u8(reinterpret_cast<const uint8_t *>(dst + i));
+        vst1q_u8(reinterpret_cast<uint8_t *>(dst + i), veorq_u8(target, product));
+    }
+#endif
+
+    for (; i < size; ++i)
+    {
+        uint8_t value = static_cast<uint8_t>(src[i]);
+        dst[i] ^= static_cast<char>(low[value & 0x0F] ^ high[value >> 4]);
+    }
+}
@@ -1,26 +1,187 @@
 #include <stfs/raid.h>
-#include <iostream>
+#include <algorithm>
 
-std::vector<PhysicalLocation> Raid0::map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const {
+bool RaidGovernor::map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const {
+    for (uint64_t i = 0; i < out.size(); ++i) {
+        PhysicalLocations locations = map_logical_to_physical(first_id + i, disks_layout);
+
+        if (locations.empty()) {
+            return false;
+        }
+        out[i] = locations[copy % locations.size()];
+    }
+    return true;
+}
+
+PhysicalLocations Raid0::map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const {
+    PhysicalLocations locations;
     uint64_t num_disks = disks_layout.size();
 
     if (num_disks == 0) {
-        std::cerr << "Error: No disks in RAID layout!" << std::endl;
-        return {};
+        return locations;
     }
 
     uint8_t target_disk_id = block_id % num_disks;
 
     uint64_t physical_block = block_id / num_disks;
 
-    if (physical_block >= disks_layout[target_disk_id].total_blocks) {
-        std::cerr << "Error: Address out of bounds on disk " << (int)target_disk_id 
-                  << " (Request: " << physical_block 
-                  << ", Max: " << disks_layout[target_disk_id].total_blocks << ")" << std::endl;
-        return {};
+    if (physical_block < disks_layout[target_disk_id].total_blocks) {
+        locations.push_back({target_disk_id, physical_block});
+    }
+
+    return locations;
+}
+
+// stepping through the disks avoids a division per block
+bool Raid0::map_range(uint64_t first_id, uint64_t, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const {
+    uint64_t num_disks = disks_layout.size();
+
+    if (num_disks == 0) {
+        return out.empty();
+    }
+
+    uint64_t disk = first_id % num_disks;
+    uint64_t physical_block = first_id / num_disks;
+
+    for (PhysicalLocation &location : out) {
+        if (physical_block >= disks_layout[disk].total_blocks) {
+            return false;
+        }
+        location = {static_cast<uint8_t>(disk), physical_block};
+
+        if (++disk == num_disks) {
+            disk = 0;
+            physical_block++;
+        }
+    }
+    return true;
+}
+
+uint8_t Raid0::get_type() const { return 0; }
+
+uint64_t Raid0::get_capacity(const std::vector<DiskLayout> &disks_layout) const {
+    uint64_t capacity = 0;
+    for (const auto &disk : disks_layout) {
+        capacity += disk.total_blocks;
+    }
+    return capacity;
+}
+
+PhysicalLocations Raid1::map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const {
+    PhysicalLocations locations;
+
+    if (block_id >= get_capacity(disks_layout)) {
+        return locations;
+    }
+
+    for (const auto &disk : disks_layout) {
+        locations.push_back({disk.disk_id, block_id});
+    }
+
+    return locations;
+}
+
+bool Raid1::map_range(uint64_t first_id, uint64_t copy, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const {
+    if (disks_layout.empty() || first_id + out.size() > get_capacity(disks_layout)) {
+        return out.empty();
+    }
+
+    uint8_t disk_id = disks_layout[copy % disks_layout.size()].disk_id;
+
+    for (uint64_t i = 0; i < out.size(); ++i) {
+        out[i] = {disk_id, first_id + i};
+    }
+    return true;
+}
+
+uint64_t Raid1::get_capacity(const std::vector<DiskLayout> &disks_layout) const {
+    if (disks_layout.empty()) {
+        return 0;
     }
 
-    return std::vector<PhysicalLocation> {{ target_disk_id, physical_block }};
+    return std::min_element(disks_layout.begin(), disks_layout.end(), [](const DiskLayout &a, const DiskLayout &b) {
+        return a.total_blocks < b.total_blocks;
+    })->total_blocks;
 }
 
-uint8_t Raid0::get_type() const { return 0; }
\ No newline at end of file
+uint8_t Raid1::get_type() const { return 1; }
+
+ParityRaid::ParityRaid(uint8_t parity_count) : parity_count_(parity_count) {}
+
+uint64_t ParityRaid::parity_disk_index(uint64_t stripe_id, uint64_t num_disks) const {
+    return num_disks - 1 - stripe_id % num_disks;
+}
+
+PhysicalLocations ParityRaid::map_logical_to_physical(uint64_t block_id, const std::vector<DiskLayout> &disks_layout) const {
+    PhysicalLocations locations;
+    uint64_t num_disks = disks_layout.size();
+
+    if (num_disks <= parity_count_ || block_id >= get_capacity(disks_layout)) {
+        return locations;
+    }
+
+    uint64_t stripe_width = get_stripe_width(disks_layout);
+    uint64_t stripe_id = block_id / stripe_width;
+    uint64_t position = block_id % stripe_width;
+
+    uint64_t disk_index = (parity_disk_index(stripe_id, num_disks) + parity_count_ + position) % num_disks;
+
+    locations.push_back({disks_layout[disk_index].disk_id, stripe_id});
+    return locations;
+}
+
+bool ParityRaid::map_range(uint64_t first_id, uint64_t, const std::vector<DiskLayout> &disks_layout, std::span<PhysicalLocation> out) const {
+    uint64_t num_disks = disks_layout.size();
+
+    if (num_disks <= parity_count_ || first_id + out.size() > get_capacity(disks_layout)) {
+        return out.empty();
+    }
+
+    uint64_t stripe_width = get_stripe_width(disks_layout);
+    uint64_t stripe_id = first_id / stripe_width;
+    uint64_t position = first_id % stripe_width;
+    uint64_t first_data_disk = (parity_disk_index(stripe_id, num_disks) + parity_count_) % num_disks;
+
+    for (PhysicalLocation &location : out) {
+        location = {disks_layout[(first_data_disk + position) % num_disks].disk_id, stripe_id};
+
+        if (++position == stripe_width) {
+            position = 0;
+            stripe_id++;
+            first_data_disk = (parity_disk_index(stripe_id, num_disks) + parity_count_) % num_disks;
+        }
+    }
+    return true;
+}
+
+uint64_t ParityRaid::get_capacity(const std::vector<DiskLayout> &disks_layout) const {
+    if (disks_layout.size() <= parity_count_) {
+        return 0;
+    }
+
+    uint64_t rows = std::min_element(disks_layout.begin(), disks_layout.end(), [](const DiskLayout &a, const DiskLayout &b) {
+        return a.total_blocks < b.total_blocks;
+    })->total_blocks;
+
+    return rows * get_stripe_width(disks_layout);
+}
+
+uint8_t ParityRaid::get_type() const { return parity_count_ == 1 ? 5 : 6; }
+
+uint8_t ParityRaid::get_parity_count() const { return parity_count_; }
+
+uint64_t ParityRaid::get_stripe_width(const std::vector<DiskLayout> &disks_layout) const {
+    return disks_layout.size() - parity_count_;
+}
+
+PhysicalLocations ParityRaid::map_parity(uint64_t stripe_id, const std::vector<DiskLayout> &disks_layout) const {
+    PhysicalLocations locations;
+    uint64_t num_disks = disks_layout.size();
+    uint64_t first_parity = parity_disk_index(stripe_id, num_disks);
+
+    for (uint8_t i = 0; i < parity_count_; ++i) {
+        locations.push_back({disks_layout[(first_parity + i) % num_disks].disk_id, stripe_id});
+    }
+
+    return locations;
+}
@@ -0,0 +1,277 @@
+#include <stfs/ram_device.h>
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+RamDevice::RamDevice(uint64_t offset, const RamDeviceOptions &options)
+    : huge_pages_(options.huge_pages), head_offset_(offset)
+{
+    grow(std::max<size_t>(options.initial_size, head_offset_ + DEVICE_HEAD_SIZE));
+}
+
+size_t RamDevice::round_to_page(size_t size) const
+{
+    size_t page_size = huge_pages_ ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+// over-allocates by one alignment step and trims both ends, mmap alone only promises page alignment
+static void *map_arena(size_t size, size_t alignment)
+{
+    if (alignment == 0)
+    {
+        return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+
+    size_t reserved = size + alignment;
+    void *mapping = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        return mapping;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+    uintptr_t aligned = (start + alignment - 1) / alignment * alignment;
+
+    if (aligned > start)
+    {
+        munmap(mapping, aligned - start);
+    }
+    if (start + reserved > aligned + size)
+    {
+        munmap(reinterpret_cast<void *>(aligned + size), start + reserved - aligned - size);
+    }
+
+    return reinterpret_cast<void *>(aligned);
+}
+
+void RamDevice::grow(size_t size)
+{
+    if (size <= arena_size_)
+    {
+        return;
+    }
+
+    // grow geometrically, the arena stays one contiguous mapping
+    size_t new_size = round_to_page(std::max(size, arena_size_ * 2));
+    size_t alignment = huge_pages_ ? HUGE_PAGE_SIZE : 0;
+    void *arena;
+
+#ifdef __linux__
+    if (arena_ && alignment == 0)
+    {
+        arena = mremap(arena_, arena_size_, new_size, MREMAP_MAYMOVE);
+    }
+    else if (arena_)
+    {
+        // the pages move into an aligned reservation, nothing is copied
+        arena = map_arena(new_size, alignment);
+        if (arena != MAP_FAILED)
+        {
+            void *target = arena;
+            arena = mremap(arena_, arena_size_, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+            if (arena == MAP_FAILED)
+            {
+                munmap(target, new_size);
+            }
+        }
+    }
+    else
+    {
+        arena = map_arena(new_size, alignment);
+    }
+#else
+    arena = map_arena(new_size, alignment);
+    if (arena != MAP_FAILED && arena_)
+    {
+        std::memcpy(arena, arena_, used_size_);
+        munmap(arena_, arena_size_);
+    }
+#endif
+
+    if (arena == MAP_FAILED)
+    {
+        throw DeviceError("Failed to allocate device memory.");
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages_)
+    {
+        madvise(arena, new_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    arena_ = static_cast<char *>(arena);
+    arena_size_ = new_size;
+}
+
+void RamDevice::read_head()
+{
+    auto head_data = read(head_offset_, DEVICE_HEAD_SIZE);
+
+    head_.deserialize(head_data.get());
+}
+
+void RamDevice::write_head()
+{
+    auto serialized_data = head_.serialize();
+    write(head_offset_, serialized_data.data(), DEVICE_HEAD_SIZE);
+}
+
+std::unique_ptr<Device> RamDevice::format(
+    uint64_t head_offset,
+    uint64_t total_blocks_on_disk,
+    uint8_t disk_id,
+    const RamDeviceOptions &options)
+{
+    auto device = std::unique_ptr<RamDevice>(new RamDevice(head_offset, options));
+
+    DeviceHead head{
+        .total_blocks_on_disk = total_blocks_on_disk,
+        .disk_id = disk_id};
+    device->head_ = head;
+    device->write_head();
+
+    return device;
+}
+
+std::unique_ptr<Device> RamDevice::load(const std::string &snapshot_filename, uint64_t head_offset, const RamDeviceOptions &options)
+{
+    std::ifstream file(snapshot_filename, std::ios::binary | std::ios::ate);
+
+    if (!file.is_open())
+    {
+        throw DeviceError("Failed to open device snapshot: " + snapshot_filename);
+    }
+
+    size_t size = file.tellg();
+    file.seekg(0);
+
+    RamDeviceOptions load_options = options;
+    load_options.initial_size = std::max(options.initial_size, size);
+
+    auto device = std::unique_ptr<RamDevice>(new RamDevice(head_offset, load_options));
+
+    if (!file.read(device->arena_, size))
+    {
+        throw DeviceError("An error occurred while reading device snapshot: " + snapshot_filename);
+    }
+    device->used_size_ = size;
+
+    device->read_head();
+    return device;
+}
+
+const DeviceHead &RamDevice::get_head() const
+{
+    return head_;
+}
+
+void RamDevice::read_into(size_t position, std::span<char> buffer)
+{
+    std::shared_lock lock(arena_mutex_);
+
+    if (position + buffer.size() > used_size_)
+    {
+        throw DeviceError("Unexpected end of file reached.");
+    }
+
+    std::memcpy(buffer.data(), arena_ + position, buffer.size());
+}
+
+void RamDevice::write(size_t position, const char *data, size_t size)
+{
+    std::lock_guard lock(arena_mutex_);
+
+    grow(position + size);
+
+    std::memcpy(arena_ + position, data, size);
+    used_size_ = std::max(used_size_, position + size);
+}
+
+void RamDevice::sync()
+{
+}
+
+void RamDevice::snapshot(const std::string &snapshot_filename) const
+{
+    std::string temporary_filename = snapshot_filename + ".tmp";
+
+    {
+        std::shared_lock lock(arena_mutex_);
+
+        int fd = ::open(temporary_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            throw DeviceError("Failed to create device snapshot: " + temporary_filename);
+        }
+
+        size_t done = 0;
+        while (done < used_size_)
+        {
+            ssize_t result = ::write(fd, arena_ + done, used_size_ - done);
+
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                break;
+            }
+            done += result;
+        }
+
+        // the data has to be durable before the rename makes it the snapshot
+        bool written = done == used_size_ && ::fsync(fd) == 0;
+        ::close(fd);
+
+        if (!written)
+        {
+            throw DeviceError("An error occurred while writing device snapshot: " + temporary_filename);
+        }
+    }
+
+    if (std::rename(temporary_filename.c_str(), snapshot_filename.c_str()) != 0)
+    {
+        throw DeviceError("Failed to replace device snapshot: " + snapshot_filename);
+    }
+
+    // and the rename itself lives in the directory entry
+    std::string directory = std::filesystem::path(snapshot_filename).parent_path().string();
+    int directory_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory_fd < 0)
+    {
+        throw DeviceError("Failed to open the directory of device snapshot: " + snapshot_filename);
+    }
+
+    bool synced = ::fsync(directory_fd) == 0;
+    ::close(directory_fd);
+
+    if (!synced)
+    {
+        throw DeviceError("Failed to sync the directory of device snapshot: " + snapshot_filename);
+    }
+}
+
+RamDevice::~RamDevice()
+{
+    if (arena_)
+    {
+        munmap(arena_, arena_size_);
+    }
+}
+
+#endif
@@ -0,0 +1,256 @@
+#include <limits>
+#include <stfs/record_block.h>
+#include <stfs/serelization.h>
+#include <stfs/storage_cluster.h>
+
+#define MIN_FRAGMENT_SIZE 2 // one encoded byte may cost a token and the byte
+
+RecordBlockBuilder::RecordBlockBuilder(uint64_t payload_size, PayloadCodec codec)
+    : payload_size_(payload_size),
+      codec_(codec),
+      encoder_(make_block_encoder(codec))
+{
+    if (payload_size < RECORD_BLOCK_HEADER_SIZE + RECORD_ENTRY_SIZE + MIN_FRAGMENT_SIZE || payload_size > std::numeric_limits<uint32_t>::max())
+    {
+        throw ClusterError("Block payload size " + std::to_string(payload_size) + " cannot hold packed records");
+    }
+}
+
+uint64_t RecordBlockBuilder::used() const
+{
+    return RECORD_BLOCK_HEADER_SIZE + directory_.size() + encoder_->output().size();
+}
+
+bool RecordBlockBuilder::empty() const
+{
+    return count_ == 0;
+}
+
+bool RecordBlockBuilder::full() const
+{
+    return payload_size_ - used() < RECORD_ENTRY_SIZE + MIN_FRAGMENT_SIZE;
+}
+
+std::optional<size_t> RecordBlockBuilder::add(uint64_t timestamp, std::span<const char> data, bool continues)
+{
+    if (payload_size_ - used() < RECORD_ENTRY_SIZE)
+    {
+        return std::nullopt;
+    }
+
+    uint64_t offset = encoder_->raw().size();
+    size_t size = encoder_->append(data, payload_size_ - RECORD_BLOCK_HEADER_SIZE - directory_.size() - RECORD_ENTRY_SIZE);
+
+    if (size == 0 && !data.empty())
+    {
+        return std::nullopt;
+    }
+
+    if (encoder_->raw().size() > std::numeric_limits<uint32_t>::max())
+    {
+        throw ClusterError("Packed block data exceeds 4 GiB");
+    }
+
+    bool last = size == data.size();
+    FragmentKind kind = continues ? (last ? FragmentKind::Last : FragmentKind::Middle)
+                                  : (last ? FragmentKind::Whole : FragmentKind::First);
+
+    directory_.resize(directory_.size() + RECORD_ENTRY_SIZE);
+
+    char *ptr = directory_.data() + directory_.size() - RECORD_ENTRY_SIZE;
+    uint32_t data_offset = offset;
+    uint8_t kind_byte = static_cast<uint8_t>(kind);
+
+    SERIALIZE_FIELD(ptr, timestamp, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, data_offset, uint32_t, serializeU32);
+    std::memcpy(ptr, &kind_byte, sizeof(kind_byte));
+
+    if (count_ == 0 || !continues)
+    {
+        stamp_ = timestamp;
+    }
+    count_++;
+
+    return size;
+}
+
+Block RecordBlockBuilder::seal()
+{
+    std::vector<char> payload(payload_size_, 0);
+
+    // data the codec could not shrink is stored as is
+    PayloadCodec codec = codec_;
+    std::span<const char> stored = encoder_->output();
+
+    if (encoder_->raw().size() <= stored.size())
+    {
+        codec = PayloadCodec::None;
+        stored = encoder_->raw();
+    }
+
+    char *ptr = payload.data();
+    uint8_t codec_byte = static_cast<uint8_t>(codec);
+    uint32_t data_size = encoder_->raw().size();
+    uint32_t stored_size = stored.size();
+
+    SERIALIZE_FIELD(ptr, count_, uint32_t, serializeU32);
+    std::memcpy(ptr, &codec_byte, sizeof(codec_byte));
+    ptr += sizeof(codec_byte);
+    SERIALIZE_FIELD(ptr, data_size, uint32_t, serializeU32);
+    SERIALIZE_FIELD(ptr, stored_size, uint32_t, serializeU32);
+
+    std::memcpy(ptr, directory_.data(), directory_.size());
+    ptr += directory_.size();
+    std::memcpy(ptr, stored.data(), stored.size());
+
+    Block block = {stamp_, payload_size_, std::move(payload), 0};
+    block.update_crc();
+
+    encoder_->reset();
+    directory_.clear();
+    count_ = 0;
+    stamp_ = 0;
+
+    return block;
+}
+
+RecordBlockView::RecordBlockView(std::span<const char> payload) : payload_(payload)
+{
+    decode();
+}
+
+const char *RecordBlockView::entry(uint32_t index) const
+{
+    return payload_.data() + RECORD_BLOCK_HEADER_SIZE + static_cast<uint64_t>(index) * RECORD_ENTRY_SIZE;
+}
+
+uint32_t RecordBlockView::data_offset(uint32_t index) const
+{
+    uint32_t offset;
+    const char *ptr = entry(index) + sizeof(uint64_t);
+    DESERIALIZE_FIELD(ptr, offset, uint32_t, deserializeU32);
+    return offset;
+}
+
+// the payload passed its CRC before it gets here, a malformed one is not a packed block
+void RecordBlockView::decode()
+{
+    if (payload_.size() < RECORD_BLOCK_HEADER_SIZE)
+    {
+        return;
+    }
+
+    const char *ptr = payload_.data();
+    uint8_t codec;
+    uint32_t data_size;
+    uint32_t stored_size;
+
+    DESERIALIZE_FIELD(ptr, count_, uint32_t, deserializeU32);
+    std::memcpy(&codec, ptr, sizeof(codec));
+    ptr += sizeof(codec);
+    DESERIALIZE_FIELD(ptr, data_size, uint32_t, deserializeU32);
+    DESERIALIZE_FIELD(ptr, stored_size, uint32_t, deserializeU32);
+
+    uint64_t directory_end = RECORD_BLOCK_HEADER_SIZE + static_cast<uint64_t>(count_) * RECORD_ENTRY_SIZE;
+
+    if (directory_end + stored_size > payload_.size() || codec > static_cast<uint8_t>(PayloadCodec::Lz))
+    {
+        return;
+    }
+
+    std::span<const char> stored = payload_.subspan(directory_end, stored_size);
+
+    if (static_cast<PayloadCodec>(codec) == PayloadCodec::None)
+    {
+        if (stored_size != data_size)
+        {
+            return;
+        }
+        data_ = stored;
+    }
+    else
+    {
+        decoded_.resize(data_size);
+
+        if (!decode_block(static_cast<PayloadCodec>(codec), stored, decoded_))
+        {
+            return;
+        }
+        data_ = decoded_;
+    }
+
+    uint64_t previous_offset = 0;
+    uint64_t previous_timestamp = 0;
+
+    for (uint32_t i = 0; i < count_; ++i)
+    {
+        const char *field = entry(i);
+        uint64_t timestamp;
+        uint32_t offset;
+
+        DESERIALIZE_FIELD(field, timestamp, uint64_t, deserializeU64);
+        DESERIALIZE_FIELD(field, offset, uint32_t, deserializeU32);
+
+        if (offset < previous_offset || offset > data_.size() || timestamp < previous_timestamp ||
+            static_cast<uint8_t>(*field) > static_cast<uint8_t>(FragmentKind::Last))
+        {
+            return;
+        }
+
+        previous_offset = offset;
+        previous_timestamp = timestamp;
+    }
+
+    well_formed_ = true;
+}
+
+bool RecordBlockView::is_well_formed() const
+{
+    return well_formed_;
+}
+
+uint32_t RecordBlockView::size() const
+{
+    return well_formed_ ? count_ : 0;
+}
+
+RecordFragment RecordBlockView::fragment(uint32_t index) const
+{
+    const char *ptr = entry(index);
+    uint64_t timestamp;
+
+    DESERIALIZE_FIELD(ptr, timestamp, uint64_t, deserializeU64);
+    ptr += sizeof(uint32_t);
+    FragmentKind kind = static_cast<FragmentKind>(*ptr);
+
+    uint32_t begin = data_offset(index);
+    uint32_t end = index + 1 < count_ ? data_offset(index + 1) : data_.size();
+
+    return {.timestamp = timestamp, .kind = kind, .data = data_.subspan(begin, end - begin)};
+}
+
+uint32_t RecordBlockView::lower_bound(uint64_t timestamp) const
+{
+    uint32_t left = 0;
+    uint32_t right = size();
+
+    while (left < right)
+    {
+        uint32_t mid = left + (right - left) / 2;
+
+        uint64_t found_timestamp;
+        const char *ptr = entry(mid);
+        DESERIALIZE_FIELD(ptr, found_timestamp, uint64_t, deserializeU64);
+
+        if (found_timestamp < timestamp)
+        {
+            left = mid + 1;
+        }
+        else
+        {
+            right = mid;
+        }
+    }
+
+    return left;
+}
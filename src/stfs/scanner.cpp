@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <stfs/scanner.h>
+
+BlockScanner::BlockScanner(
+    StorageCluster &cluster,
+    RingBufferState state,
+    uint64_t begin,
+    uint64_t end,
+    ScanDirection direction,
+    DataValidator validator)
+    : cluster_(cluster),
+      state_(state),
+      begin_(begin),
+      end_(std::max(begin, end)),
+      direction_(direction),
+      validator_(std::move(validator))
+{
+}
+
+void BlockScanner::read_logical_range(uint64_t first_logical_id, uint64_t count)
+{
+    uint64_t total_block_size = cluster_.get_total_block_size();
+
+    while (count > 0)
+    {
+        uint64_t first_id = (state_.head_id + first_logical_id) % state_.capacity;
+        uint64_t run = std::min(count, state_.capacity - first_id);
+
+        batch_buffer_.resize(run * total_block_size);
+        cluster_.read_blocks(first_id, run, validator_, batch_buffer_);
+
+        for (uint64_t i = 0; i < run; ++i)
+        {
+            Block block = BlockView(batch_buffer_.data() + i * total_block_size, total_block_size).to_block();
+
+            if (direction_ == ScanDirection::Forward)
+            {
+                buffered_.push_back(std::move(block));
+            }
+            else
+            {
+                buffered_.push_front(std::move(block));
+            }
+        }
+
+        first_logical_id += run;
+        count -= run;
+    }
+}
+
+void BlockScanner::fill()
+{
+    uint64_t count = std::min<uint64_t>(batch_blocks_, end_ - begin_);
+    batch_blocks_ = std::min<uint64_t>(batch_blocks_ * 2, SCAN_BATCH_BLOCKS);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (direction_ == ScanDirection::Forward)
+    {
+        read_logical_range(begin_, count);
+        begin_ += count;
+    }
+    else
+    {
+        read_logical_range(end_ - count, count);
+        end_ -= count;
+    }
+}
+
+std::optional<Block> BlockScanner::next()
+{
+    if (buffered_.empty())
+    {
+        fill();
+    }
+
+    if (buffered_.empty())
+    {
+        return std::nullopt;
+    }
+
+    Block block = std::move(buffered_.front());
+    buffered_.pop_front();
+
+    return block;
+}
+
+uint64_t BlockScanner::remaining() const
+{
+    return buffered_.size() + (end_ - begin_);
+}
+
+RecordScanner::RecordScanner(BlockScanner blocks, uint64_t from, uint64_t to)
+    : blocks_(std::move(blocks)),
+      from_(from),
+      to_(to)
+{
+}
+
+std::optional<RecordFragment> RecordScanner::next_fragment()
+{
+    while (!view_ || next_fragment_ == view_->size())
+    {
+        view_.reset();
+        block_ = blocks_.next();
+        next_fragment_ = 0;
+
+        if (!block_)
+        {
+            return std::nullopt;
+        }
+
+        view_.emplace(block_->payload);
+
+        if (!view_->is_well_formed())
+        {
+            throw ClusterError("Block stamped " + std::to_string(block_->timestamp) + " does not hold packed records");
+        }
+
+        // records of the first block stamped before the range are skipped through the directory
+        if (first_block_)
+        {
+            next_fragment_ = view_->lower_bound(from_);
+            first_block_ = false;
+        }
+    }
+
+    return view_->fragment(next_fragment_++);
+}
+
+std::optional<Record> RecordScanner::next()
+{
+    std::optional<Record> partial;
+
+    while (!done_)
+    {
+        std::optional<RecordFragment> fragment = next_fragment();
+
+        if (!fragment)
+        {
+            done_ = true;
+            break;
+        }
+
+        if (fragment->kind == FragmentKind::Whole || fragment->kind == FragmentKind::First)
+        {
+            if (fragment->timestamp > to_)
+            {
+                done_ = true;
+                break;
+            }
+
+            partial = Record{fragment->timestamp, std::vector<char>(fragment->data.begin(), fragment->data.end())};
+        }
+        else if (partial && partial->timestamp == fragment->timestamp)
+        {
+            partial->data.insert(partial->data.end(), fragment->data.begin(), fragment->data.end());
+        }
+        else
+        {
+            partial.reset();
+            continue;
+        }
+
+        if (fragment->kind == FragmentKind::Whole || fragment->kind == FragmentKind::Last)
+        {
+            if (partial->timestamp >= from_)
+            {
+                return partial;
+            }
+            partial.reset();
+        }
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <stfs/block.h>
+#include <stfs/scrubber.h>
+
+static bool is_valid_block_data(const char *data, size_t size)
+{
+    return BlockView(data, size).is_valid();
+}
+
+Scrubber::Scrubber(StorageCluster &cluster, const ScrubberOptions &options)
+    : Scrubber(cluster, is_valid_block_data, options)
+{
+}
+
+Scrubber::Scrubber(StorageCluster &cluster, DataValidator validator, const ScrubberOptions &options)
+    : cluster_(cluster),
+      validator_(std::move(validator)),
+      options_(options)
+{
+}
+
+Scrubber::~Scrubber()
+{
+    stop();
+}
+
+void Scrubber::start()
+{
+    if (thread_.joinable())
+    {
+        return;
+    }
+
+    stopping_ = false;
+    budget_time_ = std::chrono::steady_clock::now();
+    seen_foreground_requests_ = cluster_.get_foreground_request_count();
+    thread_ = std::thread(&Scrubber::run, this);
+}
+
+void Scrubber::stop()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void Scrubber::scrub_pass()
+{
+    if (thread_.joinable())
+    {
+        throw ClusterError("Scrubber is already running in the background");
+    }
+
+    stopping_ = false;
+    in_pass_ = false;
+    budget_time_ = std::chrono::steady_clock::now();
+
+    while (scrub_next())
+    {
+    }
+}
+
+ScrubberStats Scrubber::get_stats() const
+{
+    return {
+        .passes_completed = passes_completed_.load(),
+        .blocks_scrubbed = blocks_scrubbed_.load(),
+        .bytes_read = bytes_read_.load(),
+        .replicas_repaired = replicas_repaired_.load(),
+        .parity_rebuilds = parity_rebuilds_.load(),
+        .unrecoverable_blocks = unrecoverable_blocks_.load(),
+        .pass_blocks_done = pass_blocks_done_.load(),
+        .pass_blocks_total = pass_blocks_total_.load()};
+}
+
+void Scrubber::run()
+{
+    while (true)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (options_.foreground_backoff.count() > 0)
+        {
+            uint64_t requests = cluster_.get_foreground_request_count();
+
+            if (requests != seen_foreground_requests_)
+            {
+                seen_foreground_requests_ = requests;
+
+                if (!wait_until(now + options_.foreground_backoff))
+                {
+                    return;
+                }
+                continue;
+            }
+        }
+
+        bool has_more;
+        try
+        {
+            has_more = scrub_next();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warning: scrubber failed: " << e.what() << std::endl;
+            has_more = false;
+        }
+
+        if (!has_more && !wait_until(now + options_.pass_interval))
+        {
+            return;
+        }
+    }
+}
+
+bool Scrubber::wait_until(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock lock(mutex_);
+    return !wakeup_.wait_until(lock, deadline, [this]
+                               { return stopping_; });
+}
+
+bool Scrubber::throttle(uint64_t bytes)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (options_.bytes_per_second == 0)
+    {
+        return wait_until(now);
+    }
+
+    // unused budget is kept for one second at most, an idle scrubber does not come back with a burst
+    budget_time_ = std::max(budget_time_, now - std::chrono::seconds(1));
+    budget_time_ += std::chrono::nanoseconds(bytes * 1000000000 / options_.bytes_per_second);
+
+    return wait_until(budget_time_);
+}
+
+bool Scrubber::scrub_next()
+{
+    ClusterState state = cluster_.get_state();
+    uint64_t capacity = cluster_.get_head().total_blocks;
+    uint64_t first_sequence = state.total_writes_count - state.valid_block_count;
+
+    if (!in_pass_)
+    {
+        if (state.valid_block_count == 0)
+        {
+            return false;
+        }
+
+        in_pass_ = true;
+        cursor_ = pass_begin_ = first_sequence;
+        pass_end_ = state.total_writes_count;
+        pass_blocks_done_ = 0;
+        pass_blocks_total_ = pass_end_ - pass_begin_;
+    }
+
+    // blocks overwritten since the pass started are gone, a journal recovery may also have rolled the tail back
+    cursor_ = std::max(cursor_, first_sequence);
+
+    if (cursor_ >= std::min(pass_end_, state.total_writes_count))
+    {
+        in_pass_ = false;
+        passes_completed_++;
+        return false;
+    }
+
+    uint64_t id = (state.head_logical_block_id + (cursor_ - first_sequence)) % capacity;
+    cursor_++;
+    pass_blocks_done_ = cursor_ - pass_begin_;
+
+    ScrubReport report = cluster_.scrub_block(id, validator_);
+
+    blocks_scrubbed_++;
+    bytes_read_ += report.bytes_read;
+    replicas_repaired_ += report.replicas_repaired;
+    parity_rebuilds_ += report.rebuilt_from_parity;
+    unrecoverable_blocks_ += report.unrecoverable;
+
+    return throttle(report.bytes_read);
+}
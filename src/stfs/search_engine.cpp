@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stfs/search_engine.h>
 
 uint64_t SearchEngine::logical_to_real_index(uint64_t logical_id, RingBufferState state) {
@@ -5,8 +6,16 @@ uint64_t SearchEngine::logical_to_real_index(uint64_t logical_id, RingBufferStat
 }
 
 uint64_t SearchEngine::find_block_id_by_timestamp(uint64_t timestamp,  TimeStampFetcher& fetcher, RingBufferState state) {
-    uint64_t left = 0;
-    uint64_t right = state.count;
+    return find_block_id_by_timestamp(timestamp, fetcher, state, {.left = 0, .right = state.count});
+}
+
+uint64_t SearchEngine::find_block_id_by_timestamp(uint64_t timestamp,  TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window, SearchStrategy strategy) {
+    if (strategy != SearchStrategy::Binary) {
+        return logical_to_real_index(find_first_logical_id(timestamp, fetcher, state, window, strategy), state);
+    }
+
+    uint64_t left = window.left;
+    uint64_t right = window.right;
     while (left < right) {
         uint64_t mid = left + (right - left) / 2;
         uint64_t real_id = logical_to_real_index(mid, state);
@@ -22,3 +31,117 @@ uint64_t SearchEngine::find_block_id_by_timestamp(uint64_t timestamp,  TimeStamp
     }
     return logical_to_real_index(left, state);
 }
+
+uint64_t SearchEngine::find_first_logical_id(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window, SearchStrategy strategy) {
+    switch (strategy) {
+    case SearchStrategy::Interpolation:
+        return interpolation_lower_bound(timestamp, fetcher, state, window);
+    case SearchStrategy::Galloping:
+        return galloping_lower_bound(timestamp, fetcher, state, window);
+    default:
+        return binary_lower_bound(timestamp, fetcher, state, window);
+    }
+}
+
+uint64_t SearchEngine::binary_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window) {
+    uint64_t left = window.left;
+    uint64_t right = window.right;
+    while (left < right) {
+        uint64_t mid = left + (right - left) / 2;
+        if (fetcher(logical_to_real_index(mid, state)) < timestamp) {
+            left = mid + 1;
+        } else {
+            right = mid;
+        }
+    }
+    return left;
+}
+
+// The answer stays in [left, right]: the block before left is older than timestamp, the one at right is not.
+// Once both ends are probed every guess is followed by a probe of its neighbour on the side of the answer,
+// so evenly spaced timestamps settle in about four probes. A round that does not cut the window to a
+// quarter costs more than two halvings would, the rest of the search is then binary.
+uint64_t SearchEngine::interpolation_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window) {
+    uint64_t left = window.left;
+    uint64_t right = window.right;
+
+    if (left == right) {
+        return left;
+    }
+
+    uint64_t high_timestamp = fetcher(logical_to_real_index(right - 1, state));
+    if (high_timestamp < timestamp) {
+        return right;
+    }
+    right--;
+
+    if (left == right) {
+        return left;
+    }
+
+    uint64_t low_timestamp = fetcher(logical_to_real_index(left, state));
+    if (low_timestamp >= timestamp) {
+        return left;
+    }
+    left++;
+
+    while (left < right) {
+        uint64_t size = right - left;
+
+        // low_timestamp < timestamp <= high_timestamp, so the guess falls in (left - 1, right]
+        uint64_t low_position = left - 1;
+        unsigned __int128 span = static_cast<unsigned __int128>(timestamp - low_timestamp) * (right - low_position);
+        uint64_t guess = low_position + static_cast<uint64_t>(span / (high_timestamp - low_timestamp));
+        guess = std::clamp(guess, left, right - 1);
+
+        uint64_t found_timestamp = fetcher(logical_to_real_index(guess, state));
+        if (found_timestamp < timestamp) {
+            left = guess + 1;
+            low_timestamp = found_timestamp;
+
+            if (left < right) {
+                found_timestamp = fetcher(logical_to_real_index(left, state));
+                if (found_timestamp >= timestamp) {
+                    return left;
+                }
+                left++;
+                low_timestamp = found_timestamp;
+            }
+        } else {
+            right = guess;
+            high_timestamp = found_timestamp;
+
+            if (left < right) {
+                found_timestamp = fetcher(logical_to_real_index(right - 1, state));
+                if (found_timestamp < timestamp) {
+                    return right;
+                }
+                right--;
+                high_timestamp = found_timestamp;
+            }
+        }
+
+        if ((right - left) * 4 > size) {
+            return binary_lower_bound(timestamp, fetcher, state, {.left = left, .right = right});
+        }
+    }
+    return left;
+}
+
+// probes the newest block, then ones 2, 4, 8... back until one is older than timestamp, and bisects the last stride
+uint64_t SearchEngine::galloping_lower_bound(uint64_t timestamp, TimeStampFetcher& fetcher, RingBufferState state, SearchWindow window) {
+    uint64_t left = window.left;
+    uint64_t right = window.right;
+    uint64_t stride = 1;
+
+    while (left < right) {
+        uint64_t probe = right - std::min(stride, right - left);
+        if (fetcher(logical_to_real_index(probe, state)) < timestamp) {
+            left = probe + 1;
+            break;
+        }
+        right = probe;
+        stride *= 2;
+    }
+    return binary_lower_bound(timestamp, fetcher, state, {.left = left, .right = right});
+}
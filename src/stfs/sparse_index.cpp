@@ -0,0 +1,113 @@
+#include <bit>
+#include <stfs/sparse_index.h>
+
+SparseIndex::SparseIndex(uint64_t stride) : stride_(stride) {}
+
+uint64_t SparseIndex::get_stride() const
+{
+    return stride_;
+}
+
+size_t SparseIndex::size() const
+{
+    return samples_.size();
+}
+
+bool SparseIndex::should_sample(uint64_t sequence) const
+{
+    return sequence % stride_ == 0;
+}
+
+void SparseIndex::append(uint64_t sequence, uint64_t timestamp)
+{
+    samples_.push_back({.timestamp = timestamp, .sequence = sequence});
+    layout_dirty_ = true;
+}
+
+void SparseIndex::evict_before(uint64_t sequence)
+{
+    while (!samples_.empty() && samples_.front().sequence < sequence)
+    {
+        samples_.pop_front();
+        layout_dirty_ = true;
+    }
+}
+
+void SparseIndex::truncate_from(uint64_t sequence)
+{
+    while (!samples_.empty() && samples_.back().sequence >= sequence)
+    {
+        samples_.pop_back();
+        layout_dirty_ = true;
+    }
+}
+
+void SparseIndex::rebuild_layout()
+{
+    layout_.resize(samples_.size() + 1);
+
+    // in-order walk of the implicit tree hands out ranks in sorted order
+    uint64_t rank = 0;
+    uint64_t k = 1;
+    std::vector<uint64_t> stack;
+
+    while (k < layout_.size() || !stack.empty())
+    {
+        if (k < layout_.size())
+        {
+            stack.push_back(k);
+            k = 2 * k;
+            continue;
+        }
+
+        k = stack.back();
+        stack.pop_back();
+
+        layout_[k] = {.timestamp = samples_[rank].timestamp, .rank = rank};
+        rank++;
+
+        k = 2 * k + 1;
+    }
+
+    layout_dirty_ = false;
+}
+
+bool SparseIndex::has_stale_layout() const
+{
+    return layout_dirty_;
+}
+
+SearchWindow SparseIndex::narrow(uint64_t timestamp, RingBufferState state, uint64_t first_sequence)
+{
+    if (samples_.empty())
+    {
+        return {.left = 0, .right = state.count};
+    }
+
+    if (layout_dirty_)
+    {
+        rebuild_layout();
+    }
+
+    uint64_t n = samples_.size();
+    uint64_t k = 1;
+
+    while (k <= n)
+    {
+        k = 2 * k + (layout_[k].timestamp < timestamp);
+    }
+    k >>= std::countr_one(k) + 1;
+
+    if (k == 0)
+    {
+        return {
+            .left = samples_.back().sequence + 1 - first_sequence,
+            .right = state.count};
+    }
+
+    uint64_t rank = layout_[k].rank;
+
+    return {
+        .left = rank == 0 ? 0 : samples_[rank - 1].sequence + 1 - first_sequence,
+        .right = samples_[rank].sequence + 1 - first_sequence};
+}
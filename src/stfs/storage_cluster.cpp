@@ -5,13 +5,70 @@
 #include <stfs/const.h>
 #include <stfs/crypto.h>
 #include <stfs/storage_cluster.h>
+#include <stfs/parity.h>
+
+#define FORMAT_CLEAR_CHUNK (1 << 20)
+
+// submission failures surface through the future, so requests queued before them are still awaited
+template <typename Submit>
+static std::future<void> queue_request(Submit submit)
+{
+    try
+    {
+        return submit();
+    }
+    catch (...)
+    {
+        std::promise<void> failed;
+        failed.set_exception(std::current_exception());
+        return failed.get_future();
+    }
+}
+
+// every request is awaited before the first failure is rethrown, so no buffer is released while in flight;
+// on_done sees each request as it is found complete
+static void wait_all(std::vector<std::future<void>> &pending, const std::function<void(size_t index, bool failed)> &on_done = {})
+{
+    std::exception_ptr error;
+
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        bool failed = false;
+        try
+        {
+            pending[i].get();
+        }
+        catch (...)
+        {
+            failed = true;
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+
+        if (on_done)
+        {
+            on_done(i, failed);
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
 
 std::vector<char> ClusterHead::serialize() const
 {
-    std::vector<char> buffer;
-    buffer.resize(CLUSTER_HEAD_SIZE);
+    std::vector<char> buffer(CLUSTER_HEAD_SIZE);
+    serialize_into(buffer.data());
+    return buffer;
+}
 
-    char *ptr = buffer.data();
+void ClusterHead::serialize_into(char *buffer) const
+{
+    char *ptr = buffer;
 
     std::memcpy(ptr, magic.data(), magic.size());
     ptr += magic.size();
@@ -29,14 +86,13 @@ std::vector<char> ClusterHead::serialize() const
     SERIALIZE_FIELD(ptr, cluster_state_offset, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, journal_offset, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, data_offset, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, index_offset, uint64_t, serializeU64);
 
-    SERIALIZE_FIELD(ptr, reserve1, uint64_t, serializeU64);
-    SERIALIZE_FIELD(ptr, reserve2, uint64_t, serializeU64);
-    SERIALIZE_FIELD(ptr, reserve3, uint64_t, serializeU64);
-    SERIALIZE_FIELD(ptr, reserve4, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, payload_format, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, payload_codec, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, journal_slots, uint64_t, serializeU64);
 
     SERIALIZE_FIELD(ptr, crc32, uint32_t, serializeU32);
-    return buffer;
 }
 
 size_t ClusterHead::deserialize(const char *buffer)
@@ -59,11 +115,11 @@ size_t ClusterHead::deserialize(const char *buffer)
     DESERIALIZE_FIELD(buffer, cluster_state_offset, uint64_t, deserializeU64);
     DESERIALIZE_FIELD(buffer, journal_offset, uint64_t, deserializeU64);
     DESERIALIZE_FIELD(buffer, data_offset, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, index_offset, uint64_t, deserializeU64);
 
-    DESERIALIZE_FIELD(buffer, reserve1, uint64_t, deserializeU64);
-    DESERIALIZE_FIELD(buffer, reserve2, uint64_t, deserializeU64);
-    DESERIALIZE_FIELD(buffer, reserve3, uint64_t, deserializeU64);
-    DESERIALIZE_FIELD(buffer, reserve4, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, payload_format, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, payload_codec, uint64_t, deserializeU64);
+    DESERIALIZE_FIELD(buffer, journal_slots, uint64_t, deserializeU64);
     DESERIALIZE_FIELD(buffer, crc32, uint32_t, deserializeU32);
 
     return buffer - start;
@@ -71,40 +127,36 @@ size_t ClusterHead::deserialize(const char *buffer)
 
 void ClusterHead::update_crc()
 {
-    this->crc32 = 0;
-    auto serialized_data = serialize();
-    this->crc32 = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
+    std::array<char, CLUSTER_HEAD_SIZE> serialized_data;
+    serialize_into(serialized_data.data());
+
+    this->crc32 = generate_record_CRC32(serialized_data.data(), serialized_data.size());
 }
 
 bool ClusterHead::is_valid() const
 {
-    ClusterHead self_copy = *this;
-    self_copy.crc32 = 0;
-    auto serialized_data = self_copy.serialize();
+    std::array<char, CLUSTER_HEAD_SIZE> serialized_data;
+    serialize_into(serialized_data.data());
 
-    uint32_t calculated_crc = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
-
-    return calculated_crc == this->crc32;
+    return generate_record_CRC32(serialized_data.data(), serialized_data.size()) == this->crc32;
 }
 
 std::vector<char> ClusterState::serialize() const
 {
-    std::vector<char> buffer;
-    buffer.resize(CLUSTER_STATE_SIZE);
+    std::vector<char> buffer(CLUSTER_STATE_SIZE);
+    serialize_into(buffer.data());
+    return buffer;
+}
 
-    char *ptr = buffer.data();
+void ClusterState::serialize_into(char *buffer) const
+{
+    char *ptr = buffer;
 
     SERIALIZE_FIELD(ptr, head_logical_block_id, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, tail_logical_block_id, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, valid_block_count, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, total_writes_count, uint64_t, serializeU64);
     SERIALIZE_FIELD(ptr, crc32, uint32_t, serializeU32);
-
-    return buffer;
 }
 
 size_t ClusterState::deserialize(const char *buffer)
@@ -122,101 +174,209 @@ size_t ClusterState::deserialize(const char *buffer)
 
 void ClusterState::update_crc()
 {
-    this->crc32 = 0;
-    auto serialized_data = serialize();
-    this->crc32 = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
+    std::array<char, CLUSTER_STATE_SIZE> serialized_data;
+    serialize_into(serialized_data.data());
+
+    this->crc32 = generate_record_CRC32(serialized_data.data(), serialized_data.size());
 }
 
 bool ClusterState::is_valid() const
 {
-    ClusterState self_copy = *this;
-    self_copy.crc32 = 0;
+    std::array<char, CLUSTER_STATE_SIZE> serialized_data;
+    serialize_into(serialized_data.data());
 
-    auto serialized_data = self_copy.serialize();
+    return generate_record_CRC32(serialized_data.data(), serialized_data.size()) == this->crc32;
+}
 
-    uint32_t calculated_crc = generate_CRC32(
-        reinterpret_cast<const uint8_t *>(serialized_data.data()),
-        serialized_data.size());
+size_t StorageCluster::read_and_verify_mirrored_data(
+    std::span<const PhysicalAddress> addresses,
+    std::span<char> out,
+    const DataValidator &is_valid)
+{
+    std::vector<PhysicalAddress> stale;
 
-    return calculated_crc == this->crc32;
+    vote_mirrored_data(addresses, out, is_valid, stale);
+    return repair_replicas(stale, out.data(), out.size());
 }
 
-std::unique_ptr<char[]> StorageCluster::read_and_verify_mirrored_data(
-    const std::vector<PhysicalAddress> &addresses,
-    size_t size,
-    const DataValidator &is_valid)
+void StorageCluster::vote_mirrored_data(
+    std::span<const PhysicalAddress> addresses,
+    std::span<char> out,
+    const DataValidator &is_valid,
+    std::vector<PhysicalAddress> &stale)
 {
-    std::map<std::vector<char>, int> vote_counts;
+    size_t size = out.size();
 
-    for (auto &address : addresses)
+    if (addresses.size() == 1)
     {
+        const PhysicalAddress &address = addresses.front();
+
         try
         {
-            auto bytes = read(address.disk_id, address.offset, size);
-
-            if (is_valid(bytes.get(), size))
-            {
-                std::vector<char> key(bytes.get(), bytes.get() + size);
-                vote_counts[key]++;
-            }
+            read(address.disk_id, address.offset, out);
         }
         catch (const std::exception &e)
         {
             std::cerr << "Warning: could not read data from device " << (int)address.disk_id << ": " << e.what() << std::endl;
+            throw ClusterError("No valid data found on any device.");
+        }
+
+        if (!validate(is_valid, out.data(), size))
+        {
+            throw ClusterError("No valid data found on any device.");
         }
+        return;
     }
 
-    if (vote_counts.empty())
+    // every replica is read once, votes are counted on the first copy of each distinct value
+    std::vector<char> copies(addresses.size() * size);
+    std::vector<std::string> read_errors(addresses.size());
+    std::vector<size_t> votes(addresses.size(), 0);
+
+    std::vector<IoRequest> requests;
+    requests.reserve(addresses.size());
+
+    for (size_t i = 0; i < addresses.size(); ++i)
     {
-        throw ClusterError("No valid data found on any device.");
+        requests.push_back({addresses[i].disk_id, [this, &addresses, &copies, &read_errors, size, i]
+                            {
+                                try
+                                {
+                                    read(addresses[i].disk_id, addresses[i].offset, {copies.data() + i * size, size});
+                                }
+                                catch (const std::exception &e)
+                                {
+                                    read_errors[i] = e.what();
+                                }
+                            }});
+    }
+
+    io_pool_.run(requests);
+
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        const char *copy = copies.data() + i * size;
+
+        if (!read_errors[i].empty())
+        {
+            std::cerr << "Warning: could not read data from device " << (int)addresses[i].disk_id << ": " << read_errors[i] << std::endl;
+            continue;
+        }
+
+        if (!validate(is_valid, copy, size))
+        {
+            continue;
+        }
+
+        size_t first_copy = 0;
+        while (first_copy < i && (votes[first_copy] == 0 || std::memcmp(copies.data() + first_copy * size, copy, size) != 0))
+        {
+            first_copy++;
+        }
+        votes[first_copy]++;
     }
 
-    auto winner_it = std::max_element(vote_counts.begin(), vote_counts.end(),
-                                      [](const auto &a, const auto &b)
-                                      { return a.second < b.second; });
+    size_t distinct_values = std::count_if(votes.begin(), votes.end(), [](size_t count)
+                                           { return count > 0; });
+
+    if (distinct_values == 0)
+    {
+        throw ClusterError("No valid data found on any device.");
+    }
 
-    int max_votes = winner_it->second;
-    const std::vector<char> &winner_key = winner_it->first;
+    size_t winner = std::max_element(votes.begin(), votes.end()) - votes.begin();
 
-    size_t required_quorum = (vote_counts.size() / 2) + 1;
-    if (max_votes < required_quorum)
+    size_t required_quorum = (distinct_values / 2) + 1;
+    if (votes[winner] < required_quorum)
     {
+        metrics_.add(MetricCounter::QuorumFailures);
         throw ClusterError("Cluster is inconsistent: No quorum for data. Manual intervention required.");
     }
 
-    const std::vector<char> &winning_data = winner_it->first;
+    const char *winning_data = copies.data() + winner * size;
+
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        if (!read_errors[i].empty() || std::memcmp(copies.data() + i * size, winning_data, size) != 0)
+        {
+            stale.push_back(addresses[i]);
+        }
+    }
+
+    std::memcpy(out.data(), winning_data, size);
+}
+
+size_t StorageCluster::repair_replicas(std::span<const PhysicalAddress> stale, const char *data, size_t size)
+{
+    for (const PhysicalAddress &address : stale)
+    {
+        std::cerr << "Warning: restoring metadata on device " << (int)address.disk_id << std::endl;
+        write(address.disk_id, address.offset, data, size);
+    }
+
+    if (!stale.empty())
+    {
+        metrics_.add(MetricCounter::ReplicasRepaired, stale.size());
+    }
+    return stale.size();
+}
 
-    for (auto &address : addresses)
+bool StorageCluster::try_read_replicated_data(
+    std::span<const PhysicalAddress> addresses,
+    std::span<char> out,
+    const DataValidator &is_valid)
+{
+    if (replica_read_mode_ == ReplicaReadMode::Fast || addresses.size() == 1)
     {
-        bool needs_restore = true;
+        const PhysicalAddress &address = addresses[replica_cursor_.fetch_add(1, std::memory_order_relaxed) % addresses.size()];
+
         try
         {
-            auto bytes = read(address.disk_id, address.offset, size);
-            std::vector<char> current_key(bytes.get(), bytes.get() + size);
-            if (current_key == winner_key)
-            {
-                needs_restore = false;
-            }
+            read(address.disk_id, address.offset, out);
+            return validate(is_valid, out.data(), out.size());
         }
         catch (const std::exception &e)
         {
-            needs_restore = true;
+            std::cerr << "Warning: could not read data from device " << (int)address.disk_id << ": " << e.what() << std::endl;
+            return false;
         }
+    }
 
-        if (needs_restore)
-        {
-            std::cout << "Restoring metadata on device " << (int)address.disk_id << std::endl;
-            write(address.disk_id, address.offset, winning_data.data(), size);
-        }
+    // quorum reads are served without the writer lock only when every replica agrees
+    size_t size = out.size();
+    std::vector<char> copies(addresses.size() * size);
+    std::vector<char> valid(addresses.size(), false);
+
+    std::vector<IoRequest> requests;
+    requests.reserve(addresses.size());
+
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        requests.push_back({addresses[i].disk_id, [this, &addresses, &copies, &valid, &is_valid, size, i]
+                            {
+                                try
+                                {
+                                    read(addresses[i].disk_id, addresses[i].offset, {copies.data() + i * size, size});
+                                    valid[i] = validate(is_valid, copies.data() + i * size, size);
+                                }
+                                catch (const std::exception &)
+                                {
+                                }
+                            }});
     }
 
-    auto response = std::make_unique<char[]>(size);
+    io_pool_.run(requests);
 
-    std::memcpy(response.get(), winning_data.data(), size);
+    for (size_t i = 0; i < addresses.size(); ++i)
+    {
+        if (!valid[i] || std::memcmp(copies.data(), copies.data() + i * size, size) != 0)
+        {
+            return false;
+        }
+    }
 
-    return response;
+    std::memcpy(out.data(), copies.data(), size);
+    return true;
 }
 
 void StorageCluster::read_and_verify_heads()
@@ -248,9 +408,10 @@ void StorageCluster::read_and_verify_heads()
                 .offset = 0};
         });
 
-    auto stored_head = read_and_verify_mirrored_data(addresses, CLUSTER_HEAD_SIZE, validator);
+    std::array<char, CLUSTER_HEAD_SIZE> stored_head;
+    read_and_verify_mirrored_data(addresses, stored_head, validator);
 
-    head_.deserialize(stored_head.get());
+    head_.deserialize(stored_head.data());
 }
 
 void StorageCluster::read_and_verify_states()
@@ -282,9 +443,102 @@ void StorageCluster::read_and_verify_states()
                 .offset = head_.cluster_state_offset};
         });
 
-    auto stored_state = read_and_verify_mirrored_data(addresses, CLUSTER_STATE_SIZE, validator);
+    std::array<char, CLUSTER_STATE_SIZE> stored_state;
+    read_and_verify_mirrored_data(addresses, stored_state, validator);
+
+    state_.deserialize(stored_state.data());
+    publish_state();
+}
+
+std::vector<JournalRecord> StorageCluster::scan_journal()
+{
+    size_t region_size = journal_slots_ * journal_slot_size_;
+    std::vector<char> copies(devices_.size() * region_size);
+    std::vector<std::string> read_errors(devices_.size());
+
+    std::vector<IoRequest> requests;
+    requests.reserve(devices_.size());
+
+    size_t i = 0;
+    for (const auto &[id, device] : devices_)
+    {
+        requests.push_back({id, [this, &copies, &read_errors, region_size, id, i]
+                            {
+                                try
+                                {
+                                    read(id, head_.journal_offset, {copies.data() + i * region_size, region_size});
+                                }
+                                catch (const std::exception &e)
+                                {
+                                    read_errors[i] = e.what();
+                                }
+                            }});
+        i++;
+    }
+
+    io_pool_.run(requests);
+
+    // a slot keeps the newest copy that passes its CRC, torn or stale copies on other devices lose to it
+    std::vector<std::optional<JournalRecord>> slots(journal_slots_);
+
+    i = 0;
+    for (const auto &[id, device] : devices_)
+    {
+        if (!read_errors[i].empty())
+        {
+            std::cerr << "Warning: could not read journal from device " << (int)id << ": " << read_errors[i] << std::endl;
+            i++;
+            continue;
+        }
+
+        for (uint64_t slot = 0; slot < journal_slots_; ++slot)
+        {
+            const char *record = copies.data() + i * region_size + slot * journal_slot_size_;
+            const char *ptr = record;
+
+            uint32_t crc;
+            uint64_t sequence;
+            uint64_t size;
+            DESERIALIZE_FIELD(ptr, crc, uint32_t, deserializeU32);
+            DESERIALIZE_FIELD(ptr, sequence, uint64_t, deserializeU64);
+            DESERIALIZE_FIELD(ptr, size, uint64_t, deserializeU64);
+
+            if (size < JOURNAL_RECORD_HEADER_SIZE || size > journal_slot_size_ || sequence % journal_slots_ != slot)
+            {
+                continue;
+            }
+            if (slots[slot] && slots[slot]->sequence >= sequence)
+            {
+                continue;
+            }
+            if (crc != generate_record_CRC32(record + sizeof(uint32_t), size - sizeof(uint32_t)))
+            {
+                continue;
+            }
+
+            slots[slot] = JournalRecord{.sequence = sequence, .data = std::vector<char>(record, record + size)};
+        }
+        i++;
+    }
+
+    std::vector<JournalRecord> records;
+    for (auto &slot : slots)
+    {
+        if (slot)
+        {
+            records.push_back(std::move(*slot));
+        }
+    }
+    std::sort(records.begin(), records.end(), [](const JournalRecord &a, const JournalRecord &b)
+              { return a.sequence < b.sequence; });
+
+    if (!records.empty())
+    {
+        journal_sequence_ = std::max(journal_sequence_, records.back().sequence + 1);
+    }
+    journal_scanned_ = true;
 
-    state_.deserialize(stored_state.get());
+    return records;
 }
 
 void StorageCluster::write_head_to_all_devices()
@@ -303,58 +557,259 @@ void StorageCluster::write_state_to_all_devices()
     auto serialized = state_.serialize();
 
     mirrored_write(head_.cluster_state_offset, reinterpret_cast<const char *>(serialized.data()), CLUSTER_STATE_SIZE);
+    publish_state();
+
+    blocks_since_checkpoint_ = 0;
+    last_checkpoint_ = std::chrono::steady_clock::now();
+}
+
+void StorageCluster::checkpoint_state_if_due(uint64_t written_blocks)
+{
+    blocks_since_checkpoint_ += written_blocks;
+
+    bool blocks_due = checkpoint_policy_.max_blocks != 0 && blocks_since_checkpoint_ >= checkpoint_policy_.max_blocks;
+    bool age_due = checkpoint_policy_.max_age.count() != 0 && std::chrono::steady_clock::now() - last_checkpoint_ >= checkpoint_policy_.max_age;
+
+    if (blocks_due || age_due)
+    {
+        write_state_to_all_devices();
+        return;
+    }
+
+    publish_state();
+}
+
+const std::vector<DiskLayout> &StorageCluster::get_disks_layout() const
+{
+    return layouts_;
+}
+
+RingBufferState StorageCluster::ring_state(const ClusterState &state) const
+{
+    return {
+        .head_id = state.head_logical_block_id,
+        .tail_id = state.tail_logical_block_id,
+        .count = state.valid_block_count,
+        .capacity = head_.total_blocks};
+}
+
+PhysicalLocations StorageCluster::map_block(uint64_t id) const
+{
+    PhysicalLocations locations = raid_governor_->map_logical_to_physical(id, layouts_);
+
+    if (locations.empty())
+    {
+        throw ClusterError("Block " + std::to_string(id) + " has no physical location");
+    }
+
+    return locations;
+}
+
+PhysicalAddresses StorageCluster::block_addresses(uint64_t id) const
+{
+    PhysicalAddresses addresses;
+
+    for (const PhysicalLocation &location : map_block(id))
+    {
+        addresses.push_back({
+            .disk_id = location.disk_id,
+            .offset = head_.data_offset + (location.block_id_on_disk * total_block_size_)});
+    }
+
+    return addresses;
+}
+
+PhysicalAddresses StorageCluster::index_addresses(uint64_t id) const
+{
+    PhysicalAddresses addresses;
+
+    for (const PhysicalLocation &location : map_block(id))
+    {
+        addresses.push_back({
+            .disk_id = location.disk_id,
+            .offset = head_.index_offset + (location.block_id_on_disk * INDEX_ENTRY_SIZE)});
+    }
+
+    return addresses;
+}
+
+DataValidator StorageCluster::index_validator(uint64_t id, const ClusterState &state) const
+{
+    uint64_t sequence = expected_sequence(id, state);
+
+    return [id, sequence](const char *data, size_t size) -> bool
+    {
+        if (size != INDEX_ENTRY_SIZE)
+        {
+            return false;
+        }
+
+        IndexEntry candidate;
+        candidate.deserialize(data);
+
+        return candidate.is_valid() && candidate.block_id == id && candidate.sequence == sequence;
+    };
+}
+
+uint64_t StorageCluster::expected_sequence(uint64_t id, const ClusterState &state) const
+{
+    uint64_t logical_id = (id + head_.total_blocks - state.head_logical_block_id) % head_.total_blocks;
+
+    return first_valid_sequence(state) + logical_id;
+}
+
+uint64_t StorageCluster::first_valid_sequence(const ClusterState &state)
+{
+    return state.total_writes_count - state.valid_block_count;
 }
 
 void StorageCluster::mirrored_write(size_t address, const char *data, size_t size)
 {
-    for (const auto &[id, _value] : devices_)
+    std::vector<IoRequest> requests;
+    requests.reserve(devices_.size());
+
+    for (const auto &[id, device] : devices_)
     {
-        write(id, address, data, size);
+        requests.push_back({id, [this, id, address, data, size]
+                            { write(id, address, data, size); }});
     }
+
+    io_pool_.run(requests);
 }
 
-void StorageCluster::write(uint8_t device_id, size_t address, const char *data, size_t size)
+// index entries share the block cache, kept apart from block ids by the top bit
+static uint64_t index_cache_key(uint64_t id)
+{
+    return id | (1ull << 63);
+}
+
+void StorageCluster::note_foreground_request()
+{
+    foreground_requests_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StorageCluster::publish_state()
+{
+    std::lock_guard lock(published_state_mutex_);
+    published_state_ = state_;
+}
+
+Device &StorageCluster::get_device(uint8_t device_id) const
 {
-    const auto &device = devices_[device_id];
+    auto device = devices_.find(device_id);
 
-    if (!device)
+    if (device == devices_.end())
     {
         throw ClusterError("Device not found");
     }
 
-    device->write(address, data, size);
+    return *device->second;
 }
 
-std::unique_ptr<char[]> StorageCluster::read(uint8_t device_id, size_t address, size_t size)
+void StorageCluster::add_device(uint8_t disk_id, std::unique_ptr<Device> device)
 {
-    const auto &device = devices_[device_id];
+    DiskLayout layout = {.disk_id = disk_id, .total_blocks = device->get_head().total_blocks_on_disk};
+    layouts_.insert(std::upper_bound(layouts_.begin(), layouts_.end(), layout, [](const DiskLayout &a, const DiskLayout &b)
+                                     { return a.disk_id < b.disk_id; }),
+                    layout);
+
+    devices_.emplace(disk_id, std::move(device));
+    io_pool_.add_device(disk_id);
+    metrics_.register_device(disk_id);
+}
+
+bool StorageCluster::validate(const DataValidator &validator, const char *data, size_t size)
+{
+    auto started = Metrics::Clock::now();
+    bool valid = validator(data, size);
+
+    metrics_.record(MetricHistogram::CrcNs, Metrics::elapsed_ns(started));
+    return valid;
+}
+
+void StorageCluster::write(uint8_t device_id, size_t address, const char *data, size_t size)
+{
+    Device &device = get_device(device_id);
+    auto started = Metrics::Clock::now();
 
-    if (!device)
+    try
     {
-        throw ClusterError("Device not found");
+        device.write(address, data, size);
+    }
+    catch (...)
+    {
+        metrics_.record_device_error(device_id);
+        throw;
     }
+    metrics_.record_device(device_id, DeviceOp::Write, size, started);
+}
 
-    return device->read(address, size);
+void StorageCluster::read(uint8_t device_id, size_t address, std::span<char> buffer)
+{
+    Device &device = get_device(device_id);
+    auto started = Metrics::Clock::now();
+
+    try
+    {
+        device.read_into(address, buffer);
+    }
+    catch (...)
+    {
+        metrics_.record_device_error(device_id);
+        throw;
+    }
+    metrics_.record_device(device_id, DeviceOp::Read, buffer.size(), started);
 }
 
 StorageCluster::StorageCluster(std::unique_ptr<RaidGovernor> governor, const ClusterStructsSizes &sizes) : raid_governor_(std::move(governor))
 {
     total_block_size_ = sizes.total_block_size;
     transaction_size_ = sizes.transaction_size;
+    journal_slots_ = sizes.journal_slots;
+}
+
+StorageCluster::~StorageCluster()
+{
+    try
+    {
+        checkpoint_state();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Warning: cluster state was not persisted: " << e.what() << std::endl;
+    }
 }
 
-void StorageCluster::format_cluster(const std::vector<DeviceFormatBlueprint> &blueprints, uint64_t block_payload_size)
+void StorageCluster::format_cluster(
+    const std::vector<DeviceFormatBlueprint> &blueprints,
+    uint64_t block_payload_size,
+    PayloadFormat payload_format,
+    PayloadCodec payload_codec)
 {
     if (blueprints.size() > MAX_DEVICES)
     {
         throw ClusterError("Device limit reached, max " + std::to_string(MAX_DEVICES));
     }
+    // a block slot has a fixed size, only packing more records into it gains from encoding
+    if (payload_codec != PayloadCodec::None && payload_format != PayloadFormat::PackedRecords)
+    {
+        throw ClusterError("Payload codecs apply to packed records only");
+    }
 
     head_.raid_type = raid_governor_->get_type();
     head_.num_of_disks = blueprints.size();
     head_.block_payload_size = block_payload_size;
+    head_.payload_format = static_cast<uint64_t>(payload_format);
+    head_.payload_codec = static_cast<uint64_t>(payload_codec);
+
+    if (journal_slots_ == 0)
+    {
+        throw ClusterError("Journal needs at least one slot");
+    }
+    head_.journal_slots = journal_slots_;
+    journal_slot_size_ = transaction_size_;
 
-    head_.total_blocks = 0;
+    uint64_t max_blocks_on_disk = 0;
 
     for (size_t i = 0; i < blueprints.size(); ++i)
     {
@@ -362,16 +817,31 @@ void StorageCluster::format_cluster(const std::vector<DeviceFormatBlueprint> &bl
 
         auto device = blueprint.formater(blueprint.path, CLUSTER_HEAD_SIZE, i);
 
-        head_.total_blocks += device->get_head().total_blocks_on_disk;
+        max_blocks_on_disk = std::max(max_blocks_on_disk, device->get_head().total_blocks_on_disk);
 
-        devices_.emplace(i, std::move(device));
+        add_device(i, std::move(device));
     }
-    head_.data_offset = head_.journal_offset + CLUSTER_STATE_SIZE + total_block_size_;
+    head_.total_blocks = raid_governor_->get_capacity(get_disks_layout());
+    head_.index_offset = head_.journal_offset + journal_slots_ * journal_slot_size_;
+    head_.data_offset = head_.index_offset + max_blocks_on_disk * INDEX_ENTRY_SIZE;
 
     head_.update_crc();
 
     write_head_to_all_devices();
     write_state_to_all_devices();
+
+    // journal records and index entries left on reused devices by an earlier cluster
+    // must not be replayed or taken for its tail
+    std::vector<char> zeros(std::min<uint64_t>(head_.data_offset - head_.journal_offset, FORMAT_CLEAR_CHUNK), 0);
+
+    for (uint64_t offset = head_.journal_offset; offset < head_.data_offset; offset += zeros.size())
+    {
+        mirrored_write(offset, zeros.data(), std::min<uint64_t>(zeros.size(), head_.data_offset - offset));
+    }
+    journal_sequence_ = 0;
+    journal_scanned_ = true;
+
+    sync_devices();
 }
 
 void StorageCluster::open_cluster(const std::vector<DeviceOpenBlueprint> &blueprints)
@@ -392,136 +862,991 @@ void StorageCluster::open_cluster(const std::vector<DeviceOpenBlueprint> &bluepr
             throw ClusterError("Disk already exists, id: " + std::to_string(disk_id));
         }
 
-        devices_.emplace(disk_id, std::move(device));
+        add_device(disk_id, std::move(device));
     }
 
     read_and_verify_heads();
+
+    if (head_.raid_type != raid_governor_->get_type())
+    {
+        throw ClusterError("Cluster raid type " + std::to_string(head_.raid_type) + " does not match governor type " + std::to_string(raid_governor_->get_type()));
+    }
+
+    // the slot size comes from the region the cluster was formatted with, clusters from before the
+    // circular journal hold a single record
+    journal_slots_ = std::max<uint64_t>(head_.journal_slots, 1);
+    journal_slot_size_ = ((has_index() ? head_.index_offset : head_.data_offset) - head_.journal_offset) / journal_slots_;
+
+    if (transaction_size_ > journal_slot_size_)
+    {
+        throw ClusterError("Transaction size " + std::to_string(transaction_size_) + " exceeds the journal slot size " + std::to_string(journal_slot_size_));
+    }
+
     read_and_verify_states();
 }
 
-void StorageCluster::write_next_block(const char *data)
+void StorageCluster::write_next_block(const char *data, uint64_t timestamp)
 {
-    std::vector<DiskLayout> layouts;
-    layouts.reserve(devices_.size());
+    write_next_blocks(data, 1, {timestamp});
+}
 
-    std::transform(
-        devices_.begin(),
-        devices_.end(),
-        std::back_inserter(layouts),
-        [](const auto &pair)
+void StorageCluster::write_runs(uint8_t disk_id, std::vector<WriteSlot> &slots)
+{
+    Device &device = get_device(disk_id);
+
+    const std::vector<char> zero_entry(INDEX_ENTRY_SIZE, 0);
+    std::deque<std::vector<char>> scratch;
+    std::vector<std::future<void>> pending;
+    std::vector<uint64_t> pending_bytes;
+    auto started = Metrics::Clock::now();
+
+    std::sort(slots.begin(), slots.end(), [](const WriteSlot &a, const WriteSlot &b)
+              { return a.block_id_on_disk < b.block_id_on_disk; });
+
+    // every run of the disk is queued before the first one is awaited
+    size_t run_start = 0;
+    while (run_start < slots.size())
+    {
+        size_t run_end = run_start + 1;
+        bool source_contiguous = true;
+
+        while (run_end < slots.size() && slots[run_end].block_id_on_disk == slots[run_end - 1].block_id_on_disk + 1)
         {
-            return DiskLayout{
-                .disk_id = pair.first,
-                .total_blocks = pair.second->get_head().total_blocks_on_disk};
-        });
+            source_contiguous = source_contiguous && slots[run_end].data == slots[run_end - 1].data + total_block_size_;
+            run_end++;
+        }
+
+        size_t run_length = run_end - run_start;
+        size_t offset = head_.data_offset + slots[run_start].block_id_on_disk * total_block_size_;
+
+        const char *run_data = slots[run_start].data;
+        if (!source_contiguous)
+        {
+            std::vector<char> &gathered = scratch.emplace_back(run_length * total_block_size_);
+            for (size_t i = run_start; i < run_end; ++i)
+            {
+                std::memcpy(gathered.data() + (i - run_start) * total_block_size_, slots[i].data, total_block_size_);
+            }
+            run_data = gathered.data();
+        }
+
+        pending.push_back(queue_request([&]
+                                        { return device.write_async(offset, run_data, run_length * total_block_size_); }));
+        pending_bytes.push_back(run_length * total_block_size_);
+
+        if (has_index())
+        {
+            // parity rows carry no index entry, their slot is cleared
+            std::vector<char> &entries = scratch.emplace_back(run_length * INDEX_ENTRY_SIZE);
+            for (size_t i = run_start; i < run_end; ++i)
+            {
+                const char *entry_data = slots[i].index_entry ? slots[i].index_entry : zero_entry.data();
+                std::memcpy(entries.data() + (i - run_start) * INDEX_ENTRY_SIZE, entry_data, INDEX_ENTRY_SIZE);
+            }
+
+            size_t index_offset = head_.index_offset + slots[run_start].block_id_on_disk * INDEX_ENTRY_SIZE;
+            pending.push_back(queue_request([&]
+                                            { return device.write_async(index_offset, entries.data(), entries.size()); }));
+            pending_bytes.push_back(entries.size());
+        }
+
+        run_start = run_end;
+    }
+
+    // queued writes are timed from the submission of the batch to when each is seen complete
+    wait_all(pending, [&](size_t index, bool failed)
+             {
+                 if (failed)
+                 {
+                     metrics_.record_device_error(disk_id);
+                     return;
+                 }
+                 metrics_.record_device(disk_id, DeviceOp::Write, pending_bytes[index], started); });
+}
+
+void StorageCluster::write_next_blocks(const char *data, uint64_t count, const std::vector<uint64_t> &timestamps)
+{
+    note_foreground_request();
+    std::lock_guard lock(writer_mutex_);
+
+    if (count > head_.total_blocks || timestamps.size() != count)
+    {
+        throw ClusterError("Invalid block batch");
+    }
+
+    // a scan on open starts at the slot after the persisted tail, a later lap must not overwrite it first
+    if (blocks_since_checkpoint_ + count > head_.total_blocks)
+    {
+        write_state_to_all_devices();
+    }
+
+    const auto &layouts = get_disks_layout();
+
+    ClusterState next_state = state_;
+    std::map<uint8_t, std::vector<WriteSlot>> slots_per_disk;
+    std::vector<char> entries(has_index() ? count * INDEX_ENTRY_SIZE : 0);
+    std::deque<std::vector<char>> parity_blocks;
+
+    for (uint64_t slot = 0; slot < count; ++slot)
+    {
+        RingBufferState ring = {
+            .head_id = next_state.head_logical_block_id,
+            .tail_id = next_state.tail_logical_block_id,
+            .count = next_state.valid_block_count,
+            .capacity = head_.total_blocks};
+
+        uint64_t new_block_id = ring.get_next_block_id();
+        const char *block_data = data + slot * total_block_size_;
+        const char *entry_data = nullptr;
+
+        if (has_index())
+        {
+            IndexEntry entry{
+                .timestamp = timestamps[slot],
+                .block_id = new_block_id,
+                .sequence = next_state.total_writes_count};
+            entry.update_crc();
+
+            entry_data = entries.data() + slot * INDEX_ENTRY_SIZE;
+            entry.serialize_into(entries.data() + slot * INDEX_ENTRY_SIZE);
+        }
+
+        for (PhysicalLocation location : map_block(new_block_id))
+        {
+            slots_per_disk[location.disk_id].push_back({location.block_id_on_disk, block_data, entry_data});
+        }
+
+        if (raid_governor_->get_parity_count() > 0)
+        {
+            fold_into_stripe(new_block_id, block_data, layouts, slots_per_disk, parity_blocks);
+        }
 
-    uint64_t new_block_id = get_ring_buffer_state().get_next_block_id();
+        next_state = advance_state(next_state, new_block_id);
+    }
+
+    // each disk writes its runs on its own worker
+    std::vector<IoRequest> requests;
+    requests.reserve(slots_per_disk.size());
+
+    for (auto &[disk_id, slots] : slots_per_disk)
+    {
+        requests.push_back({disk_id, [this, disk_id, &slots]
+                            { write_runs(disk_id, slots); }});
+    }
+
+    io_pool_.run(requests);
+
+    // only once the new data is on the devices, a reader refilling the cache before that would bring the old block back
+    uint64_t first_id = ring_state(state_).get_next_block_id();
+
+    for (uint64_t slot = 0; slot < count; ++slot)
+    {
+        uint64_t id = (first_id + slot) % head_.total_blocks;
 
-    std::vector<PhysicalLocation> location_to_write = raid_governor_->map_logical_to_physical(new_block_id, layouts);
+        block_cache_.invalidate(id);
+        block_cache_.invalidate(index_cache_key(id));
+    }
 
-    for (PhysicalLocation location : location_to_write)
     {
-        auto &device = devices_.at(location.disk_id);
+        std::unique_lock sparse_lock(sparse_index_mutex_);
 
-        size_t offset = head_.data_offset + location.block_id_on_disk * total_block_size_;
+        if (sparse_index_)
+        {
+            for (uint64_t slot = 0; slot < count; ++slot)
+            {
+                uint64_t sequence = state_.total_writes_count + slot;
 
-        device->write(offset, data, total_block_size_);
+                if (sparse_index_->should_sample(sequence))
+                {
+                    sparse_index_->append(sequence, timestamps[slot]);
+                }
+            }
+            sparse_index_->evict_before(first_valid_sequence(next_state));
+        }
     }
 
-    state_.total_writes_count++;
+    state_ = next_state;
 
-    bool was_full = (state_.valid_block_count == head_.total_blocks);
+    checkpoint_state_if_due(count);
+}
+
+ClusterState StorageCluster::advance_state(ClusterState state, uint64_t new_block_id) const
+{
+    state.total_writes_count++;
+
+    bool was_full = (state.valid_block_count == head_.total_blocks);
 
     if (was_full)
     {
-        state_.head_logical_block_id = (state_.head_logical_block_id + 1) % head_.total_blocks;
+        state.head_logical_block_id = (state.head_logical_block_id + 1) % head_.total_blocks;
     }
 
-    state_.tail_logical_block_id = new_block_id;
+    state.tail_logical_block_id = new_block_id;
 
     if (!was_full)
     {
-        state_.valid_block_count++;
+        state.valid_block_count++;
     }
 
-    write_state_to_all_devices();
+    // a lap refills a stripe from its first block, the parity on disk stops covering the older blocks
+    // left in it, so they are dropped together instead of one by one
+    uint64_t stripe_width = raid_governor_->get_parity_count() > 0 ? raid_governor_->get_stripe_width(get_disks_layout()) : 1;
+
+    if (stripe_width > 1 && new_block_id % stripe_width == 0)
+    {
+        uint64_t head_distance = (state.head_logical_block_id + head_.total_blocks - new_block_id) % head_.total_blocks;
+
+        if (head_distance > 0 && head_distance < stripe_width)
+        {
+            uint64_t dropped = stripe_width - head_distance;
+
+            state.head_logical_block_id = (state.head_logical_block_id + dropped) % head_.total_blocks;
+            state.valid_block_count -= dropped;
+        }
+    }
+
+    return state;
+}
+
+void StorageCluster::open_stripe(uint64_t stripe_id, uint64_t position, const std::vector<DiskLayout> &layouts)
+{
+    uint64_t stripe_width = raid_governor_->get_stripe_width(layouts);
+
+    open_stripe_ = ParityStripe{
+        .stripe_id = stripe_id,
+        .blocks_folded = 0,
+        .p = std::vector<char>(total_block_size_, 0),
+        .q = std::vector<char>(raid_governor_->get_parity_count() > 1 ? total_block_size_ : 0, 0)};
+
+    // the accumulator was lost (reopen or rolled back state), fold the blocks already on disk
+    std::vector<char> block_data(total_block_size_);
+
+    for (uint64_t i = 0; i < position; ++i)
+    {
+        PhysicalLocation location = map_block(stripe_id * stripe_width + i).front();
+
+        read(location.disk_id, head_.data_offset + location.block_id_on_disk * total_block_size_, block_data);
+
+        xor_into(open_stripe_->p.data(), block_data.data(), total_block_size_);
+        if (!open_stripe_->q.empty())
+        {
+            gf256_mul_xor_into(open_stripe_->q.data(), block_data.data(), gf256_pow2(i), total_block_size_);
+        }
+        open_stripe_->blocks_folded++;
+    }
+}
+
+void StorageCluster::fold_into_stripe(
+    uint64_t block_id,
+    const char *data,
+    const std::vector<DiskLayout> &layouts,
+    std::map<uint8_t, std::vector<WriteSlot>> &slots_per_disk,
+    std::deque<std::vector<char>> &parity_blocks)
+{
+    uint64_t stripe_width = raid_governor_->get_stripe_width(layouts);
+    uint64_t stripe_id = block_id / stripe_width;
+    uint64_t position = block_id % stripe_width;
+
+    if (!open_stripe_ || open_stripe_->stripe_id != stripe_id || open_stripe_->blocks_folded != position)
+    {
+        open_stripe(stripe_id, position, layouts);
+    }
+
+    xor_into(open_stripe_->p.data(), data, total_block_size_);
+    if (!open_stripe_->q.empty())
+    {
+        gf256_mul_xor_into(open_stripe_->q.data(), data, gf256_pow2(position), total_block_size_);
+    }
+    open_stripe_->blocks_folded++;
+
+    if (open_stripe_->blocks_folded < stripe_width)
+    {
+        return;
+    }
+
+    // full stripe, its parity goes out with the data of the same batch
+    PhysicalLocations parity_locations = raid_governor_->map_parity(stripe_id, layouts);
+
+    parity_blocks.push_back(std::move(open_stripe_->p));
+    slots_per_disk[parity_locations[0].disk_id].push_back({parity_locations[0].block_id_on_disk, parity_blocks.back().data(), nullptr});
+
+    if (parity_locations.size() > 1)
+    {
+        parity_blocks.push_back(std::move(open_stripe_->q));
+        slots_per_disk[parity_locations[1].disk_id].push_back({parity_locations[1].block_id_on_disk, parity_blocks.back().data(), nullptr});
+    }
+
+    open_stripe_.reset();
+}
+
+void StorageCluster::rebuild_from_parity(uint64_t id, const DataValidator &validator, std::span<char> out)
+{
+    write_stripe_repairs(reconstruct_from_parity(id, validator, out, open_stripe_));
+}
+
+void StorageCluster::write_stripe_repairs(const std::vector<StripeRepair> &repairs)
+{
+    for (const StripeRepair &repair : repairs)
+    {
+        write(repair.location.disk_id, head_.data_offset + repair.location.block_id_on_disk * total_block_size_, repair.data.data(), total_block_size_);
+    }
+    metrics_.add(MetricCounter::ParityRebuilds);
+}
+
+std::vector<StripeRepair> StorageCluster::reconstruct_from_parity(uint64_t id, const DataValidator &validator, std::span<char> out, const std::optional<ParityStripe> &open_stripe)
+{
+    const auto &layouts = get_disks_layout();
+    uint64_t stripe_width = raid_governor_->get_stripe_width(layouts);
+    uint64_t stripe_id = id / stripe_width;
+    uint64_t target = id % stripe_width;
+
+    // blocks of the open stripe are protected by the in-memory accumulator only up to the last folded one
+    bool is_open_stripe = open_stripe && open_stripe->stripe_id == stripe_id;
+    uint64_t members = is_open_stripe ? open_stripe->blocks_folded : stripe_width;
+
+    if (target >= members)
+    {
+        throw ClusterError("Block " + std::to_string(id) + " belongs to an open stripe without parity");
+    }
+
+    std::vector<char> stripe(members * total_block_size_);
+    std::vector<PhysicalLocation> locations(members);
+    std::vector<uint64_t> missing;
+
+    for (uint64_t i = 0; i < members; ++i)
+    {
+        locations[i] = map_block(stripe_id * stripe_width + i).front();
+        char *block_data = stripe.data() + i * total_block_size_;
+
+        bool valid = false;
+        if (i != target)
+        {
+            try
+            {
+                read(locations[i].disk_id, head_.data_offset + locations[i].block_id_on_disk * total_block_size_, {block_data, total_block_size_});
+                valid = validate(validator, block_data, total_block_size_);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Warning: could not read stripe member from device " << (int)locations[i].disk_id << ": " << e.what() << std::endl;
+            }
+        }
+
+        if (!valid)
+        {
+            std::memset(block_data, 0, total_block_size_);
+            missing.push_back(i);
+        }
+    }
+
+    std::vector<char> p;
+    std::vector<char> q;
+
+    if (is_open_stripe)
+    {
+        p = open_stripe->p;
+        q = open_stripe->q;
+    }
+    else
+    {
+        PhysicalLocations parity_locations = raid_governor_->map_parity(stripe_id, layouts);
+
+        for (size_t i = 0; i < parity_locations.size(); ++i)
+        {
+            std::vector<char> parity(total_block_size_);
+            try
+            {
+                read(parity_locations[i].disk_id, head_.data_offset + parity_locations[i].block_id_on_disk * total_block_size_, parity);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Warning: could not read parity from device " << (int)parity_locations[i].disk_id << ": " << e.what() << std::endl;
+                continue;
+            }
+            (i == 0 ? p : q) = std::move(parity);
+        }
+    }
+
+    // syndromes of the surviving blocks, missing blocks are zero in the stripe buffer
+    if (!p.empty())
+    {
+        for (uint64_t i = 0; i < members; ++i)
+        {
+            xor_into(p.data(), stripe.data() + i * total_block_size_, total_block_size_);
+        }
+    }
+    if (!q.empty())
+    {
+        for (uint64_t i = 0; i < members; ++i)
+        {
+            gf256_mul_xor_into(q.data(), stripe.data() + i * total_block_size_, gf256_pow2(i), total_block_size_);
+        }
+    }
+
+    std::vector<StripeRepair> repairs;
+    std::vector<char> rebuilt(total_block_size_);
+    bool restored = false;
+
+    if (missing.size() == 1 && !p.empty())
+    {
+        std::memcpy(rebuilt.data(), p.data(), total_block_size_);
+        restored = validate(validator, rebuilt.data(), total_block_size_);
+    }
+
+    if (!restored && missing.size() == 1 && !q.empty())
+    {
+        std::memset(rebuilt.data(), 0, total_block_size_);
+        gf256_mul_xor_into(rebuilt.data(), q.data(), gf256_inv(gf256_pow2(target)), total_block_size_);
+        restored = validate(validator, rebuilt.data(), total_block_size_);
+    }
+
+    if (!restored && missing.size() == 2 && !p.empty() && !q.empty())
+    {
+        // D_x = (Q' ^ g^y * P') / (g^x ^ g^y), D_y = P' ^ D_x
+        uint64_t x = missing[0];
+        uint64_t y = missing[1];
+        uint8_t denominator_inv = gf256_inv(gf256_pow2(x) ^ gf256_pow2(y));
+
+        std::vector<char> block_x(total_block_size_, 0);
+        gf256_mul_xor_into(block_x.data(), q.data(), denominator_inv, total_block_size_);
+        gf256_mul_xor_into(block_x.data(), p.data(), gf256_mul(gf256_pow2(y), denominator_inv), total_block_size_);
+
+        std::vector<char> block_y = p;
+        xor_into(block_y.data(), block_x.data(), total_block_size_);
+
+        uint64_t other = x == target ? y : x;
+        std::vector<char> &other_block = x == target ? block_y : block_x;
+        rebuilt = x == target ? block_x : block_y;
+
+        restored = validate(validator, rebuilt.data(), total_block_size_);
+
+        if (restored && validate(validator, other_block.data(), total_block_size_))
+        {
+            repairs.push_back({locations[other], std::move(other_block)});
+        }
+    }
+
+    if (!restored)
+    {
+        throw ClusterError("Block " + std::to_string(id) + " could not be rebuilt from parity");
+    }
+
+    std::memcpy(out.data(), rebuilt.data(), total_block_size_);
+    repairs.push_back({locations[target], std::move(rebuilt)});
+
+    return repairs;
 }
 
-void StorageCluster::write_transaction_block(const char *data)
+uint64_t StorageCluster::append_journal_record(std::span<char> record)
 {
-    mirrored_write(head_.journal_offset, data, transaction_size_);
+    if (record.size() < JOURNAL_RECORD_HEADER_SIZE || record.size() > transaction_size_)
+    {
+        throw ClusterError("Transaction does not fit the journal");
+    }
+
+    note_foreground_request();
+    std::lock_guard lock(writer_mutex_);
+
+    if (!journal_scanned_)
+    {
+        scan_journal();
+    }
+
+    uint64_t sequence = journal_sequence_++;
+    char *ptr = record.data() + sizeof(uint32_t);
+
+    SERIALIZE_FIELD(ptr, sequence, uint64_t, serializeU64);
+    SERIALIZE_FIELD(ptr, record.size(), uint64_t, serializeU64);
+
+    ptr = record.data();
+    SERIALIZE_FIELD(ptr, generate_record_CRC32(record.data() + sizeof(uint32_t), record.size() - sizeof(uint32_t)), uint32_t, serializeU32);
+
+    mirrored_write(head_.journal_offset + (sequence % journal_slots_) * journal_slot_size_, record.data(), record.size());
+
+    return sequence;
+}
+
+void StorageCluster::sync_devices()
+{
+    note_foreground_request();
+
+    // flushes run beside the device workers and without the writer lock, reads never queue behind them;
+    // the first device is synced on this thread while the others are in flight
+    std::vector<std::future<void>> pending;
+    pending.reserve(devices_.size());
+
+    for (const auto &[id, device] : devices_)
+    {
+        Device *target = device.get();
+        pending.push_back(std::async(pending.empty() ? std::launch::deferred : std::launch::async, [this, id, target]
+                                     {
+                                         auto started = Metrics::Clock::now();
+                                         try
+                                         {
+                                             target->sync();
+                                         }
+                                         catch (...)
+                                         {
+                                             metrics_.record_device_error(id);
+                                             throw;
+                                         }
+                                         metrics_.record_device(id, DeviceOp::Sync, 0, started); }));
+    }
+
+    wait_all(pending);
+}
+
+void StorageCluster::set_state_checkpoint_policy(StateCheckpointPolicy policy)
+{
+    // without index entries the blocks written after a checkpoint cannot be found again on open
+    if (!has_index() && (policy.max_blocks != 1 || policy.max_age.count() != 0))
+    {
+        throw ClusterError("Deferred state checkpoints require a block index");
+    }
+
+    std::lock_guard lock(writer_mutex_);
+    checkpoint_policy_ = policy;
+}
+
+void StorageCluster::checkpoint_state()
+{
+    std::lock_guard lock(writer_mutex_);
+
+    if (blocks_since_checkpoint_ != 0)
+    {
+        write_state_to_all_devices();
+    }
+}
+
+uint64_t StorageCluster::recover_tail(const DataValidator &validator)
+{
+    if (!has_index())
+    {
+        return 0;
+    }
+
+    note_foreground_request();
+    std::lock_guard lock(writer_mutex_);
+
+    std::array<char, INDEX_ENTRY_SIZE> entry_data;
+    std::vector<char> block_data(total_block_size_);
+    uint64_t recovered = 0;
+
+    // every block carries the write ordinal, the scan stops at the first slot that is stale, torn or empty
+    while (true)
+    {
+        uint64_t id = ring_state(state_).get_next_block_id();
+        uint64_t sequence = state_.total_writes_count;
+
+        DataValidator entry_validator = [id, sequence](const char *data, size_t size) -> bool
+        {
+            if (size != INDEX_ENTRY_SIZE)
+            {
+                return false;
+            }
+
+            IndexEntry candidate;
+            candidate.deserialize(data);
+
+            return candidate.is_valid() && candidate.block_id == id && candidate.sequence == sequence;
+        };
+
+        try
+        {
+            read_and_verify_mirrored_data(index_addresses(id), entry_data, entry_validator);
+            read_and_verify_mirrored_data(block_addresses(id), block_data, validator);
+        }
+        catch (const ClusterError &)
+        {
+            break;
+        }
+
+        IndexEntry entry;
+        entry.deserialize(entry_data.data());
+
+        block_cache_.invalidate(id);
+        block_cache_.invalidate(index_cache_key(id));
+
+        {
+            std::unique_lock sparse_lock(sparse_index_mutex_);
+
+            if (sparse_index_ && sparse_index_->should_sample(sequence))
+            {
+                sparse_index_->append(sequence, entry.timestamp);
+            }
+        }
+
+        state_ = advance_state(state_, id);
+
+        recovered++;
+    }
+
+    if (recovered == 0)
+    {
+        return 0;
+    }
+
+    std::cerr << "Warning: restoring " << recovered << " blocks written after the last state checkpoint" << std::endl;
+
+    {
+        std::unique_lock sparse_lock(sparse_index_mutex_);
+
+        if (sparse_index_)
+        {
+            sparse_index_->evict_before(first_valid_sequence(state_));
+        }
+    }
+
+    open_stripe_.reset();
+    write_state_to_all_devices();
+
+    return recovered;
 }
 
 RingBufferState StorageCluster::get_ring_buffer_state() const
 {
-    return {
-        .head_id = state_.head_logical_block_id,
-        .tail_id = state_.tail_logical_block_id,
-        .count = state_.valid_block_count,
-        .capacity = head_.total_blocks};
+    return ring_state(get_state());
 }
 
 std::unique_ptr<char[]> StorageCluster::read_block(uint64_t id, DataValidator validator)
 {
+    auto response = std::make_unique<char[]>(total_block_size_);
+    read_block(id, validator, {response.get(), total_block_size_});
+    return response;
+}
+
+void StorageCluster::read_block(uint64_t id, DataValidator validator, std::span<char> out)
+{
+    if (out.size() != total_block_size_)
+    {
+        throw ClusterError("Output buffer does not match block size");
+    }
+
     if (id >= head_.total_blocks)
     {
         throw ClusterError("Block id is out of bound");
     }
-    std::vector<DiskLayout> layouts;
-    layouts.reserve(devices_.size());
 
-    std::transform(
-        devices_.begin(),
-        devices_.end(),
-        std::back_inserter(layouts),
-        [](const auto &pair)
+    note_foreground_request();
+
+    uint64_t epoch;
+    if (block_cache_.lookup(id, out, epoch))
+    {
+        return;
+    }
+
+    read_block_from_replicas(id, validator, out);
+    block_cache_.insert(id, out, epoch);
+}
+
+void StorageCluster::read_block_from_replicas(uint64_t id, const DataValidator &validator, std::span<char> out)
+{
+    PhysicalAddresses addresses = block_addresses(id);
+
+    if (try_read_replicated_data(addresses, out, validator))
+    {
+        return;
+    }
+
+    std::lock_guard lock(writer_mutex_);
+
+    try
+    {
+        read_and_verify_mirrored_data(addresses, out, validator);
+    }
+    catch (const ClusterError &e)
+    {
+        if (raid_governor_->get_parity_count() == 0)
         {
-            return DiskLayout{
-                .disk_id = pair.first,
-                .total_blocks = pair.second->get_head().total_blocks_on_disk};
-        });
+            throw;
+        }
+
+        std::cerr << "Warning: rebuilding block " << id << " from parity: " << e.what() << std::endl;
+        rebuild_from_parity(id, validator, out);
+    }
+}
+
+void StorageCluster::read_runs(uint8_t disk_id, std::vector<RunSlot> &slots, const DataValidator &validator, std::span<char> out, std::vector<char> &filled)
+{
+    struct PendingRun
+    {
+        size_t start;
+        size_t end;
+        const char *buffer;
+        bool in_place;
+        std::future<void> done;
+    };
 
-    std::vector<PhysicalLocation> location_to_write = raid_governor_->map_logical_to_physical(id, layouts);
+    Device &device = get_device(disk_id);
 
-    std::vector<PhysicalAddress> physical_locations;
-    physical_locations.reserve(location_to_write.size());
+    std::deque<std::vector<char>> scratch;
+    std::vector<PendingRun> pending;
+    auto started = Metrics::Clock::now();
 
-    std::transform(
-        location_to_write.begin(),
-        location_to_write.end(),
-        std::back_inserter(physical_locations),
-        [this](auto &location)
+    std::sort(slots.begin(), slots.end(), [](const RunSlot &a, const RunSlot &b)
+              { return a.block_id_on_disk < b.block_id_on_disk; });
+
+    // every run of the disk is queued before the first one is awaited
+    size_t run_start = 0;
+    while (run_start < slots.size())
+    {
+        size_t run_end = run_start + 1;
+        bool target_contiguous = true;
+
+        while (run_end < slots.size() && slots[run_end].block_id_on_disk == slots[run_end - 1].block_id_on_disk + 1)
         {
-            return PhysicalAddress{
-                .disk_id = location.disk_id,
-                .offset = head_.data_offset + (location.block_id_on_disk * total_block_size_)};
-        });
+            target_contiguous = target_contiguous && slots[run_end].slot == slots[run_end - 1].slot + 1;
+            run_end++;
+        }
+
+        size_t run_size = (run_end - run_start) * total_block_size_;
+        size_t offset = head_.data_offset + slots[run_start].block_id_on_disk * total_block_size_;
+
+        // runs that land contiguously in the output are read in place, others go through a scratch buffer
+        char *run_buffer = out.data() + slots[run_start].slot * total_block_size_;
+        if (!target_contiguous)
+        {
+            run_buffer = scratch.emplace_back(run_size).data();
+        }
+
+        pending.push_back({
+            .start = run_start,
+            .end = run_end,
+            .buffer = run_buffer,
+            .in_place = target_contiguous,
+            .done = queue_request([&]
+                                  { return device.read_async(offset, {run_buffer, run_size}); })});
+
+        run_start = run_end;
+    }
+
+    for (PendingRun &run : pending)
+    {
+        try
+        {
+            run.done.get();
+            metrics_.record_device(disk_id, DeviceOp::Read, (run.end - run.start) * total_block_size_, started);
+        }
+        catch (const std::exception &e)
+        {
+            metrics_.record_device_error(disk_id);
+            std::cerr << "Warning: could not read block run from device " << (int)disk_id << ": " << e.what() << std::endl;
+            continue;
+        }
 
-    return read_and_verify_mirrored_data(physical_locations, total_block_size_, validator);
+        for (size_t i = run.start; i < run.end; ++i)
+        {
+            const char *block_data = run.buffer + (i - run.start) * total_block_size_;
+
+            if (validate(validator, block_data, total_block_size_))
+            {
+                if (!run.in_place)
+                {
+                    std::memcpy(out.data() + slots[i].slot * total_block_size_, block_data, total_block_size_);
+                }
+                filled[slots[i].slot] = true;
+            }
+        }
+    }
 }
 
-std::unique_ptr<char[]> StorageCluster::read_transaction_block(DataValidator validator)
+void StorageCluster::read_blocks(uint64_t first_id, uint64_t count, DataValidator validator, std::span<char> out)
 {
-    size_t offset = head_.journal_offset;
-    std::vector<PhysicalAddress> addresses;
-    addresses.reserve(devices_.size());
+    if (first_id + count > head_.total_blocks)
+    {
+        throw ClusterError("Block range is out of bound");
+    }
+    if (out.size() != count * total_block_size_)
+    {
+        throw ClusterError("Output buffer does not match block range size");
+    }
 
-    std::transform(
-        devices_.begin(),
-        devices_.end(),
-        std::back_inserter(addresses),
-        [offset](const auto &pair)
+    std::vector<char> filled(count, false);
+
+    note_foreground_request();
+    const auto &layouts = get_disks_layout();
+    std::map<uint8_t, std::vector<RunSlot>> slots_per_disk;
+
+    // the whole range is read from one replica, consecutive calls rotate over replicas
+    uint64_t replica = replica_cursor_.fetch_add(1, std::memory_order_relaxed);
+    std::vector<PhysicalLocation> locations(count);
+
+    if (!raid_governor_->map_range(first_id, replica, layouts, locations))
+    {
+        throw ClusterError("Blocks " + std::to_string(first_id) + ".." + std::to_string(first_id + count - 1) + " have no physical location");
+    }
+
+    for (uint64_t slot = 0; slot < count; ++slot)
+    {
+        slots_per_disk[locations[slot].disk_id].push_back({locations[slot].block_id_on_disk, slot});
+    }
+
+    // each disk reads its runs on its own worker
+    std::vector<IoRequest> requests;
+    requests.reserve(slots_per_disk.size());
+
+    for (auto &[disk_id, slots] : slots_per_disk)
+    {
+        requests.push_back({disk_id, [this, disk_id, &slots, &validator, out, &filled]
+                            { read_runs(disk_id, slots, validator, out, filled); }});
+    }
+
+    io_pool_.run(requests);
+
+    for (uint64_t slot = 0; slot < count; ++slot)
+    {
+        if (!filled[slot])
         {
-            return PhysicalAddress{
-                .disk_id = pair.first,
-                .offset = offset};
-        });
-    return read_and_verify_mirrored_data(addresses, transaction_size_, validator);
+            read_block_from_replicas(first_id + slot, validator, out.subspan(slot * total_block_size_, total_block_size_));
+        }
+    }
 }
 
-const ClusterState &StorageCluster::get_state() const
+IndexEntry StorageCluster::read_index_entry(uint64_t id)
 {
-    return state_;
+    if (!has_index())
+    {
+        throw ClusterError("Cluster has no index");
+    }
+    if (id >= head_.total_blocks)
+    {
+        throw ClusterError("Block id is out of bound");
+    }
+
+    note_foreground_request();
+
+    std::array<char, INDEX_ENTRY_SIZE> data;
+    uint64_t epoch;
+
+    if (!block_cache_.lookup(index_cache_key(id), data, epoch))
+    {
+        PhysicalAddresses addresses = index_addresses(id);
+
+        if (!try_read_replicated_data(addresses, data, index_validator(id, get_state())))
+        {
+            // voted on again against the current state, an entry the writer replaced
+            // after the snapshot was taken is not mistaken for a broken replica
+            std::lock_guard lock(writer_mutex_);
+            read_and_verify_mirrored_data(addresses, data, index_validator(id, state_));
+        }
+
+        block_cache_.insert(index_cache_key(id), data, epoch);
+    }
+
+    IndexEntry entry;
+    entry.deserialize(data.data());
+
+    return entry;
+}
+
+std::vector<JournalRecord> StorageCluster::read_journal()
+{
+    note_foreground_request();
+    std::lock_guard lock(writer_mutex_);
+
+    return scan_journal();
+}
+
+bool StorageCluster::has_index() const
+{
+    return head_.index_offset != 0;
+}
+
+PayloadFormat StorageCluster::get_payload_format() const
+{
+    return static_cast<PayloadFormat>(head_.payload_format);
+}
+
+PayloadCodec StorageCluster::get_payload_codec() const
+{
+    return static_cast<PayloadCodec>(head_.payload_codec);
+}
+
+void StorageCluster::set_replica_read_mode(ReplicaReadMode mode)
+{
+    replica_read_mode_ = mode;
+}
+
+void StorageCluster::set_block_cache_capacity(size_t bytes)
+{
+    block_cache_.set_capacity(bytes);
+}
+
+BlockCacheStats StorageCluster::get_block_cache_stats() const
+{
+    return block_cache_.get_stats();
+}
+
+Metrics &StorageCluster::get_metrics()
+{
+    return metrics_;
+}
+
+MetricsSnapshot StorageCluster::get_metrics_snapshot() const
+{
+    return metrics_.snapshot();
+}
+
+void StorageCluster::build_sparse_index(uint64_t stride, TimeStampFetcher &fetcher)
+{
+    if (stride == 0)
+    {
+        throw ClusterError("Sparse index stride must be positive");
+    }
+
+    auto index = std::make_unique<SparseIndex>(stride);
+    ClusterState state = get_state();
+    RingBufferState ring = ring_state(state);
+
+    uint64_t first_sequence = first_valid_sequence(state);
+    uint64_t sequence = (first_sequence + stride - 1) / stride * stride;
+
+    for (; sequence < state.total_writes_count; sequence += stride)
+    {
+        uint64_t id = (ring.head_id + (sequence - first_sequence)) % ring.capacity;
+
+        try
+        {
+            index->append(sequence, fetcher(id));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warning: sparse index skips block " << id << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::unique_lock lock(sparse_index_mutex_);
+    sparse_index_ = std::move(index);
+}
+
+SearchWindow StorageCluster::narrow_search(uint64_t timestamp)
+{
+    ClusterState state = get_state();
+    SearchWindow whole_ring = {.left = 0, .right = state.valid_block_count};
+
+    {
+        std::shared_lock lock(sparse_index_mutex_);
+
+        if (!sparse_index_)
+        {
+            return whole_ring;
+        }
+        if (!sparse_index_->has_stale_layout())
+        {
+            return sparse_index_->narrow(timestamp, ring_state(state), first_valid_sequence(state));
+        }
+    }
+
+    // the first search after the samples changed rebuilds the layout
+    std::unique_lock lock(sparse_index_mutex_);
+
+    return sparse_index_ ? sparse_index_->narrow(timestamp, ring_state(state), first_valid_sequence(state)) : whole_ring;
+}
+
+ClusterState StorageCluster::get_state() const
+{
+    std::lock_guard lock(published_state_mutex_);
+    return published_state_;
 }
 
 const ClusterHead &StorageCluster::get_head() const
@@ -529,7 +1854,157 @@ const ClusterHead &StorageCluster::get_head() const
     return head_;
 }
 
+uint64_t StorageCluster::get_total_block_size() const
+{
+    return total_block_size_;
+}
+
+uint64_t StorageCluster::get_transaction_size() const
+{
+    return transaction_size_;
+}
+
+uint64_t StorageCluster::get_journal_slots() const
+{
+    return journal_slots_;
+}
+
 void StorageCluster::update_state(ClusterState state)
 {
+    std::lock_guard lock(writer_mutex_);
+
     state_ = state;
-}
\ No newline at end of file
+    open_stripe_.reset();
+
+    publish_state();
+
+    // a rolled back tail leaves slots whose cached copies no longer match the state
+    block_cache_.clear();
+
+    std::unique_lock sparse_lock(sparse_index_mutex_);
+    if (sparse_index_)
+    {
+        sparse_index_->truncate_from(state_.total_writes_count);
+    }
+}
+
+ScrubReport StorageCluster::scrub_block(uint64_t id, const DataValidator &validator)
+{
+    if (id >= head_.total_blocks)
+    {
+        throw ClusterError("Block id is out of bound");
+    }
+
+    // the block may have left the ring since the caller picked it, parity raids drop stripes at once
+    auto in_ring = [this, id](const ClusterState &state)
+    {
+        return (id + head_.total_blocks - state.head_logical_block_id) % head_.total_blocks < state.valid_block_count;
+    };
+
+    ScrubReport report;
+    ClusterState state = get_state();
+
+    if (!in_ring(state))
+    {
+        return report;
+    }
+
+    // replicas are read and voted on without the writer lock, ingest only waits for the repairs
+    uint64_t sequence = expected_sequence(id, state);
+    std::vector<char> block(total_block_size_);
+    PhysicalAddresses addresses = block_addresses(id);
+    std::vector<PhysicalAddress> stale_blocks;
+    std::vector<StripeRepair> rebuilt;
+    std::string block_error;
+
+    report.bytes_read += addresses.size() * total_block_size_;
+
+    try
+    {
+        // every replica is read and voted on, a diverging copy is rewritten even when the others agree
+        vote_mirrored_data(addresses, block, validator, stale_blocks);
+    }
+    catch (const ClusterError &e)
+    {
+        block_error = e.what();
+    }
+
+    if (!block_error.empty() && raid_governor_->get_parity_count() > 0)
+    {
+        std::optional<ParityStripe> open_stripe;
+        {
+            std::lock_guard lock(writer_mutex_);
+            open_stripe = open_stripe_;
+        }
+
+        try
+        {
+            report.bytes_read += raid_governor_->get_stripe_width(get_disks_layout()) * total_block_size_;
+            rebuilt = reconstruct_from_parity(id, validator, block, open_stripe);
+            block_error.clear();
+        }
+        catch (const ClusterError &rebuild_error)
+        {
+            block_error = rebuild_error.what();
+        }
+    }
+
+    std::array<char, INDEX_ENTRY_SIZE> entry;
+    std::vector<PhysicalAddress> stale_entries;
+    std::string index_error;
+
+    if (has_index())
+    {
+        addresses = index_addresses(id);
+        report.bytes_read += addresses.size() * INDEX_ENTRY_SIZE;
+
+        try
+        {
+            vote_mirrored_data(addresses, entry, index_validator(id, state), stale_entries);
+        }
+        catch (const ClusterError &e)
+        {
+            index_error = e.what();
+        }
+    }
+
+    if (stale_blocks.empty() && rebuilt.empty() && stale_entries.empty() && block_error.empty() && index_error.empty())
+    {
+        return report;
+    }
+
+    std::lock_guard lock(writer_mutex_);
+
+    // a writer that overwrote the block meanwhile leaves nothing to repair, the reads may have seen its new data
+    if (!in_ring(state_) || expected_sequence(id, state_) != sequence)
+    {
+        return {.bytes_read = report.bytes_read};
+    }
+
+    if (!block_error.empty())
+    {
+        std::cerr << "Warning: scrub could not repair block " << id << ": " << block_error << std::endl;
+        report.unrecoverable = true;
+    }
+    if (!index_error.empty())
+    {
+        std::cerr << "Warning: scrub could not repair index entry " << id << ": " << index_error << std::endl;
+        report.unrecoverable = true;
+    }
+
+    report.replicas_repaired += repair_replicas(stale_blocks, block.data(), total_block_size_);
+    report.replicas_repaired += repair_replicas(stale_entries, entry.data(), INDEX_ENTRY_SIZE);
+
+    if (!rebuilt.empty())
+    {
+        write_stripe_repairs(rebuilt);
+        report.rebuilt_from_parity = true;
+    }
+
+    return report;
+}
+
+uint64_t StorageCluster::get_foreground_request_count() const
+{
+    return foreground_requests_.load(std::memory_order_relaxed);
+}
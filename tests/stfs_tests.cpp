@@ -0,0 +1,1216 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stfs/block_cache.h>
+#include <stfs/codec.h>
+#include <stfs/fs.h>
+#include <stfs/ingest_queue.h>
+#include <stfs/io_uring_device.h>
+#include <stfs/ram_device.h>
+#include <unistd.h>
+
+// Regression checks run by ctest, every check formats its own RAM backed cluster,
+// the io_uring checks use scratch files on tmpfs.
+
+#define CHECK(condition)                                                                   \
+    do                                                                                     \
+    {                                                                                      \
+        if (!(condition))                                                                  \
+        {                                                                                  \
+            throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " #condition); \
+        }                                                                                  \
+    } while (0)
+
+#define PAYLOAD 64
+#define JOURNAL_BLOCKS 8
+
+using DeviceWrapper = std::function<std::unique_ptr<Device>(std::unique_ptr<Device>)>;
+
+static std::unique_ptr<StorageCluster> make_cluster(std::unique_ptr<RaidGovernor> governor, uint64_t devices, uint64_t blocks_per_device, std::vector<Device *> *formatted = nullptr,
+                                                    PayloadFormat format = PayloadFormat::Blocks, PayloadCodec codec = PayloadCodec::None, DeviceWrapper wrap = nullptr)
+{
+    ClusterStructsSizes sizes = {
+        .total_block_size = BLOCK_STATIC_SIZE + PAYLOAD,
+        .transaction_size = TRANSACTION_STATIC_SIZE + JOURNAL_BLOCKS * (BLOCK_STATIC_SIZE + PAYLOAD)};
+
+    auto cluster = std::make_unique<StorageCluster>(std::move(governor), sizes);
+
+    DeviceFormatter formatter = [blocks_per_device, formatted, wrap](const std::string &, uint64_t device_head_offset, uint8_t device_id) -> std::unique_ptr<Device>
+    {
+        auto device = RamDevice::format(device_head_offset, blocks_per_device, device_id);
+        if (formatted)
+        {
+            formatted->push_back(device.get());
+        }
+        return wrap ? wrap(std::move(device)) : std::move(device);
+    };
+
+    std::vector<DeviceFormatBlueprint> blueprints;
+    for (uint64_t i = 0; i < devices; ++i)
+    {
+        blueprints.push_back({"ram" + std::to_string(i), formatter});
+    }
+
+    cluster->format_cluster(blueprints, PAYLOAD, format, codec);
+    return cluster;
+}
+
+static Block make_block(uint64_t timestamp, size_t payload_size = PAYLOAD)
+{
+    return {timestamp, payload_size, std::vector<char>(payload_size, static_cast<char>('a' + timestamp % 26)), 0};
+}
+
+template <typename Call>
+static bool throws_cluster_error(Call call)
+{
+    try
+    {
+        call();
+    }
+    catch (const ClusterError &)
+    {
+        return true;
+    }
+    return false;
+}
+
+static void oversized_blocks_are_rejected()
+{
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 64);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+
+    fs.add_block(make_block(1));
+
+    Block oversized = make_block(2, 200);
+    Block mismatched = make_block(3);
+    mismatched.payload.resize(PAYLOAD + 1);
+    std::vector<Block> batch = {make_block(4), make_block(5, PAYLOAD * 2)};
+
+    CHECK(throws_cluster_error([&] { fs.add_block(oversized); }));
+    CHECK(throws_cluster_error([&] { fs.add_block(mismatched); }));
+    CHECK(throws_cluster_error([&] { fs.add_blocks(batch); }));
+
+    // nothing of the rejected calls was logged or written
+    CHECK(cluster->get_state().total_writes_count == 1);
+    CHECK(fs.get_block_by_timestamp(1).payload == make_block(1).payload);
+}
+
+static void block_crc_covers_serialized_bytes()
+{
+    for (size_t payload_size : {PAYLOAD / 2, PAYLOAD, PAYLOAD * 2})
+    {
+        Block block = make_block(7, payload_size);
+        block.block_payload_size = PAYLOAD;
+        block.update_crc();
+
+        std::vector<char> serialized(BLOCK_STATIC_SIZE + PAYLOAD + 16, 'x');
+        block.serialize_into(serialized.data());
+
+        BlockView view(serialized.data(), BLOCK_STATIC_SIZE + PAYLOAD);
+        CHECK(view.is_valid());
+        CHECK(serialized[BLOCK_STATIC_SIZE + PAYLOAD] == 'x');
+    }
+}
+
+// after every lap position, each valid block survives the loss of one disk (two for RAID6)
+static void parity_survives_disk_loss_after_wrap()
+{
+    for (uint64_t parity : {1, 2})
+    {
+        for (uint64_t extra = 0; extra < 8; ++extra)
+        {
+            std::vector<Device *> devices;
+            auto cluster = make_cluster(parity == 1 ? std::unique_ptr<RaidGovernor>(std::make_unique<Raid5>()) : std::make_unique<Raid6>(), 4, 8, &devices);
+            Journal journal(*cluster);
+            Fs fs(*cluster, journal);
+
+            uint64_t capacity = cluster->get_head().total_blocks;
+            for (uint64_t i = 0; i < capacity * 2 + extra; ++i)
+            {
+                fs.add_block(make_block(i));
+            }
+
+            std::vector<char> garbage(8 * cluster->get_total_block_size(), static_cast<char>(0xA5));
+            for (uint64_t lost = 0; lost < parity; ++lost)
+            {
+                devices[lost]->write(cluster->get_head().data_offset, garbage.data(), garbage.size());
+            }
+
+            RingBufferState ring = cluster->get_ring_buffer_state();
+            std::vector<char> buffer(cluster->get_total_block_size());
+
+            CHECK(ring.count > 0);
+            for (uint64_t logical = 0; logical < ring.count; ++logical)
+            {
+                fs.get_block_view_by_id((ring.head_id + logical) % ring.capacity, buffer);
+            }
+        }
+    }
+}
+
+// with pipelined commits the state may reach the disk while the data of its transaction does not
+static void recovery_replays_blocks_missing_behind_the_state()
+{
+    std::vector<Device *> devices;
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 64, &devices);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+
+    CHECK(cluster->get_journal_slots() > 1);
+    for (uint64_t i = 1; i <= 3; ++i)
+    {
+        fs.add_block(make_block(i));
+    }
+
+    std::vector<char> garbage(3 * cluster->get_total_block_size(), static_cast<char>(0xA5));
+    for (Device *device : devices)
+    {
+        device->write(cluster->get_head().data_offset, garbage.data(), garbage.size());
+    }
+
+    journal.recover_transaction();
+
+    CHECK(cluster->get_state().total_writes_count == 3);
+    for (uint64_t i = 1; i <= 3; ++i)
+    {
+        CHECK(fs.get_block_by_timestamp(i).payload == make_block(i).payload);
+    }
+}
+
+static void deferred_checkpoints_need_an_index()
+{
+    auto indexed = make_cluster(std::make_unique<Raid1>(), 2, 64);
+    indexed->set_state_checkpoint_policy({.max_blocks = 16, .max_age = std::chrono::milliseconds(100)});
+
+    // a cluster that is not formatted yet has no index region
+    StorageCluster bare(std::make_unique<Raid1>(), {.total_block_size = BLOCK_STATIC_SIZE + PAYLOAD, .transaction_size = 4096});
+    CHECK(!bare.has_index());
+    bare.set_state_checkpoint_policy({});
+    CHECK(throws_cluster_error([&] { bare.set_state_checkpoint_policy({.max_blocks = 16}); }));
+    CHECK(throws_cluster_error([&] { bare.set_state_checkpoint_policy({.max_blocks = 0}); }));
+    CHECK(throws_cluster_error([&] { bare.set_state_checkpoint_policy({.max_blocks = 1, .max_age = std::chrono::milliseconds(5)}); }));
+}
+
+// more disks than PerDiskList holds inline
+static void wide_clusters_map_every_disk()
+{
+    std::vector<DiskLayout> layout;
+    for (uint64_t disk = 0; disk < PER_DISK_INLINE_CAPACITY + 4; ++disk)
+    {
+        layout.push_back({static_cast<uint8_t>(disk), 8});
+    }
+
+    PhysicalLocations mirrors = Raid1().map_logical_to_physical(3, layout);
+    CHECK(mirrors.size() == layout.size());
+    for (size_t i = 0; i < mirrors.size(); ++i)
+    {
+        CHECK(mirrors[i].disk_id == layout[i].disk_id && mirrors[i].block_id_on_disk == 3);
+    }
+
+    PhysicalLocations copy = mirrors;
+    CHECK(copy.back().disk_id == layout.back().disk_id && copy.data() != mirrors.data());
+
+    auto cluster = make_cluster(std::make_unique<Raid6>(), layout.size(), 8);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+
+    fs.add_block(make_block(1));
+    CHECK(fs.get_block_by_timestamp(1).payload == make_block(1).payload);
+}
+
+static void record_order_survives_reopen()
+{
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 64, nullptr, PayloadFormat::PackedRecords);
+    Journal journal(*cluster);
+    std::string data(40, 'r');
+
+    {
+        Fs fs(*cluster, journal);
+        fs.append_record(10, data);
+        fs.append_record(20, data);
+    }
+
+    Fs fs(*cluster, journal);
+    CHECK(throws_cluster_error([&] { fs.append_record(15, data); }));
+    fs.append_record(20, data);
+    fs.append_record(30, data);
+}
+
+static void scrub_repairs_damaged_copies()
+{
+    for (bool parity : {false, true})
+    {
+        std::vector<Device *> devices;
+        auto cluster = make_cluster(parity ? std::unique_ptr<RaidGovernor>(std::make_unique<Raid5>()) : std::make_unique<Raid1>(), parity ? 4 : 2, 8, &devices);
+        Journal journal(*cluster);
+        Fs fs(*cluster, journal);
+
+        uint64_t blocks = parity ? 6 : 3;
+        for (uint64_t i = 0; i < blocks; ++i)
+        {
+            fs.add_block(make_block(i));
+        }
+
+        // the first row of the second device holds block 0 on RAID1 and a data block of stripe 0 on RAID5
+        std::vector<char> garbage(cluster->get_total_block_size(), static_cast<char>(0xA5));
+        devices[1]->write(cluster->get_head().data_offset, garbage.data(), garbage.size());
+
+        DataValidator is_valid_block = [](const char *data, size_t size) { return BlockView(data, size).is_valid(); };
+        ScrubReport repaired{};
+        for (uint64_t id = 0; id < blocks; ++id)
+        {
+            ScrubReport report = cluster->scrub_block(id, is_valid_block);
+            CHECK(!report.unrecoverable);
+            repaired.replicas_repaired += report.replicas_repaired;
+            repaired.rebuilt_from_parity |= report.rebuilt_from_parity;
+        }
+        CHECK(parity ? repaired.rebuilt_from_parity : repaired.replicas_repaired == 1);
+
+        // the repair reached the disk, a second pass finds nothing to do
+        for (uint64_t id = 0; id < blocks; ++id)
+        {
+            ScrubReport report = cluster->scrub_block(id, is_valid_block);
+            CHECK(!report.unrecoverable && report.replicas_repaired == 0 && !report.rebuilt_from_parity);
+            CHECK(fs.get_block_by_id(id).payload == make_block(id).payload);
+        }
+    }
+}
+
+static std::vector<char> random_bytes(size_t size, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<char> data(size);
+    for (char &byte : data)
+    {
+        byte = static_cast<char>(random());
+    }
+    return data;
+}
+
+// encodes data in one append and checks the output decodes back to it
+static std::vector<char> lz_round_trip(std::span<const char> data, size_t budget = SIZE_MAX)
+{
+    LzEncoder encoder;
+    size_t taken = encoder.append(data, budget);
+
+    std::vector<char> output(encoder.output().begin(), encoder.output().end());
+    std::vector<char> decoded(taken);
+
+    CHECK(output.size() <= budget);
+    CHECK(std::equal(encoder.raw().begin(), encoder.raw().end(), data.begin(), data.begin() + taken));
+    CHECK(decode_block(PayloadCodec::Lz, output, decoded));
+    CHECK(std::equal(decoded.begin(), decoded.end(), data.begin()));
+    return output;
+}
+
+static size_t extra_length_bytes(size_t length)
+{
+    return length < 15 ? 0 : (length - 15) / 255 + 1;
+}
+
+static void lz_round_trips()
+{
+    std::vector<char> noise = random_bytes(4096, 1);
+    CHECK(lz_round_trip(noise).size() == 1 + extra_length_bytes(noise.size()) + noise.size());
+
+    std::vector<char> zeros(5000, 0);
+    CHECK(lz_round_trip(zeros).size() < 64);
+
+    std::string repeated;
+    for (int i = 0; i < 200; ++i)
+    {
+        repeated += "timestamp=" + std::to_string(1000 + i % 7) + ";";
+    }
+    CHECK(lz_round_trip(repeated).size() < repeated.size() / 4);
+
+    // literal runs and matches whose length lands on both sides of the 15 and 270 extra byte boundaries,
+    // a match longer than its offset overlaps the bytes it produces
+    for (size_t literals : {14, 15, 16, 269, 270, 271})
+    {
+        for (size_t match_extra : {14, 15, 16, 269, 270, 271})
+        {
+            std::vector<char> data = random_bytes(literals, literals);
+            for (size_t i = 0; i < match_extra + 3; ++i)
+            {
+                data.push_back(data[i % literals]);
+            }
+
+            std::vector<char> output = lz_round_trip(data);
+            CHECK(output.size() == 1 + extra_length_bytes(literals) + literals + sizeof(uint16_t) + extra_length_bytes(match_extra));
+        }
+    }
+
+    // every budget cuts the stream somewhere, the prefix taken still decodes
+    std::vector<char> mixed = random_bytes(300, 2);
+    mixed.insert(mixed.end(), mixed.begin(), mixed.begin() + 280);
+    mixed.insert(mixed.end(), 300, 'z');
+    for (size_t budget = 0; budget < 700; ++budget)
+    {
+        lz_round_trip(mixed, budget);
+    }
+
+    // later appends match against earlier ones, a full block takes nothing more
+    std::vector<char> record = random_bytes(1000, 4);
+    LzEncoder encoder;
+    CHECK(encoder.append(record, SIZE_MAX) == record.size());
+    size_t first_output = encoder.output().size();
+    CHECK(encoder.append(record, SIZE_MAX) == record.size());
+    CHECK(encoder.output().size() - first_output < 16);
+    CHECK(encoder.append(noise, encoder.output().size()) == 0);
+
+    std::vector<char> decoded(encoder.raw().size());
+    CHECK(decode_block(PayloadCodec::Lz, encoder.output(), decoded));
+    CHECK(std::equal(decoded.begin(), decoded.end(), encoder.raw().begin()));
+}
+
+static void lz_rejects_damaged_input()
+{
+    std::vector<char> data = random_bytes(300, 3);
+    data.insert(data.end(), data.begin(), data.begin() + 290);
+    std::vector<char> output = lz_round_trip(data);
+    std::vector<char> decoded(data.size());
+
+    for (size_t size = 0; size < output.size(); ++size)
+    {
+        CHECK(!decode_block(PayloadCodec::Lz, std::span<const char>(output.data(), size), decoded));
+    }
+
+    std::vector<char> larger(data.size() + 1);
+    std::vector<char> smaller(data.size() - 1);
+    CHECK(!decode_block(PayloadCodec::Lz, output, larger));
+    CHECK(!decode_block(PayloadCodec::Lz, output, smaller));
+
+    std::vector<char> out(64);
+    auto rejects = [&out](std::vector<unsigned char> input)
+    {
+        return !decode_block(PayloadCodec::Lz, std::span<const char>(reinterpret_cast<const char *>(input.data()), input.size()), out);
+    };
+
+    CHECK(rejects({0x41, 'a', 'b', 'c', 'd', 0x00, 0x00}));       // zero offset
+    CHECK(rejects({0x41, 'a', 'b', 'c', 'd', 0x05, 0x00}));       // offset before the start
+    CHECK(rejects({0x41, 'a', 'b', 'c', 'd', 0x04}));             // offset cut short
+    CHECK(rejects({0x50, 'a', 'b'}));                             // literals past the input
+    CHECK(rejects({0xF0, 0xFF, 0xFF}));                           // extra length runs off the end
+    CHECK(rejects({0x4F, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x60})); // match past the output
+}
+
+static void record_block_packs_fragments()
+{
+    RecordBlockBuilder builder(256);
+    std::string first(20, 'a');
+    std::string second(30, 'b');
+    std::vector<char> large = random_bytes(400, 5);
+
+    CHECK(builder.add(10, first, false) == first.size());
+    CHECK(builder.add(20, second, false) == second.size());
+
+    // the large record takes what is left and continues in the next block
+    size_t taken = builder.add(30, large, false).value();
+    CHECK(taken > 0 && taken < large.size());
+
+    Block sealed = builder.seal();
+    CHECK(sealed.timestamp == 30);
+    CHECK(builder.empty());
+
+    RecordBlockView view(sealed.payload);
+    CHECK(view.is_well_formed() && view.size() == 3);
+    CHECK(view.fragment(0).kind == FragmentKind::Whole && view.fragment(0).timestamp == 10);
+    CHECK(std::equal(view.fragment(1).data.begin(), view.fragment(1).data.end(), second.begin(), second.end()));
+    CHECK(view.fragment(2).kind == FragmentKind::First && view.fragment(2).data.size() == taken);
+    CHECK(view.lower_bound(0) == 0 && view.lower_bound(11) == 1 && view.lower_bound(30) == 2 && view.lower_bound(31) == 3);
+
+    std::vector<FragmentKind> kinds;
+    std::vector<char> reassembled(large.begin(), large.begin() + taken);
+    while (taken < large.size())
+    {
+        size_t size = builder.add(30, std::span<const char>(large).subspan(taken), true).value();
+        Block block = builder.seal();
+        RecordBlockView continuation(block.payload);
+
+        CHECK(continuation.size() == 1 && continuation.fragment(0).timestamp == 30);
+        kinds.push_back(continuation.fragment(0).kind);
+        reassembled.insert(reassembled.end(), continuation.fragment(0).data.begin(), continuation.fragment(0).data.end());
+        taken += size;
+    }
+    CHECK(kinds.size() >= 2 && kinds.front() == FragmentKind::Middle && kinds.back() == FragmentKind::Last);
+    CHECK(reassembled == large);
+
+    std::vector<char> garbage(256, static_cast<char>(0xFF));
+    CHECK(!RecordBlockView(garbage).is_well_formed());
+}
+
+static void records_reassemble_across_blocks()
+{
+    for (PayloadCodec codec : {PayloadCodec::None, PayloadCodec::Lz})
+    {
+        auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 256, nullptr, PayloadFormat::PackedRecords, codec);
+        Journal journal(*cluster);
+        Fs fs(*cluster, journal);
+
+        // sizes from a few bytes to several blocks, timestamps repeat
+        std::vector<Record> written;
+        for (uint64_t i = 0; i < 40; ++i)
+        {
+            uint64_t timestamp = 100 + (i / 2) * 10;
+            written.push_back({timestamp, random_bytes(i % 5 == 0 ? 150 + i : 5 + i, i)});
+            fs.append_record(timestamp, written.back().data);
+        }
+        fs.flush_records();
+
+        auto collect = [&fs](uint64_t from, uint64_t to)
+        {
+            std::vector<Record> records;
+            RecordScanner scanner = fs.scan_records(from, to);
+            while (std::optional<Record> record = scanner.next())
+            {
+                records.push_back(std::move(*record));
+            }
+            return records;
+        };
+
+        auto expected = [&written](uint64_t from, uint64_t to)
+        {
+            std::vector<Record> records;
+            std::copy_if(written.begin(), written.end(), std::back_inserter(records), [from, to](const Record &record)
+                         { return record.timestamp >= from && record.timestamp <= to; });
+            return records;
+        };
+
+        auto same = [](const std::vector<Record> &a, const std::vector<Record> &b)
+        {
+            return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const Record &x, const Record &y)
+                              { return x.timestamp == y.timestamp && x.data == y.data; });
+        };
+
+        CHECK(same(collect(0, UINT64_MAX), written));
+        CHECK(same(collect(150, 150), expected(150, 150)));
+        CHECK(same(collect(151, 209), expected(151, 209)));
+        CHECK(same(collect(100, 100), expected(100, 100)));
+        CHECK(same(collect(290, UINT64_MAX), expected(290, UINT64_MAX)));
+        CHECK(collect(291, UINT64_MAX).empty());
+        CHECK(collect(0, 99).empty());
+
+        CHECK(fs.get_record_by_timestamp(0)->data == written.front().data);
+        CHECK(fs.get_record_by_timestamp(151)->data == expected(160, 160).front().data);
+        CHECK(!fs.get_record_by_timestamp(291));
+    }
+}
+
+// once the ring overwrites the first blocks of a record, its remaining fragments are skipped
+static void records_missing_their_start_are_skipped()
+{
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 16, nullptr, PayloadFormat::PackedRecords);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+    uint64_t capacity = cluster->get_head().total_blocks;
+
+    std::vector<char> large = random_bytes(200, 6);
+    fs.append_record(1, large);
+    fs.flush_records();
+
+    uint64_t large_blocks = cluster->get_state().total_writes_count;
+    CHECK(large_blocks > 3);
+
+    std::vector<Record> written;
+    for (uint64_t timestamp = 2; cluster->get_state().total_writes_count < capacity + 2; ++timestamp)
+    {
+        written.push_back({timestamp, random_bytes(20, timestamp)});
+        fs.append_record(timestamp, written.back().data);
+        fs.flush_records();
+    }
+
+    // the ring still starts inside the large record
+    ClusterState state = cluster->get_state();
+    CHECK(state.total_writes_count - state.valid_block_count < large_blocks);
+
+    RecordScanner scanner = fs.scan_records(0, UINT64_MAX);
+    for (const Record &record : written)
+    {
+        std::optional<Record> read = scanner.next();
+        CHECK(read && read->timestamp == record.timestamp && read->data == record.data);
+    }
+    CHECK(!scanner.next());
+    CHECK(fs.get_record_by_timestamp(0)->timestamp == 2);
+}
+
+// holds every device write while closed, so a test can keep the cluster writer busy
+struct WriteGate
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool open = true;
+    uint64_t waiting = 0;
+
+    void set_open(bool value)
+    {
+        std::lock_guard lock(mutex);
+        open = value;
+        changed.notify_all();
+    }
+
+    void pass()
+    {
+        std::unique_lock lock(mutex);
+        waiting++;
+        changed.notify_all();
+        changed.wait(lock, [this] { return open; });
+        waiting--;
+    }
+
+    void wait_for_writer()
+    {
+        std::unique_lock lock(mutex);
+        changed.wait(lock, [this] { return waiting > 0; });
+    }
+};
+
+class GatedDevice : public Device
+{
+private:
+    std::unique_ptr<Device> device_;
+    WriteGate &gate_;
+public:
+    GatedDevice(std::unique_ptr<Device> device, WriteGate &gate) : device_(std::move(device)), gate_(gate) {}
+
+    const DeviceHead &get_head() const override { return device_->get_head(); }
+    void read_into(size_t position, std::span<char> buffer) override { device_->read_into(position, buffer); }
+    void sync() override { device_->sync(); }
+
+    void write(size_t position, const char *data, size_t size) override
+    {
+        gate_.pass();
+        device_->write(position, data, size);
+    }
+};
+
+static Block make_producer_block(uint64_t producer, uint64_t index)
+{
+    Block block = make_block(producer * 1000 + index);
+    std::memcpy(block.payload.data(), &producer, sizeof(producer));
+    std::memcpy(block.payload.data() + sizeof(producer), &index, sizeof(index));
+    return block;
+}
+
+static void ingest_queue_commits_every_producer_in_order()
+{
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 1024);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+
+    const uint64_t producers = 4;
+    const uint64_t per_producer = 200;
+
+    {
+        IngestQueue queue(fs, {.capacity = 16});
+        std::vector<std::thread> threads;
+        std::atomic<uint64_t> failures = 0;
+
+        for (uint64_t producer = 0; producer < producers; ++producer)
+        {
+            threads.emplace_back([&queue, &failures, producer, per_producer]
+                                 {
+                std::vector<std::future<void>> committed;
+                for (uint64_t index = 0; index < per_producer; ++index)
+                {
+                    Block block = make_producer_block(producer, index);
+                    if (index % 2 == 0)
+                    {
+                        committed.push_back(queue.submit(std::move(block)));
+                        continue;
+                    }
+                    std::optional<std::future<void>> queued;
+                    while (!(queued = queue.try_submit(std::move(block))))
+                    {
+                        std::this_thread::yield();
+                    }
+                    committed.push_back(std::move(*queued));
+                }
+                for (auto &future : committed)
+                {
+                    try
+                    {
+                        future.get();
+                    }
+                    catch (...)
+                    {
+                        failures++;
+                    }
+                } });
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK(failures == 0);
+        CHECK(queue.get_stats().blocks_committed == producers * per_producer && queue.get_stats().blocks_failed == 0);
+    }
+
+    RingBufferState ring = cluster->get_ring_buffer_state();
+    CHECK(ring.count == producers * per_producer);
+
+    std::vector<uint64_t> next(producers, 0);
+    for (uint64_t logical = 0; logical < ring.count; ++logical)
+    {
+        Block block = fs.get_block_by_id((ring.head_id + logical) % ring.capacity);
+        uint64_t producer;
+        uint64_t index;
+        std::memcpy(&producer, block.payload.data(), sizeof(producer));
+        std::memcpy(&index, block.payload.data() + sizeof(producer), sizeof(index));
+
+        CHECK(producer < producers && index == next[producer]);
+        next[producer]++;
+    }
+}
+
+static void ingest_queue_applies_back_pressure_and_drains_on_stop()
+{
+    WriteGate gate;
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 64, nullptr, PayloadFormat::Blocks, PayloadCodec::None,
+                                [&gate](std::unique_ptr<Device> device) { return std::make_unique<GatedDevice>(std::move(device), gate); });
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+    IngestQueue queue(fs, {.capacity = 4});
+
+    // the writer takes the first block and stalls on the device, the queue then holds four more
+    gate.set_open(false);
+    std::vector<std::future<void>> committed;
+    committed.push_back(queue.submit(make_block(1)));
+    gate.wait_for_writer();
+
+    for (uint64_t timestamp = 2; timestamp <= 5; ++timestamp)
+    {
+        std::optional<std::future<void>> queued = queue.try_submit(make_block(timestamp));
+        CHECK(queued);
+        committed.push_back(std::move(*queued));
+    }
+
+    Block refused = make_block(6);
+    CHECK(!queue.try_submit(std::move(refused)));
+    CHECK(refused.payload.size() == PAYLOAD);
+
+    std::atomic<bool> submitted = false;
+    std::future<void> waiting_commit;
+    std::thread producer([&]
+                         {
+        waiting_commit = queue.submit(make_block(6));
+        submitted = true; });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(!submitted);
+
+    // stop waits for the waiting producer, opening the gate lets everything through
+    std::thread stopper([&queue] { queue.stop(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    gate.set_open(true);
+
+    producer.join();
+    stopper.join();
+
+    CHECK(submitted);
+    committed.push_back(std::move(waiting_commit));
+    for (auto &future : committed)
+    {
+        CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        future.get();
+    }
+
+    CHECK(queue.get_stats().blocks_committed == 6);
+    CHECK(cluster->get_state().total_writes_count == 6);
+    CHECK(throws_cluster_error([&] { queue.submit(make_block(7)); }));
+}
+
+static void block_cache_refuses_inserts_behind_an_invalidation()
+{
+    BlockCache cache(1);
+    cache.set_capacity(1 << 20);
+
+    std::vector<char> old_data(PAYLOAD, 'o');
+    std::vector<char> new_data(PAYLOAD, 'n');
+    std::vector<char> out(PAYLOAD);
+    uint64_t epoch;
+
+    // the reader misses, the writer replaces the block, the reader's copy is now stale
+    CHECK(!cache.lookup(7, out, epoch));
+    cache.invalidate(7);
+    cache.insert(7, old_data, epoch);
+
+    uint64_t fresh_epoch;
+    CHECK(!cache.lookup(7, out, fresh_epoch));
+    cache.insert(7, new_data, fresh_epoch);
+    CHECK(cache.lookup(7, out, epoch) && out == new_data);
+
+    // an invalidation anywhere in the shard also refuses the insert
+    CHECK(!cache.lookup(8, out, epoch));
+    cache.invalidate(9);
+    cache.insert(8, old_data, epoch);
+    CHECK(!cache.lookup(8, out, epoch));
+    CHECK(cache.get_stats().insertions == 1);
+}
+
+static void block_cache_evicts_within_its_byte_budget()
+{
+    const size_t charge = PAYLOAD + BLOCK_CACHE_ENTRY_OVERHEAD;
+    BlockCache cache(1);
+    cache.set_capacity(4 * charge);
+
+    std::vector<char> data(PAYLOAD, 'd');
+    std::vector<char> out(PAYLOAD);
+    uint64_t epoch;
+
+    for (uint64_t key = 0; key < 4; ++key)
+    {
+        CHECK(!cache.lookup(key, out, epoch));
+        cache.insert(key, data, epoch);
+    }
+    CHECK(cache.get_stats().entries == 4 && cache.get_stats().bytes == 4 * charge);
+
+    // blocks read since the last sweep get a second chance, the hand takes the first unreferenced one
+    CHECK(cache.lookup(0, out, epoch) && cache.lookup(1, out, epoch));
+    CHECK(!cache.lookup(4, out, epoch));
+    cache.insert(4, data, epoch);
+
+    BlockCacheStats stats = cache.get_stats();
+    CHECK(stats.entries == 4 && stats.bytes == 4 * charge && stats.evictions == 1);
+    CHECK(cache.lookup(0, out, epoch) && cache.lookup(1, out, epoch) && cache.lookup(3, out, epoch) && cache.lookup(4, out, epoch));
+    CHECK(!cache.lookup(2, out, epoch));
+
+    // an entry larger than the budget is never cached
+    std::vector<char> large(4 * charge);
+    CHECK(!cache.lookup(5, large, epoch));
+    cache.insert(5, large, epoch);
+    CHECK(cache.get_stats().entries == 4);
+
+    // shrinking evicts down to the new budget, 0 drops everything and disables lookups
+    cache.set_capacity(2 * charge);
+    CHECK(cache.get_stats().entries == 2 && cache.get_stats().bytes == 2 * charge);
+
+    cache.set_capacity(0);
+    CHECK(cache.get_stats().entries == 0 && cache.get_stats().bytes == 0);
+    cache.insert(6, data, epoch);
+    CHECK(!cache.lookup(6, out, epoch) && cache.get_stats().entries == 0);
+
+    cache.set_capacity(4 * charge);
+    CHECK(!cache.lookup(6, out, epoch));
+    cache.insert(6, data, epoch);
+    CHECK(cache.lookup(6, out, epoch));
+}
+
+// readers racing the writer over a small ring must never leave an overwritten block in the cache
+static void block_cache_stays_current_under_concurrent_writes()
+{
+    auto cluster = make_cluster(std::make_unique<Raid1>(), 2, 16);
+    Journal journal(*cluster);
+    Fs fs(*cluster, journal);
+    cluster->set_block_cache_capacity(1 << 20);
+
+    uint64_t capacity = cluster->get_head().total_blocks;
+    std::atomic<bool> writing = true;
+    std::vector<std::thread> readers;
+
+    for (uint64_t reader = 0; reader < 4; ++reader)
+    {
+        readers.emplace_back([&, reader]
+                             {
+            std::vector<char> buffer(cluster->get_total_block_size());
+            for (uint64_t i = reader; writing; ++i)
+            {
+                try
+                {
+                    fs.get_block_view_by_id(i % capacity, buffer);
+                }
+                catch (const ClusterError &)
+                {
+                }
+            } });
+    }
+
+    for (uint64_t timestamp = 0; timestamp < 3000; ++timestamp)
+    {
+        fs.add_block(make_block(timestamp));
+    }
+    writing = false;
+
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+
+    ClusterState state = cluster->get_state();
+    RingBufferState ring = cluster->get_ring_buffer_state();
+    std::vector<char> buffer(cluster->get_total_block_size());
+
+    for (uint64_t logical = 0; logical < ring.count; ++logical)
+    {
+        uint64_t expected = state.total_writes_count - state.valid_block_count + logical;
+        CHECK(fs.get_block_view_by_id((ring.head_id + logical) % ring.capacity, buffer).timestamp() == expected);
+    }
+    CHECK(cluster->get_block_cache_stats().hits > 0);
+}
+
+#ifdef __linux__
+
+// removed again when the check ends, on tmpfs when the system has one
+struct ScratchFile
+{
+    std::string path;
+
+    explicit ScratchFile(const std::string &name)
+    {
+        std::filesystem::path dir = std::filesystem::is_directory("/dev/shm") ? std::filesystem::path("/dev/shm") : std::filesystem::temp_directory_path();
+        path = (dir / ("stfs_tests_" + std::to_string(getpid()) + "_" + name)).string();
+    }
+
+    ~ScratchFile()
+    {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+};
+
+// null when the kernel refuses io_uring, or O_DIRECT on the scratch file system; the check is then skipped
+static std::unique_ptr<Device> format_uring_device(const std::string &path, uint64_t blocks, uint8_t disk_id, const IoUringOptions &options)
+{
+    try
+    {
+        return IoUringDevice::format(path, 0, blocks, disk_id, options);
+    }
+    catch (const DeviceError &e)
+    {
+        std::string error = e.what();
+        if (!error.starts_with("Failed to set up io_uring") && !(options.direct_io && error.starts_with("Failed to open or create device file")))
+        {
+            throw;
+        }
+
+        std::cout << "     skipped, " << error << std::endl;
+        return nullptr;
+    }
+}
+
+// 4 KiB aligned, so requests inside it satisfy O_DIRECT
+static std::unique_ptr<char, decltype(&std::free)> aligned_buffer(size_t size)
+{
+    return {static_cast<char *>(std::aligned_alloc(4096, size)), &std::free};
+}
+
+static bool throws_device_error(const std::function<void()> &call)
+{
+    try
+    {
+        call();
+    }
+    catch (const DeviceError &)
+    {
+        return true;
+    }
+    return false;
+}
+
+static void io_uring_device_round_trips()
+{
+    ScratchFile file("round_trip");
+    auto device = format_uring_device(file.path, 16, 3, {.queue_depth = 4});
+    if (!device)
+    {
+        return;
+    }
+
+    std::vector<char> data = random_bytes(20000, 3);
+    device->write(DEVICE_HEAD_SIZE, data.data(), data.size());
+
+    std::vector<char> patch = random_bytes(5000, 4);
+    device->write(4000, patch.data(), patch.size());
+    std::copy(patch.begin(), patch.end(), data.begin() + (4000 - DEVICE_HEAD_SIZE));
+    device->sync();
+
+    std::vector<char> read_back(data.size());
+    device->read_into(DEVICE_HEAD_SIZE, read_back);
+    CHECK(read_back == data);
+    CHECK(throws_device_error([&] { device->read(DEVICE_HEAD_SIZE + data.size(), 1); }));
+
+    device.reset();
+    auto reopened = IoUringDevice::open(file.path, 0);
+    CHECK(reopened->get_head().total_blocks_on_disk == 16);
+    CHECK(reopened->get_head().disk_id == 3);
+
+    std::fill(read_back.begin(), read_back.end(), 0);
+    reopened->read_into(DEVICE_HEAD_SIZE, read_back);
+    CHECK(read_back == data);
+}
+
+// a queue of one slot holds every submitter until the previous request completed
+static void io_uring_device_applies_back_pressure()
+{
+    ScratchFile file("back_pressure");
+    auto device = format_uring_device(file.path, 16, 1, {.queue_depth = 1});
+    if (!device)
+    {
+        return;
+    }
+
+    const size_t threads = 4;
+    const size_t writes = 64;
+    const size_t chunk = 777;
+    std::vector<char> data = random_bytes(threads * writes * chunk, 5);
+
+    std::vector<std::thread> submitters;
+    std::atomic<size_t> failures = 0;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        submitters.emplace_back([&, t]
+                                {
+            try
+            {
+                std::vector<std::future<void>> pending;
+                for (size_t i = t; i < threads * writes; i += threads)
+                {
+                    pending.push_back(device->write_async(DEVICE_HEAD_SIZE + i * chunk, data.data() + i * chunk, chunk));
+                }
+                for (auto &done : pending)
+                {
+                    done.get();
+                }
+            }
+            catch (const std::exception &)
+            {
+                failures++;
+            } });
+    }
+    for (auto &submitter : submitters)
+    {
+        submitter.join();
+    }
+    CHECK(failures == 0);
+
+    std::vector<std::vector<char>> chunks(threads * writes, std::vector<char>(chunk));
+    std::vector<std::future<void>> reads;
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        reads.push_back(device->read_async(DEVICE_HEAD_SIZE + i * chunk, chunks[i]));
+    }
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        reads[i].get();
+        CHECK(std::equal(chunks[i].begin(), chunks[i].end(), data.begin() + i * chunk));
+    }
+}
+
+// the kernel rejects a fixed-buffer request outside the registered buffer, so requests straddling
+// its end have to fall back to the plain opcodes
+static void io_uring_device_uses_registered_buffers()
+{
+    ScratchFile file("registered");
+    auto formatted = format_uring_device(file.path, 16, 1, {.queue_depth = 8});
+    if (!formatted)
+    {
+        return;
+    }
+    auto &device = static_cast<IoUringDevice &>(*formatted);
+
+    const size_t size = 64 * 1024;
+    auto registered = aligned_buffer(size);
+    std::vector<char> data = random_bytes(size, 6);
+    std::copy(data.begin(), data.end(), registered.get());
+    device.register_buffer({registered.get(), size});
+
+    std::vector<std::future<void>> pending;
+    for (size_t offset = 0; offset < size; offset += 8192)
+    {
+        pending.push_back(device.write_async(4096 + offset, registered.get() + offset, 8192));
+    }
+    for (auto &done : pending)
+    {
+        done.get();
+    }
+
+    std::fill(registered.get(), registered.get() + size, 0);
+    device.read_into(4096, {registered.get() + 100, size - 100});
+    CHECK(std::equal(data.begin(), data.end() - 100, registered.get() + 100));
+
+    // starts inside the registered buffer and ends outside of it
+    std::vector<char> straddling(size + 1000);
+    device.register_buffer({straddling.data(), size});
+    device.read_into(4096, {straddling.data() + 1000, size});
+    CHECK(std::equal(data.begin(), data.end(), straddling.begin() + 1000));
+
+    device.unregister_buffer();
+    std::vector<char> plain(size);
+    device.read_into(4096, plain);
+    CHECK(plain == data);
+}
+
+// block sized requests are neither sector aligned nor sector sized, adjacent ones share edge sectors
+static void io_uring_device_direct_io_handles_unaligned_requests()
+{
+    ScratchFile file("direct");
+    auto device = format_uring_device(file.path, 16, 1, {.queue_depth = 8, .direct_io = true});
+    if (!device)
+    {
+        return;
+    }
+
+    std::mt19937 random(7);
+    std::vector<char> expected(256 * 1024);
+    size_t end = DEVICE_HEAD_SIZE;
+
+    for (size_t round = 0; round < 8; ++round)
+    {
+        std::vector<std::vector<char>> chunks;
+        std::vector<std::future<void>> pending;
+        size_t position = DEVICE_HEAD_SIZE + random() % 100;
+
+        while (true)
+        {
+            size_t length = 1 + random() % 3000;
+            if (position + length > expected.size())
+            {
+                break;
+            }
+
+            chunks.push_back(random_bytes(length, random()));
+            std::copy(chunks.back().begin(), chunks.back().end(), expected.begin() + position);
+            pending.push_back(device->write_async(position, chunks.back().data(), length));
+            position += length;
+        }
+        for (auto &done : pending)
+        {
+            done.get();
+        }
+        end = std::max(end, position);
+    }
+
+    // an aligned request from an aligned buffer goes to the ring as is
+    auto aligned = aligned_buffer(8192);
+    std::vector<char> sectors = random_bytes(8192, 8);
+    std::copy(sectors.begin(), sectors.end(), aligned.get());
+    device->write(8192, aligned.get(), 8192);
+    std::copy(sectors.begin(), sectors.end(), expected.begin() + 8192);
+
+    std::vector<char> read_back(end - DEVICE_HEAD_SIZE);
+    device->read_into(DEVICE_HEAD_SIZE, read_back);
+    CHECK(std::equal(read_back.begin(), read_back.end(), expected.begin() + DEVICE_HEAD_SIZE));
+
+    std::fill(aligned.get(), aligned.get() + 8192, 0);
+    device->read_into(8192, {aligned.get(), 8192});
+    CHECK(std::equal(sectors.begin(), sectors.end(), aligned.get()));
+
+    CHECK(throws_device_error([&] { device->read(end + 4096, 1); }));
+
+    device.reset();
+    auto buffered = IoUringDevice::open(file.path, 0);
+    std::fill(read_back.begin(), read_back.end(), 0);
+    buffered->read_into(DEVICE_HEAD_SIZE, read_back);
+    CHECK(std::equal(read_back.begin(), read_back.end(), expected.begin() + DEVICE_HEAD_SIZE));
+}
+
+static void io_uring_cluster_survives_reopen()
+{
+    std::vector<ScratchFile> files;
+    files.emplace_back("cluster0");
+    files.emplace_back("cluster1");
+
+    IoUringOptions options = {.queue_depth = 8, .direct_io = true};
+    if (!format_uring_device(files[0].path, 1, 0, options))
+    {
+        return;
+    }
+
+    ClusterStructsSizes sizes = {
+        .total_block_size = BLOCK_STATIC_SIZE + PAYLOAD,
+        .transaction_size = TRANSACTION_STATIC_SIZE + JOURNAL_BLOCKS * (BLOCK_STATIC_SIZE + PAYLOAD)};
+
+    {
+        StorageCluster cluster(std::make_unique<Raid1>(), sizes);
+        DeviceFormatter formatter = [&](const std::string &path, uint64_t device_head_offset, uint8_t device_id)
+        {
+            return IoUringDevice::format(path, device_head_offset, 64, device_id, options);
+        };
+        cluster.format_cluster({{files[0].path, formatter}, {files[1].path, formatter}}, PAYLOAD);
+
+        Journal journal(cluster);
+        Fs fs(cluster, journal);
+        for (uint64_t timestamp = 1; timestamp <= 40; ++timestamp)
+        {
+            fs.add_block(make_block(timestamp));
+        }
+    }
+
+    StorageCluster cluster(std::make_unique<Raid1>(), sizes);
+    DeviceOpener opener = [&](const std::string &path, uint64_t device_head_offset)
+    {
+        return IoUringDevice::open(path, device_head_offset, options);
+    };
+    cluster.open_cluster({{files[0].path, opener}, {files[1].path, opener}});
+
+    Journal journal(cluster);
+    Fs fs(cluster, journal);
+    CHECK(cluster.get_state().valid_block_count == 40);
+    for (uint64_t timestamp = 1; timestamp <= 40; ++timestamp)
+    {
+        CHECK(fs.get_block_by_timestamp(timestamp).payload == make_block(timestamp).payload);
+    }
+}
+
+#endif
+
+int main()
+{
+    const std::vector<std::pair<const char *, std::function<void()>>> checks = {
+        {"oversized_blocks_are_rejected", oversized_blocks_are_rejected},
+        {"block_crc_covers_serialized_bytes", block_crc_covers_serialized_bytes},
+        {"parity_survives_disk_loss_after_wrap", parity_survives_disk_loss_after_wrap},
+        {"recovery_replays_blocks_missing_behind_the_state", recovery_replays_blocks_missing_behind_the_state},
+        {"deferred_checkpoints_need_an_index", deferred_checkpoints_need_an_index},
+        {"wide_clusters_map_every_disk", wide_clusters_map_every_disk},
+        {"record_order_survives_reopen", record_order_survives_reopen},
+        {"scrub_repairs_damaged_copies", scrub_repairs_damaged_copies},
+        {"lz_round_trips", lz_round_trips},
+        {"lz_rejects_damaged_input", lz_rejects_damaged_input},
+        {"record_block_packs_fragments", record_block_packs_fragments},
+        {"records_reassemble_across_blocks", records_reassemble_across_blocks},
+        {"records_missing_their_start_are_skipped", records_missing_their_start_are_skipped},
+        {"ingest_queue_commits_every_producer_in_order", ingest_queue_commits_every_producer_in_order},
+        {"ingest_queue_applies_back_pressure_and_drains_on_stop", ingest_queue_applies_back_pressure_and_drains_on_stop},
+        {"block_cache_refuses_inserts_behind_an_invalidation", block_cache_refuses_inserts_behind_an_invalidation},
+        {"block_cache_evicts_within_its_byte_budget", block_cache_evicts_within_its_byte_budget},
+        {"block_cache_stays_current_under_concurrent_writes", block_cache_stays_current_under_concurrent_writes},
+#ifdef __linux__
+        {"io_uring_device_round_trips", io_uring_device_round_trips},
+        {"io_uring_device_applies_back_pressure", io_uring_device_applies_back_pressure},
+        {"io_uring_device_uses_registered_buffers", io_uring_device_uses_registered_buffers},
+        {"io_uring_device_direct_io_handles_unaligned_requests", io_uring_device_direct_io_handles_unaligned_requests},
+        {"io_uring_cluster_survives_reopen", io_uring_cluster_survives_reopen},
+#endif
+    };
+
+    int failed = 0;
+
+    for (const auto &[name, check] : checks)
+    {
+        try
+        {
+            check();
+            std::cout << "ok   " << name << std::endl;
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "FAIL " << name << ": " << e.what() << std::endl;
+            failed++;
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}